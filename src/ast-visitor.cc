@@ -0,0 +1,137 @@
+#include <string>
+#include <stdexcept>
+#include <utility>
+#include "include/ast.hh"
+
+using namespace ast;
+
+Node* Variable::accept(Visitor &v)       { return v.visit_variable(this); }
+Node* Access::accept(Visitor &v)         { return v.visit_access(this); }
+Node* InfixOperator::accept(Visitor &v)  { return v.visit_infix(this); }
+Node* PrefxOperator::accept(Visitor &v)  { return v.visit_prefix(this); }
+Node* VariableDecl::accept(Visitor &v)   { return v.visit_decl(this); }
+Node* DestructList::accept(Visitor &v)   { return v.visit_destruct(this); }
+Node* AssignVariable::accept(Visitor &v) { return v.visit_assign_variable(this); }
+Node* AssignAccess::accept(Visitor &v)   { return v.visit_assign_access(this); }
+Node* If::accept(Visitor &v)             { return v.visit_if(this); }
+Node* For::accept(Visitor &v)            { return v.visit_for(this); }
+Node* Block::accept(Visitor &v)          { return v.visit_block(this); }
+Node* Nil::accept(Visitor &v)            { return v.visit_nil(this); }
+Node* Number::accept(Visitor &v)         { return v.visit_number(this); }
+Node* Bool::accept(Visitor &v)           { return v.visit_bool(this); }
+Node* String::accept(Visitor &v)         { return v.visit_string(this); }
+Node* Symbol::accept(Visitor &v)         { return v.visit_symbol(this); }
+Node* List::accept(Visitor &v)           { return v.visit_list(this); }
+Node* Map::accept(Visitor &v)            { return v.visit_map(this); }
+Node* Lambda::accept(Visitor &v)         { return v.visit_lambda(this); }
+Node* Call::accept(Visitor &v)           { return v.visit_call(this); }
+
+// lambda bodies have to stay blocks
+Block* Visitor::visit_body(Block* body) {
+	auto node = visit(body);
+	if (auto block = dynamic_cast<Block*>(node); block != nullptr)
+		return block;
+
+	std::vector<Node*> vec = { node };
+	return new Block(vec);
+}
+
+Node* Visitor::visit_variable(Variable* node) { return node; }
+
+Node* Visitor::visit_access(Access* node) {
+	node->left = visit(node->left);
+	node->right = visit(node->right);
+	return node;
+}
+
+Node* Visitor::visit_infix(InfixOperator* node) {
+	node->lhs = visit(node->lhs);
+	node->rhs = visit(node->rhs);
+	return node;
+}
+
+Node* Visitor::visit_prefix(PrefxOperator* node) {
+	node->operand = visit(node->operand);
+	return node;
+}
+
+Node* Visitor::visit_decl(VariableDecl* node) {
+	for (auto &pair : node->decls)
+		if (pair.second != nullptr)
+			pair.second = visit(pair.second);
+	return node;
+}
+
+Node* Visitor::visit_destruct(DestructList* node) {
+	for (auto &lhs : node->lhss)
+		if (dynamic_cast<Variable*>(lhs) == nullptr)
+			lhs = visit(lhs);
+	node->rhs = visit(node->rhs);
+	return node;
+}
+
+Node* Visitor::visit_assign_variable(AssignVariable* node) {
+	node->val = visit(node->val);
+	return node;
+}
+
+Node* Visitor::visit_assign_access(AssignAccess* node) {
+	node->acs->left = visit(node->acs->left);
+	node->acs->right = visit(node->acs->right);
+	node->val = visit(node->val);
+	return node;
+}
+
+Node* Visitor::visit_if(If* node) {
+	node->cond = visit(node->cond);
+	node->ifbody = visit(node->ifbody);
+	if (node->elsebody != nullptr)
+		node->elsebody = visit(node->elsebody);
+	return node;
+}
+
+Node* Visitor::visit_for(For* node) {
+	if (node->init) node->init = visit(node->init);
+	node->cond = visit(node->cond);
+	if (node->inc) node->inc = visit(node->inc);
+	node->body = visit(node->body);
+	return node;
+}
+
+Node* Visitor::visit_block(Block* node) {
+	for (auto &expr : node->exprs)
+		expr = visit(expr);
+	return node;
+}
+
+Node* Visitor::visit_nil(Nil* node) { return node; }
+Node* Visitor::visit_number(Number* node) { return node; }
+Node* Visitor::visit_bool(Bool* node) { return node; }
+Node* Visitor::visit_string(String* node) { return node; }
+Node* Visitor::visit_symbol(Symbol* node) { return node; }
+
+Node* Visitor::visit_list(List* node) {
+	for (auto &val : node->values)
+		val = visit(val);
+	return node;
+}
+
+Node* Visitor::visit_map(Map* node) {
+	for (auto &pair : node->values) {
+		pair.first = visit(pair.first);
+		pair.second = visit(pair.second);
+	}
+	return node;
+}
+
+Node* Visitor::visit_lambda(Lambda* node) {
+	node->body = visit_body(node->body);
+	return node;
+}
+
+Node* Visitor::visit_call(Call* node) {
+	node->callable = visit(node->callable);
+	for (auto &arg : node->args)
+		arg = visit(arg);
+	return node;
+}
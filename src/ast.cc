@@ -1,8 +1,10 @@
 #include <string>
 #include <stdexcept>
 #include <cassert>
+#include <cstddef>
 #include "include/ast.hh"
 #include "include/vm.hh"
+#include "opt/fold.hh"
 
 using std::string;
 using namespace ast;
@@ -13,6 +15,48 @@ static_assert(sizeof(double) == sizeof(OpCode));
 
 // TODO: bei sprüngen -1 als OpCode?
 
+thread_local Arena* Arena::current = nullptr;
+
+Arena::~Arena() {
+	for (auto node: nodes)
+		static_cast<Node*>(node)->~Node();
+}
+
+void* Arena::allocate(std::size_t size) {
+	// also in release builds: a pass or the lazy compilation creating nodes
+	// without an Arena::Scope would write through a null pointer
+	auto arena = current;
+	if (arena == nullptr)
+		throw std::runtime_error("ast node allocated outside of an arena");
+	if (size > chunk_size)
+		throw std::runtime_error("ast node too large for an arena chunk");
+	size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+	if (arena->used + size > chunk_size) {
+		arena->chunks.emplace_back(new char[chunk_size]);
+		arena->used = 0;
+	}
+
+	auto ptr = arena->chunks.back().get() + arena->used;
+	arena->used += size;
+	arena->nodes.push_back(ptr);
+	return ptr;
+}
+
+// only called for a node whose constructor threw, the memory stays in the arena
+void Arena::release(void* ptr) {
+	auto arena = current;
+	if (arena != nullptr && !arena->nodes.empty() && arena->nodes.back() == ptr)
+		arena->nodes.pop_back();
+}
+
+// compiling the specialized copy of a loop with guards (see For::to_vmops)
+static thread_local bool guarded = false;
+
+// can the operation skip checking that its operands are numbers?
+static bool unchecked(Numeric numeric) {
+	return numeric == Numeric::Proven || (numeric == Numeric::Guarded && guarded);
+}
+
 void Number::to_vmops(Context*, std::vector<OpCode> &ops) const {
 	ops.push_back(OpCode::PUSH_NUMBER);
 	ops.push_back(*reinterpret_cast<const OpCode*>(&value));
@@ -42,8 +86,16 @@ void String::to_vmops(Context*, std::vector<OpCode> &ops) const {
 void Lambda::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	ops.push_back(OpCode::PUSH_LAMBDA);
 	auto lambdaops = new std::vector<OpCode>();
-	body->to_vmops(ctx, *lambdaops);
-	auto lc = new LambdaContainer(nullptr, lambdaops, argnames, ctx, false);
+	auto outer = guarded;
+	guarded = false; // the guards do not hold when the lambda is called
+	if (lazy == nullptr) {
+		if (sealed)
+			lambdaops->push_back(OpCode::SEAL_ENV);
+		body->to_vmops(ctx, *lambdaops);
+	}
+	guarded = outer;
+	auto lc = new (ctx->heap) LambdaContainer(nullptr, lambdaops, argnames, ctx, false);
+	lc->lazy = lazy;
 	ctx->lambdas.push_back(lc);
 	ops.push_back(*reinterpret_cast<const OpCode*>(&lc));
 }
@@ -53,22 +105,22 @@ void InfixOperator::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	case InfixOperator::Add:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::ADD);
+		ops.push_back(unchecked(numeric) ? OpCode::ADD_NUM : OpCode::ADD);
 		return;
 	case InfixOperator::Sub:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::SUB);
+		ops.push_back(unchecked(numeric) ? OpCode::SUB_NUM : OpCode::SUB);
 		return;
 	case InfixOperator::Mul:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::MUL);
+		ops.push_back(unchecked(numeric) ? OpCode::MUL_NUM : OpCode::MUL);
 		return;
 	case InfixOperator::Div:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::DIV);
+		ops.push_back(unchecked(numeric) ? OpCode::DIV_NUM : OpCode::DIV);
 		return;
 	case InfixOperator::Or:{
 		// a | b <-> if a { true } else { b }
@@ -113,22 +165,22 @@ void InfixOperator::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	case InfixOperator::Bigger:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::BIGGER);
+		ops.push_back(unchecked(numeric) ? OpCode::BIGGER_NUM : OpCode::BIGGER);
 		return;
 	case InfixOperator::BiggerOrEqual:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::BIGGER_OR_EQUAL);
+		ops.push_back(unchecked(numeric) ? OpCode::BIGGER_OR_EQUAL_NUM : OpCode::BIGGER_OR_EQUAL);
 		return;
 	case InfixOperator::Smaller:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::SMALLER);
+		ops.push_back(unchecked(numeric) ? OpCode::SMALLER_NUM : OpCode::SMALLER);
 		return;
 	case InfixOperator::SmallerOrEqual:
 		lhs->to_vmops(ctx, ops);
 		rhs->to_vmops(ctx, ops);
-		ops.push_back(OpCode::SMALLER_OR_EQUAL);
+		ops.push_back(unchecked(numeric) ? OpCode::SMALLER_OR_EQUAL_NUM : OpCode::SMALLER_OR_EQUAL);
 		return;
 	}
 }
@@ -142,7 +194,7 @@ void PrefxOperator::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 		double flt = 0.0;
 		ops.push_back(*reinterpret_cast<const OpCode*>(&flt));
 		operand->to_vmops(ctx, ops);
-		ops.push_back(OpCode::SUB);
+		ops.push_back(unchecked(numeric) ? OpCode::SUB_NUM : OpCode::SUB);
 		return;
 	}
 	case PrefxOperator::Not:{
@@ -154,14 +206,6 @@ void PrefxOperator::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 }
 
 
-VariableDecl::~VariableDecl() {
-	for (auto [var, val] : decls) {
-		delete var;
-		if (val != nullptr)
-			delete val;
-	}
-}
-
 void VariableDecl::to_vmops(asbi::Context* ctx, std::vector<asbi::OpCode> &ops) const {
 	for (auto [var, val]: decls) {
 		if (val == nullptr)
@@ -182,7 +226,14 @@ void AssignVariable::to_vmops(asbi::Context* ctx, std::vector<asbi::OpCode> &ops
 	ops.push_back(*reinterpret_cast<const OpCode*>(&var->sc));
 }
 
-void Variable::to_vmops(asbi::Context*, std::vector<asbi::OpCode> &ops) const {
+void Variable::to_vmops(asbi::Context* ctx, std::vector<asbi::OpCode> &ops) const {
+	if (auto cell = ctx->global_cell(sc); cell != nullptr) {
+		ops.push_back(OpCode::LOOKUP_GLOBAL);
+		ops.push_back(*reinterpret_cast<const OpCode*>(&sc));
+		ops.push_back(*reinterpret_cast<const OpCode*>(&cell));
+		return;
+	}
+
 	ops.push_back(OpCode::LOOKUP);
 	ops.push_back(*reinterpret_cast<const OpCode*>(&sc));
 }
@@ -201,23 +252,20 @@ void DestructList::to_vmops(asbi::Context *ctx, std::vector<asbi::OpCode> &ops)
 	ops.push_back(static_cast<OpCode>(lhss.size()));
 }
 
-DestructList::~DestructList() {
-	for (auto lhs: lhss)
-		delete lhs;
-	delete rhs;
-}
 
-/*
-DestructMap::~DestructMap() {
-	for (auto [a, b]: vars) {
-		delete a;
-		delete b;
+void If::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
+	// constant condition (see opt::Fold), only the taken branch is emitted
+	if (auto constcond = dynamic_cast<Bool*>(cond); constcond != nullptr) {
+		auto taken = constcond->value ? ifbody : elsebody;
+		ops.push_back(OpCode::ENTER_SCOPE);
+		if (taken)
+			taken->to_vmops(ctx, ops);
+		else
+			ops.push_back(OpCode::PUSH_NIL);
+		ops.push_back(OpCode::LEAVE_SCOPE);
+		return;
 	}
-	delete val;
-}
-*/
 
-void If::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	cond->to_vmops(ctx, ops);
 	ops.push_back(OpCode::IF_TRUE_GOTO);
 	ops.push_back(OpCode::NOOP);
@@ -238,13 +286,6 @@ void If::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	*(ops.data() + pos2) = static_cast<OpCode>(ops.size());
 }
 
-If::~If() {
-	delete cond;
-	delete ifbody;
-	if (elsebody != nullptr)
-		delete elsebody;
-}
-
 
 void For::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	if (init) {
@@ -252,6 +293,37 @@ void For::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 		ops.push_back(OpCode::POP);
 	}
 
+	if (guards.empty()) {
+		loop_to_vmops(ctx, ops);
+		return;
+	}
+
+	// the specialized copy runs if all guarded variables are numbers
+	// when the loop is entered, the generic one otherwise
+	std::vector<std::size_t> checks;
+	for (auto sc: guards) {
+		ops.push_back(OpCode::IF_NOT_NUMBER_GOTO);
+		ops.push_back(*reinterpret_cast<const OpCode*>(&sc));
+		checks.push_back(ops.size());
+		ops.push_back(OpCode::NOOP);
+	}
+
+	auto outer = guarded;
+	guarded = true;
+	loop_to_vmops(ctx, ops);
+	guarded = false;
+	ops.push_back(OpCode::GOTO);
+	auto pos_end = ops.size();
+	ops.push_back(OpCode::NOOP);
+
+	for (auto pos: checks)
+		*(ops.data() + pos) = static_cast<OpCode>(ops.size());
+	loop_to_vmops(ctx, ops);
+	guarded = outer;
+	*(ops.data() + pos_end) = static_cast<OpCode>(ops.size());
+}
+
+void For::loop_to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	auto pos1 = ops.size();
 	cond->to_vmops(ctx, ops);
 	ops.push_back(OpCode::IF_FALSE_GOTO);
@@ -274,15 +346,6 @@ void For::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	ops.push_back(OpCode::PUSH_NIL);
 }
 
-For::~For() {
-	if (init)
-		delete init;
-	delete cond;
-	if (inc)
-		delete inc;
-	delete body;
-}
-
 
 void Block::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	int n = exprs.size();
@@ -299,7 +362,53 @@ void Block::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 }
 
 
+// keys only scalars: maps as keys are compared by identity
+MapContainer* ast::map_template(Context* ctx, const Node* node) {
+	auto list = dynamic_cast<const List*>(node);
+	auto map = dynamic_cast<const Map*>(node);
+	if (list == nullptr && map == nullptr)
+		return nullptr;
+
+	auto value = [&](const Node* node, Value* val) {
+		if (opt::literal_value(node, val))
+			return true;
+		auto mc = map_template(ctx, node);
+		if (mc != nullptr)
+			*val = Value::map(mc);
+		return mc != nullptr;
+	};
+
+	std::vector<std::pair<Value, Value>> entries;
+	Value key, val;
+	if (list != nullptr) {
+		for (std::size_t i = 0; i < list->values.size(); i++) {
+			if (!value(list->values[i], &val))
+				return nullptr;
+			entries.push_back({ Value::number(i), val });
+		}
+	} else {
+		for (auto [keynode, valnode]: map->values) {
+			if (!opt::literal_value(keynode, &key) || !value(valnode, &val))
+				return nullptr;
+			entries.push_back({ key, val });
+		}
+	}
+
+	// MAKE_MAP sets the entries from last to first, the first one wins
+	auto mc = new (ctx->heap) MapContainer(ctx, false);
+	ctx->templates.push_back(mc);
+	for (auto rit = entries.rbegin(); rit != entries.rend(); ++rit)
+		mc->set(rit->first, rit->second);
+	return mc;
+}
+
 void List::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
+	if (auto mc = map_template(ctx, this); mc != nullptr) {
+		ops.push_back(OpCode::CLONE_MAP);
+		ops.push_back(*reinterpret_cast<const OpCode*>(&mc));
+		return;
+	}
+
 	for (auto node: values) {
 		node->to_vmops(ctx, ops);
 	}
@@ -309,13 +418,13 @@ void List::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 }
 
 
-List::~List() {
-	for (auto node : values)
-		delete node;
-}
-
-
 void Map::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
+	if (auto mc = map_template(ctx, this); mc != nullptr) {
+		ops.push_back(OpCode::CLONE_MAP);
+		ops.push_back(*reinterpret_cast<const OpCode*>(&mc));
+		return;
+	}
+
 	for (auto [key, val]: values) {
 		val->to_vmops(ctx, ops);
 		key->to_vmops(ctx, ops);
@@ -326,14 +435,6 @@ void Map::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 }
 
 
-Map::~Map() {
-	for (auto pair : values) {
-		delete pair.first;
-		delete pair.second;
-	}
-}
-
-
 void Access::to_vmops(Context* ctx, std::vector<OpCode> &ops) const {
 	right->to_vmops(ctx, ops);
 	left->to_vmops(ctx, ops);
@@ -353,20 +454,19 @@ void Call::to_vmops(asbi::Context* ctx, std::vector<asbi::OpCode> &ops) const {
 	for (auto rit = args.rbegin(); rit != args.rend(); ++rit)
 		(*rit)->to_vmops(ctx, ops);
 
+	auto var = dynamic_cast<Variable*>(callable);
+	if (auto op = var != nullptr ? intrinsic(ctx, var->sc, args.size()) : NOOP; op != NOOP) {
+		auto cell = ctx->global_cell(var->sc);
+		ops.push_back(op);
+		ops.push_back(*reinterpret_cast<const OpCode*>(&var->sc));
+		ops.push_back(*reinterpret_cast<const OpCode*>(&cell));
+		ops.push_back(static_cast<OpCode>(reinterpret_cast<uintptr_t>(cell->_macro)));
+		return;
+	}
+
 	callable->to_vmops(ctx, ops);
 	ops.push_back(OpCode::CALL);
 	ops.push_back(static_cast<OpCode>(args.size()));
 }
 
 
-Call::~Call() {
-	delete callable;
-	for (auto arg: args)
-		delete arg;
-}
-
-
-Block::~Block() {
-	for (auto node : exprs)
-		delete node;
-}
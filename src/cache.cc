@@ -0,0 +1,484 @@
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "include/cache.hh"
+#include "include/context.hh"
+#include "include/types.hh"
+#include "include/vm.hh"
+#include "include/utils.hh"
+#include "ir/ir.hh"
+
+extern "C" {
+	#include <sys/stat.h>
+	#include <sys/types.h>
+	#include <unistd.h>
+}
+
+using namespace asbi;
+
+// bumped whenever the layout below or the opcodes change
+static const unsigned int format_version = 2;
+
+// FNV-1a, stable across processes unlike std::hash
+static uint64_t fnv(const std::string &data) {
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c: data) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// the opcodes with their immediates as this binary knows them: an asbi
+// rebuilt with a changed OpCode enum but the same ASBI_VERSION does not load
+// the entries of the old one
+static uint64_t opcode_layout() {
+	static const uint64_t layout = [] {
+		std::ostringstream table;
+		for (uint64_t op = 0; op <= NOOP; op++) {
+			Immediate kinds[3];
+			auto n = immediates(static_cast<OpCode>(op), kinds);
+			table << ir::opcode_name(static_cast<OpCode>(op));
+			for (unsigned int i = 0; i < n; i++)
+				table << ' ' << static_cast<int>(kinds[i]);
+			table << '\n';
+		}
+		return fnv(table.str());
+	}();
+	return layout;
+}
+
+namespace {
+
+	// the tables of one entry, filled while the ops are translated
+	struct Writer {
+		std::vector<StringContainer*> strings;
+		std::vector<MapContainer*> templates;
+		std::vector<LambdaContainer*> lambdas;
+		std::vector<std::vector<OpCode>> lambda_ops;
+		std::unordered_map<void*, uint64_t> indices;
+
+		template<typename T> uint64_t index(T* ptr, std::vector<T*> &table) {
+			auto pos = indices.find(ptr);
+			if (pos != indices.end())
+				return pos->second;
+
+			indices[ptr] = table.size();
+			table.push_back(ptr);
+			return table.size() - 1;
+		}
+
+		uint64_t lambda(LambdaContainer* lc) {
+			auto known = indices.count(lc) != 0;
+			auto i = index(lc, lambdas);
+			if (!known) {
+				lambda_ops.emplace_back();
+				auto ops = translate(*lc->ops);
+				lambda_ops[i] = ops;
+				for (auto sc: lc->argnames)
+					index(sc, strings);
+			}
+			return i;
+		}
+
+		void value(Value val, std::vector<uint64_t> &out) {
+			out.push_back(static_cast<uint64_t>(val.type));
+			switch (val.type) {
+			case type_t::Number:{
+				uint64_t bits;
+				std::memcpy(&bits, &val._number, sizeof(bits));
+				out.push_back(bits);
+				break;
+			}
+			case type_t::Bool:
+				out.push_back(val._boolean);
+				break;
+			case type_t::Nil:
+				out.push_back(0);
+				break;
+			case type_t::String: case type_t::Symbol:
+				out.push_back(index(val._string, strings));
+				break;
+			case type_t::Map:
+				out.push_back(index(val._map, templates));
+				break;
+			default:
+				throw std::runtime_error("unexpected value in a template");
+			}
+		}
+
+		std::vector<OpCode> translate(const std::vector<OpCode> &ops) {
+			std::vector<OpCode> out(ops);
+			Immediate kinds[3];
+			for (std::size_t pc = 0; pc < ops.size(); pc += 1 + immediates(ops[pc])) {
+				auto n = immediates(ops[pc], kinds);
+				for (unsigned int i = 0; i < n; i++) {
+					auto raw = ops[pc + 1 + i];
+					uint64_t imm = raw;
+					switch (kinds[i]) {
+					case Immediate::String:
+						imm = index(reinterpret_cast<StringContainer*>(raw), strings);
+						break;
+					case Immediate::Lambda:
+						imm = lambda(reinterpret_cast<LambdaContainer*>(raw));
+						break;
+					case Immediate::Template:
+						imm = index(reinterpret_cast<MapContainer*>(raw), templates);
+						break;
+					case Immediate::Cell: case Immediate::Macro:
+						imm = 0; // looked up again by load()
+						break;
+					case Immediate::Raw:
+						break;
+					}
+					out[pc + 1 + i] = static_cast<OpCode>(imm);
+				}
+			}
+			return out;
+		}
+	};
+
+	// reads the words of an entry, throws if it ends early
+	struct Reader {
+		const std::string &data;
+		std::size_t pos;
+
+		uint64_t word() {
+			uint64_t word;
+			if (data.size() - pos < sizeof(word))
+				throw std::runtime_error("bytecode cache: truncated entry");
+			std::memcpy(&word, data.data() + pos, sizeof(word));
+			pos += sizeof(word);
+			return word;
+		}
+
+		uint64_t index(std::size_t size) {
+			auto i = word();
+			if (i >= size)
+				throw std::runtime_error("bytecode cache: index out of range");
+			return i;
+		}
+
+		std::string string() {
+			auto size = word();
+			if (data.size() - pos < size)
+				throw std::runtime_error("bytecode cache: truncated entry");
+			auto str = data.substr(pos, size);
+			pos += size;
+			return str;
+		}
+	};
+
+}
+
+static void put(std::string &out, uint64_t word) {
+	out.append(reinterpret_cast<const char*>(&word), sizeof(word));
+}
+
+static void put(std::string &out, const std::string &str) {
+	put(out, str.size());
+	out += str;
+}
+
+static void put(std::string &out, const std::vector<OpCode> &ops) {
+	put(out, ops.size());
+	for (auto op: ops)
+		put(out, op);
+}
+
+std::string BytecodeCache::default_dir() {
+	if (auto xdg = getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0')
+		return std::string(xdg) + "/asbi";
+	if (auto home = getenv("HOME"); home != nullptr && *home != '\0')
+		return std::string(home) + "/.cache/asbi";
+	return "";
+}
+
+static std::string normalized(const std::string &path) {
+	std::string copy = path;
+	try {
+		return utils::normalize(copy);
+	} catch (std::runtime_error&) {
+		return path; // keyed by the path as given
+	}
+}
+
+std::string BytecodeCache::entry(const std::string &path) const {
+	std::ostringstream name;
+	name << dir << '/' << std::hex << fnv(normalized(path) + '\n' + ctx->optimizer.config()) << ".bc";
+	return name.str();
+}
+
+// everything an entry has to match, written in front of the tables
+std::string BytecodeCache::header(const std::string &path, const std::string &source) const {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return "";
+
+	std::ostringstream header;
+	header << "asbi-bytecode " << format_version << " " << ASBI_VERSION << " "
+		<< std::hex << opcode_layout() << std::dec << '\n'
+		<< ctx->optimizer.config() << '\n'
+		<< normalized(path) << '\n'
+		<< st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << ' '
+		<< source.size() << ' ' << std::hex << fnv(source) << '\n';
+	return header.str();
+}
+
+// the passes assume the builtins they know about have not been rebound
+// (see opt::is_builtin()), so do entries
+bool BytecodeCache::builtins_intact() const {
+	for (auto [sc, val]: ctx->builtins) {
+		auto cell = ctx->global_cell(sc);
+		if (cell == nullptr || cell->type != val.type)
+			return false;
+		if (val.type == type_t::Macro ? cell->_macro != val._macro : cell->_map != val._map)
+			return false;
+	}
+	return true;
+}
+
+bool BytecodeCache::stored(const std::string &path, const std::string &source) const {
+	auto expected = header(path, source);
+	if (expected.empty())
+		return false;
+
+	std::ifstream in(entry(path), std::ios::binary);
+	std::string found(expected.size(), '\0');
+	return in.read(&found[0], found.size()) && found == expected;
+}
+
+void BytecodeCache::store(const std::string &path, const std::string &source, const std::vector<OpCode> &ops) {
+	auto head = header(path, source);
+	if (head.empty() || !builtins_intact())
+		return;
+
+	Writer writer;
+	std::vector<OpCode> main_ops;
+	try {
+		main_ops = writer.translate(ops);
+	} catch (std::runtime_error&) {
+		return;
+	}
+
+	// templates and their nested maps, which may add more templates and strings
+	std::vector<std::vector<uint64_t>> templates;
+	for (std::size_t i = 0; i < writer.templates.size(); i++) {
+		std::vector<uint64_t> words;
+		auto mc = writer.templates[i];
+		words.push_back(mc->vecdata.size());
+		for (auto val: mc->vecdata)
+			writer.value(val, words);
+		words.push_back(mc->data.size());
+		for (auto [key, val]: mc->data) {
+			writer.value(key, words);
+			writer.value(val, words);
+		}
+		templates.push_back(words);
+	}
+
+	std::string out = head;
+	put(out, writer.strings.size());
+	for (auto sc: writer.strings)
+		put(out, sc->data);
+
+	put(out, templates.size());
+	for (auto &words: templates)
+		for (auto word: words)
+			put(out, word);
+
+	put(out, writer.lambdas.size());
+	for (std::size_t i = 0; i < writer.lambdas.size(); i++) {
+		auto lc = writer.lambdas[i];
+		put(out, lc->argnames.size());
+		for (auto sc: lc->argnames)
+			put(out, writer.indices[sc]);
+
+		auto lazy = lc->lazy != nullptr && !lc->lazy->compiled;
+		put(out, lazy);
+		if (lazy) {
+			put(out, lc->lazy->line);
+			put(out, lc->lazy->source);
+		} else {
+			put(out, writer.lambda_ops[i]);
+		}
+	}
+	put(out, main_ops);
+
+	// mkdir -p, then replace the entry in one step
+	for (auto i = dir.find('/', 1); ; i = dir.find('/', i + 1)) {
+		mkdir(dir.substr(0, i).c_str(), 0755);
+		if (i == std::string::npos)
+			break;
+	}
+
+	auto name = entry(path);
+	auto tmp = name + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+		if (!file.write(out.data(), out.size()))
+			return;
+	}
+	if (rename(tmp.c_str(), name.c_str()) != 0)
+		unlink(tmp.c_str());
+}
+
+bool BytecodeCache::load(const std::string &path, const std::string &source, std::vector<OpCode> &ops) {
+	auto head = header(path, source);
+	if (head.empty() || !builtins_intact())
+		return false;
+
+	std::string name = entry(path), data;
+	try {
+		utils::readfile(name, data);
+	} catch (std::runtime_error&) {
+		return false;
+	}
+	if (data.compare(0, head.size(), head) != 0)
+		return false;
+
+	std::vector<MapContainer*> templates;
+	std::vector<LambdaContainer*> lambdas;
+	std::vector<LazyBody*> lazy_bodies;
+	try {
+		Reader in{ data, head.size() };
+		std::vector<StringContainer*> strings(in.word());
+		for (auto &sc: strings)
+			sc = ctx->new_stringconstant(in.string());
+
+		auto value = [&]() {
+			auto type = static_cast<type_t>(in.word());
+			auto payload = in.word();
+			switch (type) {
+			case type_t::Number:{
+				double num;
+				std::memcpy(&num, &payload, sizeof(num));
+				return Value::number(num);
+			}
+			case type_t::Bool:
+				return Value::boolean(payload != 0);
+			case type_t::Nil:
+				return Value::nil();
+			case type_t::String: case type_t::Symbol:{
+				if (payload >= strings.size())
+					throw std::runtime_error("bytecode cache: index out of range");
+				return type == type_t::String ? Value::string(strings[payload]) : Value::symbol(strings[payload]);
+			}
+			case type_t::Map:
+				if (payload >= templates.size())
+					throw std::runtime_error("bytecode cache: index out of range");
+				return Value::map(templates[payload]);
+			default:
+				throw std::runtime_error("bytecode cache: unexpected value");
+			}
+		};
+
+		// the ops of one function, pointers in place of the indices
+		auto decode = [&](std::vector<OpCode> &ops) {
+			ops.resize(in.word());
+			for (auto &op: ops)
+				op = static_cast<OpCode>(in.word());
+
+			Immediate kinds[3];
+			StringContainer* sc = nullptr;
+			Value* cell = nullptr;
+			for (std::size_t pc = 0; pc < ops.size(); pc += 1 + immediates(ops[pc])) {
+				if (ops[pc] > NOOP || pc + immediates(ops[pc]) >= ops.size())
+					throw std::runtime_error("bytecode cache: invalid opcode");
+
+				auto op = ops[pc];
+				auto n = immediates(op, kinds);
+				for (unsigned int i = 0; i < n; i++) {
+					auto &imm = ops[pc + 1 + i];
+					switch (kinds[i]) {
+					case Immediate::String:
+						if (imm >= strings.size())
+							throw std::runtime_error("bytecode cache: index out of range");
+						sc = strings[imm];
+						imm = static_cast<OpCode>(reinterpret_cast<uintptr_t>(sc));
+						break;
+					case Immediate::Lambda:
+						if (imm >= lambdas.size())
+							throw std::runtime_error("bytecode cache: index out of range");
+						imm = static_cast<OpCode>(reinterpret_cast<uintptr_t>(lambdas[imm]));
+						break;
+					case Immediate::Template:
+						if (imm >= templates.size())
+							throw std::runtime_error("bytecode cache: index out of range");
+						imm = static_cast<OpCode>(reinterpret_cast<uintptr_t>(templates[imm]));
+						break;
+					case Immediate::Cell:
+						// bound when it was compiled, it has to be now
+						if (op != LOOKUP_GLOBAL && intrinsic(ctx, sc, op == MOD ? 2 : 1) != op)
+							throw std::runtime_error("bytecode cache: builtin rebound");
+						cell = ctx->global_cell(sc);
+						if (cell == nullptr)
+							throw std::runtime_error("bytecode cache: global not bound");
+						imm = static_cast<OpCode>(reinterpret_cast<uintptr_t>(cell));
+						break;
+					case Immediate::Macro:
+						imm = static_cast<OpCode>(reinterpret_cast<uintptr_t>(cell->_macro));
+						break;
+					case Immediate::Raw:
+						break;
+					}
+				}
+			}
+		};
+
+		templates.resize(in.word());
+		for (auto &mc: templates)
+			mc = new (ctx->heap) MapContainer(ctx, false);
+		for (auto mc: templates) {
+			mc->vecdata.resize(in.word());
+			for (auto &val: mc->vecdata)
+				val = value();
+			for (auto n = in.word(); n > 0; n--) {
+				auto key = value();
+				mc->data[key] = value();
+			}
+		}
+
+		lambdas.resize(in.word());
+		for (auto &lc: lambdas)
+			lc = new (ctx->heap) LambdaContainer(nullptr, new std::vector<OpCode>(), {}, ctx, false);
+		for (auto lc: lambdas) {
+			for (auto n = in.word(); n > 0; n--)
+				lc->argnames.push_back(strings[in.index(strings.size())]);
+
+			if (in.word() != 0) {
+				auto line = static_cast<unsigned int>(in.word());
+				lc->lazy = new LazyBody{ in.string(), line, false };
+				lazy_bodies.push_back(lc->lazy);
+			} else {
+				decode(*lc->ops);
+			}
+		}
+
+		decode(ops);
+		if (in.pos != data.size())
+			throw std::runtime_error("bytecode cache: trailing data");
+	} catch (std::exception&) {
+		for (auto mc: templates)
+			delete mc;
+		for (auto lc: lambdas) {
+			delete lc->ops;
+			delete lc;
+		}
+		for (auto body: lazy_bodies)
+			delete body;
+		ops.clear();
+		return false;
+	}
+
+	ctx->templates.insert(ctx->templates.end(), templates.begin(), templates.end());
+	ctx->lambdas.insert(ctx->lambdas.end(), lambdas.begin(), lambdas.end());
+	{
+		std::lock_guard<std::mutex> lock(ctx->parse_mtx);
+		ctx->lazy_bodies.insert(ctx->lazy_bodies.end(), lazy_bodies.begin(), lazy_bodies.end());
+	}
+	return true;
+}
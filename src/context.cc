@@ -7,42 +7,34 @@
 #include "include/tokenizer.hh"
 #include "include/types.hh"
 #include "include/utils.hh"
+#include "include/preload.hh"
+#include "include/cache.hh"
+#include "ir/ir.hh"
+#include "opt/analysis.hh"
 
 using namespace asbi;
 
-Env::Env(Context*, std::shared_ptr<Env> outer) {
-	this->outer = outer;
-}
+Env::Env(Context* ctx, std::shared_ptr<Env> outer): ctx(ctx), outer(outer), sealed(outer != nullptr && outer->sealed), epoch(ctx->gc_epoch) {}
 Env::~Env() {
-
+	if (gc_remembered)
+		ctx->remembered_envs[gc_index] = nullptr;
+	if (gc_gray)
+		ctx->gray_envs[gc_gray_index] = nullptr;
 }
 
-void Env::gc_visit() const {
-	if (gc_visited)
-		return;
-
-	gc_visited = true;
-
-	for (auto [key, val]: vars)
-		val.gc_visit();
-
-	if (outer != nullptr)
-		outer->gc_visit();
-
-	if (caller != nullptr)
-		caller->gc_visit();
+bool Env::gc_young_refs() const {
+	for (auto &[key, val]: vars)
+		if (val.gc_young())
+			return true;
+	return false;
 }
-void Env::gc_unvisit() const {
-	if (!gc_visited)
-		return;
+void Env::write_barrier(const Value &val) {
+	if (epoch != ctx->gc_epoch && !gc_remembered && val.gc_young())
+		ctx->remember(this);
 
-	gc_visited = false;
-
-	if (outer != nullptr)
-		outer->gc_unvisit();
-
-	if (caller != nullptr)
-		caller->gc_unvisit();
+	// only equal while an incremental collection marks (see Context::shade())
+	if (gc_mark == ctx->gc_marks)
+		ctx->shade(val);
 }
 Value Env::lookup(StringContainer* sc) {
 	auto env = this;
@@ -61,17 +53,32 @@ Value Env::lookup(Context* ctx, const char* str) {
 	return lookup(ctx->new_stringconstant(cppstr));
 }
 void Env::decl(StringContainer* sc, Value val) {
+	if (outer != nullptr)
+		sc->local = true;
+	write_barrier(val);
 	vars[sc] = val;
 }
 void Env::decl(Context* ctx, const char* str, Value val) {
 	std::string cppstr(str);
-	vars[ctx->new_stringconstant(cppstr)] = val;
+	decl(ctx->new_stringconstant(cppstr), val);
+}
+Value* Env::find(StringContainer* sc) {
+	auto env = this;
+	while (env != nullptr) {
+		auto search = env->vars.find(sc);
+		if (search != env->vars.end())
+			return &search->second;
+
+		env = env->outer.get();
+	}
+	return nullptr;
 }
 void Env::set(StringContainer* sc, Value val) {
 	auto env = this;
 	while (env != nullptr) {
 		auto search = env->vars.find(sc);
 		if (search != env->vars.end()) {
+			env->write_barrier(val);
 			search->second = val;
 			return;
 		}
@@ -83,6 +90,7 @@ void Env::set(StringContainer* sc, Value val) {
 }
 
 Context::Context(): evtloop(this, 0) {
+	preloader = std::make_unique<Preloader>(this);
 	global_env = std::make_shared<Env>(this, nullptr);
 
 	std::string str = "__file";
@@ -98,11 +106,19 @@ Context::Context(): evtloop(this, 0) {
 	str = "err";
 	names.err = new_stringconstant(str);
 
+	const char* types[] = { "bool", "number", "nil", "symbol", "string", "function", "map", "function", "internal_stack_placeholder" };
+	static_assert(sizeof(types) / sizeof(*types) == sizeof(type_names) / sizeof(*type_names));
+	for (unsigned int i = 0; i < sizeof(types) / sizeof(*types); ++i)
+		type_names[i] = new_stringconstant(types[i]);
+
 	load_macros();
 }
 
 Context::~Context() {
+	preloader.reset();
+	cache.reset();
 	assert(stack.size() == 0);
+	builtins.clear();
 	gc(nullptr);
 
 	for (unsigned int i = 0; i < sizeof(strconsts) / sizeof(*strconsts); ++i)
@@ -113,6 +129,12 @@ Context::~Context() {
 		delete lc->ops;
 		delete lc;
 	}
+
+	for (auto mc: templates)
+		delete mc;
+
+	for (auto body: lazy_bodies)
+		delete body;
 }
 
 void Context::push(Value v) {
@@ -127,48 +149,177 @@ Value Context::pop() {
 }
 
 Value Context::run(const std::string& str) {
-	return run(str, std::make_shared<Env>(this, global_env));
+	return run(str, std::make_shared<Env>(this, global_env), false);
+}
+
+Value Context::run(const std::string& str, std::shared_ptr<Env> env, bool open, unsigned int line) {
+	std::vector<OpCode> ops;
+	auto nlambdas = lambdas.size(), first = templates.size();
+	{
+		ast::Arena arena;
+		ast::Arena::Scope scope(arena);
+		auto ast = parse(str, line);
+		opt::Unit unit{ this, env, open };
+		compile(ast, unit, ops);
+	}
+	return execute_unit(ops, env, nlambdas, first);
 }
 
-Value Context::run(const std::string& str, std::shared_ptr<Env> env) {
-	tok::Tokenizer toker(str);
-	Parser parser(toker, this);
-	auto ast = parser.parse()->optimize();
+Value Context::run_file(const std::string &path, std::shared_ptr<Env> env, bool open) {
+	auto preloaded = preloader->take(path);
+	std::string source;
+	if (preloaded != nullptr) {
+		source = std::move(preloaded->source);
+	} else {
+		utils::readfile(path, source);
+		preloader->scan(source, path);
+	}
+
 	std::vector<OpCode> ops;
-	ast->to_vmops(this, ops);
-	delete ast;
+	auto nlambdas = lambdas.size(), first = templates.size();
+	// the entries are compiled as closed units
+	bool cached = cache != nullptr && !open;
+	if (cached && cache->load(path, source, ops))
+		return execute_unit(ops, env, nlambdas, first);
+
+	{
+		auto arena = preloaded != nullptr ? std::move(preloaded->arena) : nullptr;
+		auto ast = preloaded != nullptr ? preloaded->ast : nullptr;
+		if (ast == nullptr) {
+			arena = std::make_unique<ast::Arena>();
+			ast::Arena::Scope scope(*arena);
+			ast = parse(source, 1);
+		}
 
-	return execute(ops, env, this);
+		ast::Arena::Scope scope(*arena);
+		opt::Unit unit{ this, env, open };
+		compile(ast, unit, ops);
+	}
+	if (cached)
+		cache->store(path, source, ops);
+	return execute_unit(ops, env, nlambdas, first);
+}
+
+// runs `ops`, which use the lambdas and templates added from `nlambdas` and `first` on
+Value Context::execute_unit(std::vector<OpCode> &ops, std::shared_ptr<Env> env, std::size_t nlambdas, std::size_t first) {
+	auto last = templates.size();
+	bool shared = lambdas.size() != nlambdas;
+
+	auto res = execute(ops, env, this);
+
+	// without new lambdas only `ops` uses the templates built for it, which
+	// are freed like it (runs during execute() add theirs after them)
+	if (!shared) {
+		for (auto i = first; i < last; i++)
+			delete templates[i];
+		templates.erase(templates.begin() + first, templates.begin() + last);
+	}
+	return res;
+}
+
+// the statements are open units in one env, like the lines of the repl
+Value Context::run(std::istream &in) {
+	auto env = std::make_shared<Env>(this, global_env);
+	tok::StatementReader reader(in);
+	std::string statement;
+	unsigned int line;
+	Value res = Value::nil();
+	while (reader.next(statement, line))
+		res = run(statement, env, true, line);
+	return res;
+}
+
+// into the arena of the current scope
+ast::Node* Context::parse(const std::string &source, unsigned int line) {
+	tok::Tokenizer toker(source, line);
+	Parser parser(toker, this, optimizer.lazy_enabled());
+	return optimizer.timed("parse", [&]() { return parser.parse(); });
+}
+
+// optimizes and generates the bytecode, the tree is freed with its arena
+void Context::compile(ast::Node* ast, opt::Unit &unit, std::vector<OpCode> &ops) {
+	ast = optimizer.run(ast, unit);
+	// the IR keeps variables in slots, out of the env
+	if (optimizer.is_enabled("ir") && !opt::collect_bindings(ast).dynamic)
+		unit.sealed = true;
+	// the top level of an open unit is left to the later ones
+	if (unit.sealed) {
+		opt::seal_lambdas(ast);
+		if (!unit.open)
+			ops.push_back(OpCode::SEAL_ENV);
+	}
+	auto nlambdas = lambdas.size();
+	optimizer.timed("codegen", [&]() {
+		if (optimizer.is_enabled("ir"))
+			ir::compile(this, ast, unit, ops);
+		else
+			ast->to_vmops(this, ops);
+	});
+
+	if (optimizer.is_enabled("peephole")) {
+		optimizer.timed("peephole", [&]() {
+			opt::peephole(ops, optimizer.peephole_hits);
+			for (auto i = nlambdas; i < lambdas.size(); i++)
+				opt::peephole(*lambdas[i]->ops, optimizer.peephole_hits);
+		});
+	}
+}
+
+// the body of a lambda skimmed by the parser, compiled on its first call:
+// as its own open unit, the passes see only the body (see PassManager::lazy_enabled())
+void Context::compile_lazy(LambdaContainer* lc) {
+	auto lazy = lc->lazy;
+	ast::Arena arena;
+	ast::Arena::Scope scope(arena);
+	tok::Tokenizer toker(lazy->source, lazy->line);
+	Parser parser(toker, this, true, true);
+	auto body = optimizer.timed("parse", [&]() { return parser.parse(); });
+	opt::Unit unit{ this, lc->env, true };
+	compile(body, unit, *lc->ops);
+	lazy->compiled = true;
 }
 
 StringContainer* Context::new_stringconstant(const char* string) {
-	std::string cppstr = string;
-	return new_stringconstant(cppstr);
+	return new_stringconstant(std::string_view(string));
 }
 
-StringContainer* Context::new_stringconstant(std::string &string) {
-	std::size_t hash = std::hash<std::string>()(string);
+StringContainer* Context::new_stringconstant(std::string_view string) {
+	std::size_t hash = std::hash<std::string_view>()(string);
+	std::lock_guard<std::mutex> lock(parse_mtx);
 	auto &consts = strconsts[hash % (sizeof(strconsts) / sizeof(*strconsts))];
 	for (auto sc: consts)
 		if (sc->hash == hash && sc->data == string)
 			return sc;
 
-	auto sc = new StringContainer(string, hash, this, false);
+	std::string data(string);
+	auto sc = new (constants) StringContainer(data, hash, this, false);
 	consts.push_back(sc);
 	return sc;
 }
 
+// the entries of Env::vars are never removed, so the pointer stays valid
+Value* Context::global_cell(StringContainer* name) {
+	auto pos = global_env->vars.find(name);
+	return pos != global_env->vars.end() ? &pos->second : nullptr;
+}
+
+void Context::declare_builtin(const char* name, Value val) {
+	auto sc = new_stringconstant(name);
+	global_env->decl(sc, val);
+	builtins[sc] = val;
+}
+
 StringContainer* Context::new_string(const char* string) {
 	std::string cppstr = string;
 	return new_string(cppstr);
 }
 
 StringContainer* Context::new_string(std::string &string) {
-	return new StringContainer(string, std::hash<std::string>()(string), this, true);
+	return new (heap) StringContainer(string, std::hash<std::string>()(string), this, true);
 }
 
 Value Env::to_map(Context* ctx) const {
-	auto mc = new MapContainer(ctx);
+	auto mc = new (ctx->heap) MapContainer(ctx);
 	for (auto [name, value]: vars) {
 		mc->set(Value::string(name), value);
 	}
@@ -11,10 +11,50 @@
 #include "types.hh"
 
 namespace ast {
+	class Visitor; // forward decl.
+	class Node;
+
+	// what the type inference (opt/types.cc) proved about the operands of an
+	// operator: nothing, numbers in the specialized copy of the enclosing
+	// loop (see For::guards) or numbers everywhere
+	enum class Numeric { Checked, Guarded, Proven };
+
+	// Owns the nodes created while it is in use (see Scope), the trees of
+	// one compilation: they are bump-allocated from its chunks and destroyed
+	// together with it, no node deletes its children and a visitor replacing
+	// a node just drops it.
+	class Arena {
+	public:
+		Arena(): used(chunk_size) {}
+		~Arena();
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		// new nodes of this thread are allocated from `arena` until the scope ends
+		class Scope {
+		public:
+			explicit Scope(Arena &arena): outer(current) { current = &arena; }
+			~Scope() { current = outer; }
+		private:
+			Arena* outer;
+		};
+
+		static void* allocate(std::size_t);
+		static void release(void*);
+	private:
+		static constexpr std::size_t chunk_size = 64 * 1024;
+		static thread_local Arena* current;
+		std::vector<std::unique_ptr<char[]>> chunks;
+		std::size_t used;
+		std::vector<void*> nodes;
+	};
+
 	class Node {
 	public:
 		virtual ~Node() = default;
-		virtual Node* optimize(void) = 0;
+		static void* operator new(std::size_t size) { return Arena::allocate(size); }
+		static void operator delete(void* ptr) { Arena::release(ptr); }
+		virtual Node* accept(Visitor&) = 0;
 		virtual void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const { throw std::runtime_error("unimplemented!"); };
 	};
 
@@ -22,16 +62,15 @@ namespace ast {
 	public:
 		explicit Variable(asbi::StringContainer* sc): sc(sc) {}
 		asbi::StringContainer* sc;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class Access: public Node {
 	public:
 		Access(Node* left, Node* right): left(left), right(right) {}
-		~Access() { delete left; delete right; }
 		Node *left, *right;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -41,9 +80,9 @@ namespace ast {
 			Add, Sub, Mul, Div, And, Or, Equals, EqualsNot, Bigger, BiggerOrEqual, Smaller, SmallerOrEqual
 		} type;
 		Node *lhs, *rhs;
+		Numeric numeric = Numeric::Checked;
 		InfixOperator(optype_t type, Node* lhs, Node* rhs): type(type), lhs(lhs), rhs(rhs) {}
-		~InfixOperator() { delete lhs; delete rhs; }
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -53,28 +92,26 @@ namespace ast {
 			Not, Neg
 		} type;
 		Node* operand;
+		Numeric numeric = Numeric::Checked;
 		PrefxOperator(optype_t type, Node* operand): type(type), operand(operand) {}
-		~PrefxOperator() { delete operand; }
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class VariableDecl: public Node {
 	public:
 		VariableDecl(std::vector<std::pair<Variable*, Node*>> decls): decls(decls) {}
-		~VariableDecl();
 		std::vector<std::pair<Variable*, Node*>> decls;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class DestructList: public Node {
 	public:
 		DestructList(std::vector<Node*> lhss, Node* rhs): lhss(lhss), rhs(rhs) {}
-		~DestructList();
 		std::vector<Node*> lhss;
 		Node* rhs;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -82,10 +119,9 @@ namespace ast {
 	class DestructMap: public Node {
 	public:
 		DestructMap(std::vector<std::pair<Variable*, Node*>> vars, Node* val): vars(vars), val(val) {}
-		~DestructMap();
 		std::vector<std::pair<Variable*, Node*>> vars;
 		Node* val;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		// void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 	*/
@@ -93,31 +129,28 @@ namespace ast {
 	class AssignVariable: public Node {
 	public:
 		AssignVariable(Variable* var, Node* val): var(var), val(val) {}
-		~AssignVariable() { delete var; delete val; }
 		Variable* var;
 		Node* val;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class AssignAccess: public Node {
 	public:
 		AssignAccess(Access* acs, Node* val): acs(acs), val(val) {}
-		~AssignAccess() { delete acs; delete val; }
 		Access* acs;
 		Node* val;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class If: public Node {
 	public:
 		If(Node* cond, Node* ifbody, Node* elsebody): cond(cond), ifbody(ifbody), elsebody(elsebody) {}
-		~If();
 		Node* cond;
 		Node* ifbody;
 		Node* elsebody;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -125,18 +158,20 @@ namespace ast {
 	public:
 		For(Node* init, Node* cond, Node* inc, Node* body):
 		 	init(init), cond(cond), inc(inc), body(body) {}
-		~For();
 		Node *init, *cond, *inc, *body;
-		Node* optimize(void) override;
+		// variables checked to be numbers before running a specialized copy
+		std::vector<asbi::StringContainer*> guards;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
+	private:
+		void loop_to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const;
 	};
 
 	class Block: public Node {
 	public:
 		Block(std::vector<Node*> exprs): exprs(exprs) {}
-		~Block();
 		std::vector<Node*> exprs;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -144,7 +179,7 @@ namespace ast {
 	class Nil: public Node {
 	public:
 		Nil() {}
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -152,7 +187,7 @@ namespace ast {
 	public:
 		explicit Number(double val): value(val) {}
 		double value;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -160,7 +195,7 @@ namespace ast {
 	public:
 		explicit Bool(bool val): value(val) {}
 		bool value;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -168,7 +203,7 @@ namespace ast {
 	public:
 		explicit String(asbi::StringContainer* sc): sc(sc) {}
 		mutable asbi::StringContainer* sc;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
@@ -176,49 +211,83 @@ namespace ast {
 	public:
 		explicit Symbol(asbi::StringContainer* sc): sc(sc) {}
 		mutable asbi::StringContainer* sc;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class List: public Node {
 	public:
 		List(std::vector<Node*> vals): values(vals) {}
-		~List();
 		std::vector<Node*> values;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class Map: public Node {
 	public:
 		Map(std::vector<std::pair<Node*,Node*>> vals): values(vals) {}
-		~Map();
 		std::vector<std::pair<Node*,Node*>> values;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
+	// the value of a List/Map literal whose keys and values are constants
+	// (nested literals included), built once for CLONE_MAP, or nullptr
+	asbi::MapContainer* map_template(asbi::Context*, const Node*);
+
 	class Lambda: public Node {
 	public:
 		Lambda(std::vector<asbi::StringContainer*> argnames, Block* body):
 			argnames(argnames), body(body) {}
-		~Lambda() { delete body; }
 		std::vector<asbi::StringContainer*> argnames;
 		Block* body;
-		Node* optimize(void) override;
+		asbi::LazyBody* lazy = nullptr; // body not parsed yet, `body` is empty
+		bool sealed = false; // the body starts with SEAL_ENV (see opt::seal_lambdas())
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
 	class Call: public Node {
 	public:
 		Call(Node* callable, std::vector<Node*> args): callable(callable), args(args) {}
-		~Call();
 		Node* callable;
 		std::vector<Node*> args;
-		Node* optimize(void) override;
+		Node* accept(Visitor&) override;
 		void to_vmops(asbi::Context*, std::vector<asbi::OpCode>&) const override;
 	};
 
+	// Rewriting visitor: the node returned by a visit_*() replaces the visited
+	// node in its parent. The default implementations visit all children
+	// (but not binding sites like declared variable names) and return the node
+	// itself. Replaced nodes are freed with the arena.
+	class Visitor {
+	public:
+		virtual ~Visitor() = default;
+		Node* visit(Node* node) { return node->accept(*this); }
+		Block* visit_body(Block*);
+
+		virtual Node* visit_variable(Variable*);
+		virtual Node* visit_access(Access*);
+		virtual Node* visit_infix(InfixOperator*);
+		virtual Node* visit_prefix(PrefxOperator*);
+		virtual Node* visit_decl(VariableDecl*);
+		virtual Node* visit_destruct(DestructList*);
+		virtual Node* visit_assign_variable(AssignVariable*);
+		virtual Node* visit_assign_access(AssignAccess*);
+		virtual Node* visit_if(If*);
+		virtual Node* visit_for(For*);
+		virtual Node* visit_block(Block*);
+		virtual Node* visit_nil(Nil*);
+		virtual Node* visit_number(Number*);
+		virtual Node* visit_bool(Bool*);
+		virtual Node* visit_string(String*);
+		virtual Node* visit_symbol(Symbol*);
+		virtual Node* visit_list(List*);
+		virtual Node* visit_map(Map*);
+		virtual Node* visit_lambda(Lambda*);
+		virtual Node* visit_call(Call*);
+	};
+
 }
 
 #endif
@@ -0,0 +1,45 @@
+#ifndef CACHE_HH
+#define CACHE_HH
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace asbi {
+	class Context; // forward decl.
+	enum OpCode: uint64_t; // forward decl.
+
+	// The bytecode of the files run as scripts or modules, stored in `dir`
+	// for the next process, one file per path and PassManager::config().
+	// The pointers among the immediates are written as indices into tables
+	// of the strings, lambdas and templates of the file; global cells and
+	// builtins are looked up again when it is loaded. An entry is used only
+	// for the same mtime and source.
+	class BytecodeCache {
+	public:
+		BytecodeCache(Context* ctx, std::string dir): ctx(ctx), dir(dir) {}
+
+		// the default directory: $XDG_CACHE_HOME/asbi or ~/.cache/asbi, "" if neither is set
+		static std::string default_dir();
+
+		// the ops of the file at `path` with the contents `source`, the
+		// lambdas and templates they use are added to the context. False if
+		// the entry is missing, outdated or does not fit the globals
+		bool load(const std::string &path, const std::string &source, std::vector<OpCode> &ops);
+
+		// could load() use the entry? Only reads the file, safe on any thread
+		bool stored(const std::string &path, const std::string &source) const;
+
+		// replaces the entry for `path` with `ops`, errors are ignored
+		void store(const std::string &path, const std::string &source, const std::vector<OpCode> &ops);
+	private:
+		Context* ctx;
+		std::string dir;
+
+		std::string entry(const std::string &path) const;
+		std::string header(const std::string &path, const std::string &source) const;
+		bool builtins_intact() const;
+	};
+}
+
+#endif
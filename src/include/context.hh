@@ -1,22 +1,32 @@
 #ifndef CONTEXT_HH
 #define CONTEXT_HH
 
+#include <algorithm>
 #include <unordered_map>
 #include <cstdint>
 #include <cstdlib>
 #include <string>
+#include <string_view>
+#include <istream>
+#include <ostream>
 #include <memory>
+#include <mutex>
 #include "mem.hh"
 #include "types.hh"
 #include "../events/loop.hh"
+#include "../opt/passes.hh"
+
+namespace ast { class Arena; } // forward decl.
 
 namespace asbi {
 	enum OpCode: uint64_t; // forward decl.
+	class Preloader; // forward decl.
+	class BytecodeCache; // forward decl.
 
-	// TODO: gc_reset() um gc_inuse zurueck zu setzten bzw. gc_visit() gc_inuse setzten lassen
 	class Env {
 		friend Context;
 		friend Value;
+		friend class Snapshot;
 		friend Value execute(std::vector<OpCode>, std::shared_ptr<Env>, Context*);
 	public:
 		Env(Context*, std::shared_ptr<Env>);
@@ -26,11 +36,17 @@ namespace asbi {
 		void decl(StringContainer*, Value);
 		void decl(Context*, const char*, Value);
 		void set(StringContainer*, Value);
-		void gc_visit() const;
+		Value* find(StringContainer*); // like lookup(), nullptr if not found
 		Value to_map(Context*) const;
 	private:
+		Context* ctx;
 		std::shared_ptr<Env> outer;
 		std::shared_ptr<Env> caller;
+
+		// the passes reasoned about the variables (see opt::Unit::sealed),
+		// `eval` and `__scope` refuse it; the envs inside a sealed one (its
+		// scopes, the calls of its lambdas) are sealed as well
+		bool sealed;
 		std::unordered_map<
 			StringContainer*,
 			Value,
@@ -38,38 +54,141 @@ namespace asbi {
 			StringContainer::equalStructPointer
 		> vars;
 
-		mutable bool gc_visited = false;
-		void gc_unvisit() const;
+		// envs are not collected by the GC but by their reference count, one
+		// created before the last collection (`epoch`) is treated like an old
+		// object: remembered when a young value is written into it
+		std::size_t epoch;
+		// marked by the current marking if equal to Context::gc_marks
+		mutable std::size_t gc_mark = 0;
+		mutable bool gc_gray = false;
+		mutable std::size_t gc_gray_index; // in Context::gray_envs
+		bool gc_remembered = false;
+		std::size_t gc_index; // in Context::remembered_envs
+		void write_barrier(const Value&);
+		bool gc_young_refs() const;
 	public:
 		std::shared_ptr<Env> getOuter() { return outer; }
+		bool isSealed() const { return sealed; }
+		void setCaller(std::shared_ptr<Env> env) { caller = env; }
 	};
 
 	class Context {
 		friend GCObj;
+		friend Env;
+		friend MapContainer; // MapContainer::clone(), remember()
+		friend class Snapshot;
 		friend Value execute(std::vector<OpCode>, std::shared_ptr<Env>, Context*);
+	public:
+		// GC objects are allocated from `heap` (`new (ctx->heap) ...`), string
+		// constants from `constants`, which is never swept (the preloader
+		// threads allocate them); first so the pages outlive every object
+		Pool heap, constants;
 	private:
 		// std::vector<StringContainer*> stringconstants; // TODO: vector durch map ersetzen?
 		std::vector<StringContainer*> strconsts[32];
 
 		void load_macros();
+		ast::Node* parse(const std::string&, unsigned int line);
+		void compile(ast::Node*, opt::Unit&, std::vector<OpCode>&);
+		Value execute_unit(std::vector<OpCode>&, std::shared_ptr<Env>, std::size_t nlambdas, std::size_t first);
+
+		// the next major collection starts at twice the size of what survived
+		// the last one, at least at `heap_min` (a nearly empty heap would be
+		// collected over and over)
+		static constexpr std::size_t heap_min = 256 * 1024;
+		std::size_t heap_size = 0, heap_max = heap_min;
+		// not every object is counted when it is created (strings of
+		// builtins, maps growing through MapContainer::set()), heap_size
+		// must not wrap around when they are freed
+		void gc_freed(std::size_t bytes) { heap_size -= std::min(heap_size, bytes); }
+
+		// young objects, collected by gc_minor() once there are `nursery_max`
+		std::size_t nursery_count = 0, nursery_max = 4096;
+		static constexpr unsigned char promote_age = 2;
+
+		// old maps and envs that point to young objects (see the write
+		// barriers in MapContainer::set() and Env), roots of gc_minor()
+		std::vector<MapContainer*> remembered_maps;
+		std::vector<Env*> remembered_envs; // nullptr: freed since
+		std::size_t gc_epoch = 0; // number of collections
+		// incremented after every marking, which unmarks all envs at once
+		std::size_t gc_marks = 1;
+		// the envs looked into by a minor collection
+		std::vector<const Env*> minor_envs;
+		void remember(MapContainer*);
+		void remember(Env*);
+		void gc_minor(std::shared_ptr<Env>);
+		void gc_roots(std::shared_ptr<Env>);
+		void gc_finish();
+		void gc_promote_nursery();
+
+		// incremental major collections: the roots are shaded by gc_start(),
+		// every check_gc() then marks or sweeps `gc_slice` values' worth of
+		// the old heap (gc_step()); no minor collections in between, the
+		// stop-the-world ones (gc_lazy()) only leave the sweeping to it
+		enum class GCPhase { Idle, Mark, Sweep } gc_phase = GCPhase::Idle;
+		std::vector<const GCObj*> gray;
+		std::vector<const Env*> gray_envs; // nullptr: freed since
+		const MapContainer* scanning = nullptr; // vecdata from scan_pos is gray
+		std::size_t scan_pos = 0;
+		std::size_t sweep_next = 0; // page of the heap
+		void gc_start(std::shared_ptr<Env>);
+		void gc_step(std::shared_ptr<Env>);
+		bool gc_mark(std::size_t budget); // true once nothing is gray
+		void gc_abort();
+		void gc_lazy(std::shared_ptr<Env>);
+		void gc_mark_all(std::shared_ptr<Env>);
 
-		GCObj* heap_head = nullptr;
-		std::size_t heap_size = 0, heap_max = 128 * 2 * 2;
+		std::vector<double> gc_pauses; // of check_gc(), in microseconds
+
+		// major collections with gc_threads > 1: marking from the roots with
+		// work stealing, then sweeping the pages of the heap
+		struct GCMarkers;
+		void gc_mark_parallel(std::shared_ptr<Env>);
+		void gc_mark_worker(GCMarkers&, unsigned int);
+		void gc_sweep();
+		void gc_sweep_parallel();
 	public:
 		Context();
 		~Context();
 
 		Value run(const std::string&);
-		Value run(const std::string&, std::shared_ptr<Env>);
+		// open: can later runs in the same env see the top level variables (repl, eval)?
+		Value run(const std::string&, std::shared_ptr<Env>, bool open = true, unsigned int line = 1);
+		// each top-level statement is compiled and run as soon as it has been read
+		Value run(std::istream&);
+		// the file at `path` as a unit in the env: parsed by the preloader,
+		// from the bytecode cache (closed units only) or compiled now
+		Value run_file(const std::string &path, std::shared_ptr<Env>, bool open = false);
 
 		evts::Loop evtloop;
+		opt::PassManager optimizer;
 		std::shared_ptr<Env> global_env;
 
 		std::vector<Value> stack;
 		void push(Value);
 		Value pop();
 
+		// global names as declared by the interpreter itself
+		std::unordered_map<StringContainer*, Value> builtins;
+		void declare_builtin(const char*, Value);
+
+		// where a name bound in the global env keeps its value, nullptr if it
+		// is not bound (yet): code looking it up reads the cell directly
+		// (LOOKUP_GLOBAL) as long as the name is not declared anywhere else
+		Value* global_cell(StringContainer*);
+
 		std::vector<LambdaContainer*> lambdas; // nur da um die opcodes aller lambdas zu speichern, nicht die lambdas selbst
+		std::vector<MapContainer*> templates;  // constant literals copied by CLONE_MAP, not managed by the GC
+		std::vector<LazyBody*> lazy_bodies;
+		void compile_lazy(LambdaContainer*);
+
+		// parses imported modules on worker threads, their parsers share the
+		// string constants and lazy_bodies under parse_mtx
+		std::unique_ptr<Preloader> preloader;
+		std::mutex parse_mtx;
+
+		std::unique_ptr<BytecodeCache> cache; // nullptr: compile every file
 
 		struct {
 			StringContainer* __file;
@@ -79,13 +198,29 @@ namespace asbi {
 			StringContainer* ok;
 			StringContainer* err;
 		} names;
+		StringContainer* type_names[static_cast<int>(type_t::StackPlaceholder) + 1]; // typeof() by type_t
 		StringContainer* new_stringconstant(const char*);
-		StringContainer* new_stringconstant(std::string&);
+		StringContainer* new_stringconstant(std::string_view);
 		StringContainer* new_string(const char*);
 		StringContainer* new_string(std::string&);
 
 		void check_gc(std::shared_ptr<Env>);
+		// a full collection of both generations, swept right away
 		void gc(std::shared_ptr<Env>);
+
+		// values marked or swept per step of an incremental collection,
+		// 0: major collections stop the world to mark
+		std::size_t gc_slice = 1000;
+		// threads of a major collection, more than one: they stop the world
+		// (instead of running incrementally) and mark in parallel, gc()
+		// also sweeps in parallel
+		unsigned int gc_threads = 1;
+		// marks a value or env and leaves it to gc_mark() to look into (the
+		// roots, GCObj::gc_scan(), the write barriers while marking)
+		void shade(const Value&);
+		void shade(const Env*);
+		// number of collections and pauses (p50/p99/max)
+		void report_gc(std::ostream&) const;
 	};
 
 }
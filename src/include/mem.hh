@@ -2,19 +2,137 @@
 #define MEM_HH
 
 #include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
 
 namespace asbi {
 	class Context; // forward decl.
+	class GCObj;   // forward decl.
+
+	// memory of the GC objects of one context: sizes are rounded up to
+	// `granule` bytes, every size class carves its own pages. The header of a
+	// page has a bit per slot in side bitmaps: allocated, young (the
+	// nursery), old (swept by major collections) and marked. Marking only
+	// writes to the bitmaps, the collections walk the bitmaps of the pages
+	// instead of lists of objects and look only at the objects they free or
+	// promote. Pages are mapped one at a time and unmapped once a major
+	// collection left them empty.
+	class Pool {
+	public:
+		static constexpr std::size_t granule = 16, classes = 16, max_size = granule * classes;
+
+		Pool() = default;
+		~Pool();
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		void* allocate(std::size_t);
+		static void release(void*); // into the pool the object came from
+
+		static bool marked(const GCObj* obj) {
+			auto page = page_of(obj);
+			auto i = page->index(obj);
+			return (page->marks[i / 64] >> (i % 64)) & 1;
+		}
+		static void mark(const GCObj* obj) {
+			auto page = page_of(obj);
+			auto i = page->index(obj);
+			page->marks[i / 64] |= 1ull << (i % 64);
+		}
+		// atomically for the parallel markers, false if it was marked already
+		static bool claim(const GCObj*);
+
+		// a managed object was created, see GCObj::GCObj()
+		void add_young(const GCObj*);
+		// the unmarked young objects are appended to `dead` (still
+		// allocated), `promote(obj)` is called for the marked ones and true if
+		// it becomes old; the young ones are unmarked afterwards
+		template<typename F> void collect_young(std::vector<GCObj*> &dead, F promote);
+		// all of them become old, with their marks (see Context::gc_promote_nursery())
+		template<typename F> void promote_young(F promote);
+		void unmark_young();
+		void unmark();
+
+		// frees the old objects of page `i` that are managed and not marked,
+		// clears its marks, returns the number of old objects looked at
+		std::size_t sweep(std::size_t i, std::size_t &freed);
+		std::size_t npages() const { return pages.size(); }
+		// after every page was swept: empty pages are unmapped, the allocation
+		// starts over in the pages with free slots
+		void trim();
+	private:
+		static constexpr std::size_t page_size = 64 * 1024, header = 2048, words = 62;
+
+		struct Page {
+			Pool* pool;
+			std::uint32_t size, slots; // bytes per slot, slots in the page
+			std::uint32_t recip; // 2^32 / size rounded up, see index()
+			bool young_listed, partial_listed;
+			std::uint64_t alloc[words], young[words], old[words], marks[words];
+
+			std::size_t nwords() const { return (slots + 63) / 64; }
+			char* slot(std::size_t i) { return reinterpret_cast<char*>(this) + header + i * size; }
+			// offsets are multiples of the size, the multiplication is exact
+			std::size_t index(const void* ptr) const {
+				auto offset = static_cast<std::uint64_t>(static_cast<const char*>(ptr) - reinterpret_cast<const char*>(this) - header);
+				return (offset * recip) >> 32;
+			}
+			// the bits of word `w` that stand for slots of the page
+			std::uint64_t valid(std::size_t w) const {
+				auto n = slots - std::min<std::size_t>(slots, w * 64);
+				return n >= 64 ? ~0ull : (1ull << n) - 1;
+			}
+		};
+		static_assert(sizeof(Page) <= header && (page_size - header) / granule <= words * 64);
+
+		static Page* page_of(const void* ptr) {
+			return reinterpret_cast<Page*>(reinterpret_cast<std::uintptr_t>(ptr) & ~(page_size - 1));
+		}
+
+		// every class allocates from the free slots of one word of a page at
+		// a time, they are counted as allocated while they are in `free`
+		struct Cursor {
+			Page* page = nullptr;
+			std::size_t word = 0, next = 0;
+			std::uint64_t free = 0;
+		};
+		Cursor cursors[classes];
+		std::vector<Page*> pages;
+		std::vector<Page*> partial[classes]; // pages with free slots
+		std::vector<Page*> young_pages;
+		void refill(Cursor&, std::size_t cls);
+		Page* new_page(std::size_t cls);
+	};
 
 	class GCObj {
 	public:
 		GCObj(Context*, bool);
 		virtual ~GCObj();
-		virtual void gc_visit() const = 0;
+		// from the pool of the context, `new (ctx->heap) MapContainer(ctx)`
+		static void* operator new(std::size_t size, Pool &pool) { return pool.allocate(size); }
+		static void operator delete(void* ptr, Pool&) { Pool::release(ptr); }
+		static void operator delete(void* ptr) { Pool::release(ptr); }
 		virtual std::size_t gc_size() const = 0;
+		// moved to the old heap by a minor collection, true if it still
+		// points to young objects (see Context::gc_minor())
+		virtual bool gc_promote() { return false; }
+		// shades the objects this one points to (see Context::shade()),
+		// returns the work done in values looked at
+		virtual std::size_t gc_scan(Context*) const { return 1; }
+
+		mutable bool gc_manage = true;
+
+		// objects start in the nursery and are moved to the old heap after
+		// surviving `Context::promote_age` minor collections, objects not
+		// managed by the GC count as old
+		bool gc_old = false, gc_remembered = false;
+		unsigned char gc_age = 0;
 
-		GCObj* gc_next = nullptr;
-		mutable bool gc_inuse = false, gc_manage = true;
+		// set during a minor collection: old objects count as marked and are
+		// only looked into when they are in the remembered set
+		static inline bool gc_minor = false;
+		bool gc_marked() const { return (gc_old && gc_minor) || Pool::marked(this); }
 	};
 
 }
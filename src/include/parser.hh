@@ -10,12 +10,15 @@
 namespace asbi {
 	class Parser {
 	public:
-		explicit Parser(tok::Tokenizer, Context*);
+		// lazy: lambda bodies in `{...}` are only skimmed, see skim_body(),
+		// checked: the source was parsed before (the body of a lazy lambda)
+		explicit Parser(tok::Tokenizer, Context*, bool lazy = false, bool checked = false);
 		ast::Node* next();
 		ast::Node* parse();
 	private:
 		tok::Tokenizer tokenizer;
 		Context *ctx;
+		bool lazy, checked;
 
 	    void expect(tok::Type);
 
@@ -31,6 +34,7 @@ namespace asbi {
 		ast::Node* parse_final();
 
 	    ast::Lambda* parse_lambda(std::vector<ast::Node*>);
+		LazyBody* skim_body();
 		ast::Map* parse_map(ast::Node*);
 		ast::Block* parse_block();
 		void parse_arglist(std::vector<ast::Node*>&);
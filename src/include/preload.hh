@@ -0,0 +1,61 @@
+#ifndef PRELOAD_HH
+#define PRELOAD_HH
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <unordered_map>
+#include "ast.hh"
+#include "../events/utils.hh"
+
+namespace asbi {
+	class Context; // forward decl.
+
+	// a module read (and parsed) before execution reached its import()
+	struct Preloaded {
+		std::string source;
+		std::unique_ptr<ast::Arena> arena;
+		ast::Node* ast = nullptr; // not parsed, the bytecode cache has it
+	};
+
+	// Reads and parses the modules a script imports with a literal path
+	// (`import("lib.asbi")`) on worker threads while the script runs, and
+	// the modules those import in turn. They are compiled when they are
+	// imported: the passes and the codegen look at the envs of the main thread.
+	class Preloader {
+	public:
+		explicit Preloader(Context* ctx): ctx(ctx), queued(0) {}
+		~Preloader();
+
+		// queues the literal imports in `source`, the file at `path`
+		void scan(const std::string &source, const std::string &path);
+
+		// the parsed module at `path` (after waiting for it), nullptr if it
+		// was never queued or has been taken already; rethrows errors
+		std::unique_ptr<Preloaded> take(const std::string &path);
+	private:
+		struct Module {
+			bool done = false;
+			std::unique_ptr<Preloaded> parsed;
+			std::exception_ptr error;
+		};
+
+		Context* ctx;
+		std::mutex mtx; // modules and queue
+		std::condition_variable loaded;
+		std::unordered_map<std::string, Module> modules;
+		std::deque<std::string> queue; // an empty path stops a worker
+		evts::Semaphore queued;
+		std::vector<std::thread> threads;
+
+		void worker();
+		std::unique_ptr<Preloaded> load(std::string path);
+	};
+}
+
+#endif
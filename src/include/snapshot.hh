@@ -0,0 +1,26 @@
+#ifndef SNAPSHOT_HH
+#define SNAPSHOT_HH
+
+#include <string>
+#include <memory>
+
+namespace asbi {
+	class Context; // forward decl.
+	class Env;     // forward decl.
+
+	// The heap of a context after a script ran (asbi --snapshot), restored
+	// into a new one instead of running it again (asbi --from-snapshot):
+	// the envs, maps, strings, lambdas and their bytecode reachable from
+	// the global env and the env of the script. The builtin functions and
+	// maps are saved by name and taken from the new context, events that
+	// are still pending are not saved.
+	class Snapshot {
+	public:
+		static void save(Context*, std::shared_ptr<Env> env, const std::string &path);
+
+		// into a context that has not run anything yet, returns the saved `env`
+		static std::shared_ptr<Env> load(Context*, const std::string &path);
+	};
+}
+
+#endif
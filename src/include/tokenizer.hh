@@ -2,7 +2,9 @@
 #define TOKENIZER_HH
 
 #include <string>
-#include <memory>
+#include <string_view>
+#include <deque>
+#include <istream>
 
 namespace tok {
 
@@ -28,17 +30,20 @@ namespace tok {
 	struct Token {
 		inline Token(Type type, unsigned int line):
 			type(type), line(line), integer(0) {}
-		inline Token(Type type, std::string* _str, unsigned int line):
-			type(type), line(line), str(_str) {}
+		inline Token(Type type, std::string_view _str, unsigned int line):
+			type(type), line(line), text{ _str.data(), _str.size() } {}
 		inline Token(Type type, int _integer, unsigned int line):
 			type(type), line(line), integer(_integer) {}
 		inline Token(Type type, double _real, unsigned int line):
 			type(type), line(line), real(_real) {}
 
+		// Identifier and String: the text, valid as long as the source and the tokenizer
+		inline std::string_view str() const { return std::string_view(text.data, text.size); }
+
 		Type type;
 		unsigned int line;
 		union {
-			std::string* str;
+			struct { const char* data; std::size_t size; } text;
 			int integer;
 			double real;
 		};
@@ -48,20 +53,55 @@ namespace tok {
 
 	class Tokenizer {
 	public:
-		explicit Tokenizer(const std::string &source):
-			pos(0), line(1), source(source), tokbuf(Token(EOFTok, 0)), tokbuffed(false) {}
+		explicit Tokenizer(const std::string &source, unsigned int line = 1):
+			pos(0), line(line), source(source), tokbuf(Token(EOFTok, 0)), tokbuffed(false) {}
 
 		Token next(void);
 		Token peek(void);
+
+		// position in the source after the last token read (or peeked)
+		unsigned long offset() const { return pos; }
+		// line of offset()
+		unsigned int lineno() const { return line; }
+		// continue at `pos` (in line `line`), dropping a peeked token
+		void seek(unsigned long pos, unsigned int line);
+		const std::string& text() const { return source; }
 	private:
 		Token next_string(char);
 		Token next_number(void);
+		Token next_identifier(void);
 
 		unsigned long pos;
 		unsigned int line;
 		const std::string &source;
 		Token tokbuf;
 		bool tokbuffed;
+		// string literals with escape sequences, the tokens point into it
+		std::deque<std::string> escaped;
+	};
+
+	// Reads the top-level statements of a script (up to a `;` outside of
+	// brackets) from a stream, one line at a time and only as many lines as
+	// the next statement needs.
+	class StatementReader {
+	public:
+		explicit StatementReader(std::istream &in): in(in) {}
+
+		// the next statement and the line it starts in, false at the end
+		bool next(std::string &statement, unsigned int &line);
+	private:
+		std::istream &in;
+		std::string buffer; // the start of the next statement
+		unsigned long scanned = 0; // tokenized part of buffer
+		unsigned int depth = 0;
+		bool for_header = false;
+		Type last = EOFTok;
+		unsigned int line = 1, scanned_line = 1; // of the start of buffer, of buffer[scanned]
+		// a string (its quote) or block comment ('*') left open after
+		// scanned, the lines read since are only searched for its end (from
+		// resume on)
+		char open = 0;
+		unsigned long resume = 0;
 	};
 }
 
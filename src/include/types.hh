@@ -114,7 +114,7 @@ namespace asbi {
 		bool operator==(const Value &rhs) const;
 		std::size_t hash() const;
 		std::string to_string(bool debug) const;
-		void gc_visit() const;
+		bool gc_young() const; // a string, lambda or map in the nursery?
 		bool asUint(unsigned int*) const;
 		Value call(Context*, unsigned int argcount, std::shared_ptr<Env> callerenv) const;
 	};
@@ -139,11 +139,21 @@ namespace asbi {
 		};
 		std::size_t hash;
 		std::string data;
+		// a name declared in an env other than the global one, LOOKUP_GLOBAL
+		// has to search the envs for it
+		bool local = false;
 
-		void gc_visit() const override;
 		std::size_t gc_size() const override;
 	};
 
+	// source of a lambda body compiled when it is called for the first time
+	// (see Parser::skim_body())
+	struct LazyBody {
+		std::string source; // `{...}`
+		unsigned int line;
+		bool compiled;
+	};
+
 	class LambdaContainer: public GCObj {
 	public:
 		LambdaContainer(std::shared_ptr<Env>, std::vector<OpCode>*, std::vector<StringContainer*>, Context*, bool gc);
@@ -152,9 +162,10 @@ namespace asbi {
 		std::shared_ptr<Env> env;
 		std::vector<OpCode>* ops;
 		std::vector<StringContainer*> argnames;
+		LazyBody* lazy = nullptr; // *ops still empty unless lazy->compiled
 
-		void gc_visit() const override;
 		std::size_t gc_size() const override;
+		std::size_t gc_scan(Context*) const override;
 	};
 
 	class MapContainer: public GCObj {
@@ -168,15 +179,44 @@ namespace asbi {
 		> data;
 		std::vector<Value> vecdata;
 
-		MapContainer(Context*);
+		MapContainer(Context*, bool gc = true);
 
-		void gc_visit() const override;
 		std::size_t gc_size() const override;
+		std::size_t gc_scan(Context*) const override;
+		bool gc_promote() override;
+
+		// the parts written with young values while the map is old, visited
+		// by minor collections: vecdata[gc_dirty_lo, gc_dirty_hi) and data
+		std::size_t gc_dirty_lo = 0, gc_dirty_hi = 0;
+		bool gc_dirty_data = false;
+		void gc_scan_dirty() const;
+		bool gc_trim(); // shrinks the dirty parts, false if nothing is left
 
 		void set(Value key, Value val);
 		Value get(Value key);
+
+		// new map managed by the GC with copies of the nested maps, for
+		// templates of constant literals (see CLONE_MAP)
+		MapContainer* clone(Context*) const;
+	private:
+		Context* ctx; // for the write barrier in set()
 	};
 
+	// inline for the write barriers
+	inline bool Value::gc_young() const {
+		switch (type) {
+		case type_t::Symbol:
+		case type_t::String:
+			return !_string->gc_old;
+		case type_t::Lambda:
+			return !_lambda->gc_old;
+		case type_t::Map:
+			return !_map->gc_old;
+		default:
+			return false;
+		}
+	}
+
 }
 
 #endif
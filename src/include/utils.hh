@@ -48,9 +48,9 @@ namespace utils {
 		std::string what_message;
 	};
 
-	std::string dirname(std::string &path);
+	std::string dirname(const std::string &path);
 	std::string normalize(std::string &path);
-	void readfile(std::string &path, std::string &content);
+	void readfile(const std::string &path, std::string &content);
 	std::string join(std::string &a, std::string &b);
 
 }
@@ -25,23 +25,56 @@ namespace asbi {
 		POP,
 		ENTER_SCOPE,
 		LEAVE_SCOPE,
+		SEAL_ENV, // first op of the functions of a sealed unit (see opt::Unit)
 		CALL,
 		LOOKUP, DECL, SET,
+		LOOKUP_GLOBAL, // name, cell (see Context::global_cell())
+		DECL_POP, SET_POP, // DECL/SET followed by POP (see opt/peephole.cc)
 		ADD, SUB, MUL, DIV,
 		EQUALS, EQUALS_NOT,
 		SMALLER, BIGGER, SMALLER_OR_EQUAL, BIGGER_OR_EQUAL,
+		// operands known to be numbers
+		ADD_NUM, SUB_NUM, MUL_NUM, DIV_NUM,
+		SMALLER_NUM, BIGGER_NUM, SMALLER_OR_EQUAL_NUM, BIGGER_OR_EQUAL_NUM,
+		NEG, NEG_NUM, // 0 - x
+		// calls of builtins: name, cell, macro (see intrinsic())
+		LEN, TYPEOF, MOD, TO_INT,
 		NOT,
 		MAKE_MAP,
 		MAKE_MAP_ARRLIKE,
+		CLONE_MAP, // copy of a literal of constants (see ast::map_template())
 		GET_MAP_VAL,
 		SET_MAP_VAL,
 		DESTRUCT_ARRLIKE,
 		GOTO, IF_TRUE_GOTO, IF_FALSE_GOTO,
+		IF_NOT_NUMBER_GOTO,
+		// slots of the frame, reserved below the stack of a function (see ir/)
+		RESERVE, FREE, LOAD_SLOT, STORE_SLOT,
 		NOOP,
 	};
 
 	Value execute(std::vector<OpCode>, std::shared_ptr<Env>, Context*);
 
+	// number of immediates following the opcode
+	unsigned int immediates(OpCode);
+
+	// what the immediates of an opcode are: plain numbers (Raw) or pointers
+	// to StringContainers, LambdaContainers (templates of closures), CLONE_MAP
+	// templates, global cells or builtin macros. Returns their number
+	enum class Immediate { Raw, String, Lambda, Template, Cell, Macro };
+	unsigned int immediates(OpCode, Immediate kinds[3]);
+
+	// the opcode calling the builtin `name` with `nargs` arguments, NOOP if
+	// there is none or `name` is not bound to the builtin. If the name is
+	// rebound or shadowed later, the opcode calls whatever it is bound to.
+	OpCode intrinsic(Context*, StringContainer* name, std::size_t nargs);
+
+	// the builtins behind the intrinsics, arguments in order (macros.cc)
+	Value builtin_len(Value);
+	Value builtin_typeof(Context*, Value);
+	Value builtin_mod(Value, Value);
+	Value builtin_to_int(Value);
+
 }
 
 #endif
@@ -0,0 +1,678 @@
+#include <map>
+#include <set>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "ir.hh"
+#include "../opt/analysis.hh"
+#include "../include/ast.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+using namespace asbi::ir;
+
+/*
+ * AST to IR, following what ast::Node::to_vmops() emits. Promoted variables
+ * are put into SSA form while building ("Simple and Efficient Construction
+ * of Static Single Assignment Form", Braun et al.): scopes end their
+ * declarations by writing an undeclared marker, reading the marker means
+ * the name resolves to an outer binding, in the env. If a read could be
+ * either (declared on some paths only), the function is built again with
+ * that variable kept in the env.
+ */
+
+namespace {
+
+	using Block = ir::Block; // not ast::Block
+
+	// who binds and uses which names, to find variables to promote
+	class Candidates: public Visitor {
+	public:
+		using Local = std::pair<Lambda*, StringContainer*>; // nullptr: the top level
+
+		std::map<Local, unsigned int> binds;
+		std::set<Local> excluded;
+		// names mentioned by lambdas nested in a function (at any depth)
+		std::unordered_map<Lambda*, std::unordered_set<StringContainer*>> nested_uses;
+
+		Node* visit_variable(Variable* node) override {
+			mention(node->sc);
+			return node;
+		}
+		Node* visit_assign_variable(AssignVariable* node) override {
+			mention(node->var->sc);
+			return Visitor::visit_assign_variable(node);
+		}
+		Node* visit_decl(VariableDecl* node) override {
+			for (auto [var, val]: node->decls) {
+				bind(var->sc);
+				if (loop_header > 0)
+					excluded.insert(Local(fns.back(), var->sc));
+			}
+			return Visitor::visit_decl(node);
+		}
+		Node* visit_destruct(DestructList* node) override {
+			// declared by DESTRUCT_ARRLIKE itself
+			for (auto lhs: node->lhss) {
+				if (auto var = dynamic_cast<Variable*>(lhs); var != nullptr) {
+					bind(var->sc);
+					excluded.insert(Local(fns.back(), var->sc));
+				}
+			}
+			return Visitor::visit_destruct(node);
+		}
+		Node* visit_lambda(Lambda* node) override {
+			fns.push_back(node);
+			for (auto argname: node->argnames)
+				bind(argname);
+			Visitor::visit_lambda(node);
+			fns.pop_back();
+			return node;
+		}
+		Node* visit_for(For* node) override {
+			// guards look variables up in the env, declarations in the
+			// condition and increment are repeated in the same scope
+			for (auto guard: node->guards)
+				excluded.insert(Local(fns.back(), guard));
+
+			if (node->init) visit(node->init);
+			loop_header++;
+			visit(node->cond);
+			if (node->inc) visit(node->inc);
+			loop_header--;
+			visit(node->body);
+			return node;
+		}
+	private:
+		std::vector<Lambda*> fns{ nullptr };
+		unsigned int loop_header = 0;
+
+		void bind(StringContainer* name) {
+			binds[Local(fns.back(), name)]++;
+			mention(name);
+		}
+		void mention(StringContainer* name) {
+			for (std::size_t i = 0; i + 1 < fns.size(); i++)
+				nested_uses[fns[i]].insert(name);
+		}
+	};
+
+	struct Analysis {
+		Context* ctx;
+		const opt::Unit &unit;
+		bool dynamic; // see opt::Bindings
+		Candidates candidates;
+
+		// variables of `fn` that can be SSA values: bound once in it and
+		// not seen by any lambda in it
+		std::unordered_set<StringContainer*> promotable(Lambda* fn) const {
+			std::unordered_set<StringContainer*> res;
+			// the top level of an open unit is seen by later ones
+			if (dynamic || (fn == nullptr && unit.open))
+				return res;
+
+			auto nested = candidates.nested_uses.find(fn);
+			for (auto [local, n]: candidates.binds) {
+				auto [owner, name] = local;
+				if (owner != fn || n != 1 || candidates.excluded.count(local) != 0)
+					continue;
+				if (nested != candidates.nested_uses.end() && nested->second.count(name) != 0)
+					continue;
+				// `import` reads `__file` and `exports` from the env
+				if (name != ctx->names.exports && name != ctx->names.__file)
+					res.insert(name);
+			}
+			return res;
+		}
+	};
+
+	struct Nested {
+		Instr* instr;
+		Lambda* lambda;
+		std::string name;
+	};
+
+	class Builder {
+	public:
+		Builder(const Analysis &analysis, std::string name, const std::unordered_set<StringContainer*> &promoted):
+			fn(name), promoted(promoted), analysis(analysis), ctx(analysis.ctx) {
+			undeclared.kind = Instr::Undeclared;
+		}
+
+		Function fn;
+		const std::unordered_set<StringContainer*> &promoted;
+		std::unordered_set<StringContainer*> failed; // declared on some paths only
+		std::vector<Nested> nested;
+
+		void build_function(Node* body, const std::vector<StringContainer*> &params);
+	private:
+		struct Scope {
+			Instr* enter;
+			bool binds; // declares in the env, cannot be left out
+			std::vector<StringContainer*> declared;
+		};
+
+		const Analysis &analysis;
+		Context* ctx;
+		Block* cur = nullptr;
+		bool guarded = false;
+		std::string lambda_name;
+		Instr undeclared;
+		std::vector<Scope> scopes;
+		std::vector<Instr*> incomplete_phis;
+
+		std::unordered_map<Block*, std::unordered_map<StringContainer*, Instr*>> defs;
+		std::unordered_set<Block*> sealed;
+		std::unordered_map<Block*, std::vector<Instr*>> incomplete;
+
+		Instr* build(Node*);
+		Instr* build_infix(InfixOperator*);
+		Instr* build_if(If*);
+		Instr* build_for(For*);
+		void build_loop(For*);
+
+		Instr* emit(OpCode op, std::vector<Instr*> args = {}, std::vector<OpCode> imms = {}) {
+			return fn.new_instr(cur, op, args, imms);
+		}
+		Instr* sc_imm(OpCode op, StringContainer* sc, std::vector<Instr*> args = {}) {
+			return emit(op, args, { *reinterpret_cast<OpCode*>(&sc) });
+		}
+		Instr* nil() { return emit(PUSH_NIL); }
+		void jump(Block*);
+		void branch(Instr* cond, Block* iftrue, Block* iffalse);
+		Instr* phi(Block*, std::vector<Instr*> args);
+
+		void enter_scope();
+		void leave_scope();
+		void binds() {
+			if (!scopes.empty())
+				scopes.back().binds = true;
+		}
+
+		// SSA construction
+		void write(StringContainer*, Block*, Instr*);
+		Instr* read(StringContainer*, Block*);
+		Instr* read_recursive(StringContainer*, Block*);
+		Instr* add_phi_operands(Instr*);
+		Instr* trivial(Instr*);
+		void seal(Block*);
+		void check();
+	};
+
+	// can the operation skip checking that its operands are numbers?
+	bool unchecked(Numeric numeric, bool guarded) {
+		return numeric == Numeric::Proven || (numeric == Numeric::Guarded && guarded);
+	}
+
+}
+
+void Builder::jump(Block* to) {
+	cur->term = Block::Goto;
+	fn.add_edge(cur, to);
+}
+
+void Builder::branch(Instr* cond, Block* iftrue, Block* iffalse) {
+	cur->term = Block::Branch;
+	cur->cond = cond;
+	fn.add_edge(cur, iftrue);
+	fn.add_edge(cur, iffalse);
+}
+
+// value of an expression where control flow merges, args in pred order
+Instr* Builder::phi(Block* block, std::vector<Instr*> args) {
+	if (std::all_of(args.begin(), args.end(), [&](auto arg) { return arg == args[0]; }))
+		return args[0];
+
+	auto res = fn.new_phi(block);
+	res->args = args;
+	return res;
+}
+
+void Builder::enter_scope() {
+	scopes.push_back(Scope{ emit(ENTER_SCOPE), analysis.dynamic, {} });
+}
+
+// scopes nothing is declared in (in the env) are left out
+void Builder::leave_scope() {
+	auto scope = scopes.back();
+	scopes.pop_back();
+	for (auto var: scope.declared)
+		write(var, cur, &undeclared);
+
+	if (scope.binds) {
+		emit(LEAVE_SCOPE);
+		return;
+	}
+	auto &instrs = scope.enter->block->instrs;
+	instrs.erase(std::find(instrs.begin(), instrs.end(), scope.enter));
+}
+
+void Builder::write(StringContainer* var, Block* block, Instr* val) {
+	defs[block][var] = val;
+}
+
+Instr* Builder::read(StringContainer* var, Block* block) {
+	auto &vars = defs[block];
+	if (auto pos = vars.find(var); pos != vars.end())
+		return Function::resolve(pos->second);
+	return read_recursive(var, block);
+}
+
+Instr* Builder::read_recursive(StringContainer* var, Block* block) {
+	Instr* val;
+	if (sealed.count(block) == 0) {
+		val = fn.new_phi(block, var);
+		incomplete[block].push_back(val);
+		incomplete_phis.push_back(val);
+	} else if (block->preds.empty()) {
+		val = &undeclared;
+	} else if (block->preds.size() == 1) {
+		val = read(var, block->preds[0]);
+	} else {
+		auto phi = fn.new_phi(block, var);
+		write(var, block, phi);
+		val = add_phi_operands(phi);
+	}
+	write(var, block, val);
+	return val;
+}
+
+Instr* Builder::add_phi_operands(Instr* phi) {
+	for (auto pred: phi->block->preds)
+		phi->args.push_back(read(phi->var, pred));
+	return trivial(phi);
+}
+
+Instr* Builder::trivial(Instr* phi) {
+	Instr* same = nullptr;
+	for (auto arg: phi->args) {
+		arg = Function::resolve(arg);
+		if (arg == same || arg == phi)
+			continue;
+		if (same != nullptr) {
+			if (same == &undeclared || arg == &undeclared)
+				failed.insert(phi->var);
+			return phi;
+		}
+		same = arg;
+	}
+
+	phi->forward = same != nullptr ? same : &undeclared;
+	return phi->forward;
+}
+
+void Builder::seal(Block* block) {
+	for (auto phi: incomplete[block])
+		add_phi_operands(phi);
+	incomplete.erase(block);
+	sealed.insert(block);
+}
+
+// values read before their loop was complete have to be declared
+void Builder::check() {
+	for (auto phi: incomplete_phis)
+		if (Function::resolve(phi) == &undeclared)
+			failed.insert(phi->var);
+
+	for (auto &block: fn.blocks)
+		for (auto instr: block->instrs)
+			if (instr->kind == Instr::Phi && !instr->dead())
+				for (auto arg: instr->args)
+					if (Function::resolve(arg) == &undeclared)
+						failed.insert(instr->var);
+}
+
+void Builder::build_function(Node* body, const std::vector<StringContainer*> &params) {
+	cur = fn.entry = fn.new_block();
+	sealed.insert(cur);
+	for (auto param: params) {
+		if (promoted.count(param) == 0)
+			continue;
+
+		auto lookup = sc_imm(LOOKUP, param);
+		lookup->removable = true; // arguments are always declared
+		write(param, cur, lookup);
+	}
+
+	auto res = build(body);
+	cur->term = Block::Return;
+	cur->cond = res;
+
+	check();
+	if (failed.empty())
+		fn.resolve_all();
+}
+
+Instr* Builder::build(Node* node) {
+	if (auto num = dynamic_cast<Number*>(node); num != nullptr)
+		return emit(PUSH_NUMBER, {}, { *reinterpret_cast<OpCode*>(&num->value) });
+	if (auto boolean = dynamic_cast<Bool*>(node); boolean != nullptr)
+		return emit(boolean->value ? PUSH_TRUE : PUSH_FALSE);
+	if (dynamic_cast<Nil*>(node) != nullptr)
+		return nil();
+	if (auto sym = dynamic_cast<Symbol*>(node); sym != nullptr)
+		return sc_imm(PUSH_SYMBOL, sym->sc);
+	if (auto str = dynamic_cast<String*>(node); str != nullptr)
+		return sc_imm(PUSH_STRING, str->sc);
+
+	if (auto var = dynamic_cast<Variable*>(node); var != nullptr) {
+		if (promoted.count(var->sc) != 0)
+			if (auto val = read(var->sc, cur); val != &undeclared)
+				return val;
+		if (auto cell = ctx->global_cell(var->sc); cell != nullptr)
+			return emit(LOOKUP_GLOBAL, {}, { *reinterpret_cast<OpCode*>(&var->sc), *reinterpret_cast<OpCode*>(&cell) });
+		return sc_imm(LOOKUP, var->sc);
+	}
+
+	if (auto infix = dynamic_cast<InfixOperator*>(node); infix != nullptr)
+		return build_infix(infix);
+
+	if (auto prefx = dynamic_cast<PrefxOperator*>(node); prefx != nullptr) {
+		if (prefx->type == PrefxOperator::Not)
+			return emit(NOT, { build(prefx->operand) });
+
+		double zero = 0.0;
+		auto lhs = emit(PUSH_NUMBER, {}, { *reinterpret_cast<OpCode*>(&zero) });
+		auto rhs = build(prefx->operand);
+		return emit(unchecked(prefx->numeric, guarded) ? SUB_NUM : SUB, { lhs, rhs });
+	}
+
+	if (auto decl = dynamic_cast<VariableDecl*>(node); decl != nullptr) {
+		Instr* res = nullptr;
+		for (auto [var, val]: decl->decls) {
+			if (dynamic_cast<Lambda*>(val) != nullptr)
+				lambda_name = var->sc->data;
+			auto value = val != nullptr ? build(val) : nil();
+			if (value->kind == Instr::Op && value->op == PUSH_LAMBDA)
+				value->var = var->sc;
+
+			if (promoted.count(var->sc) == 0) {
+				res = sc_imm(DECL, var->sc, { value });
+				binds();
+				continue;
+			}
+
+			auto copy = fn.new_instr(cur, NOOP, { value });
+			copy->kind = Instr::Copy;
+			copy->var = var->sc;
+			write(var->sc, cur, copy);
+			if (!scopes.empty())
+				scopes.back().declared.push_back(var->sc);
+		}
+		return res != nullptr ? res : nil();
+	}
+
+	if (auto destruct = dynamic_cast<DestructList*>(node); destruct != nullptr) {
+		std::vector<Instr*> args;
+		for (auto rit = destruct->lhss.rbegin(); rit != destruct->lhss.rend(); ++rit) {
+			if (auto var = dynamic_cast<Variable*>(*rit); var != nullptr)
+				args.push_back(sc_imm(PUSH_STACK_PLACEHOLDER, var->sc));
+			else
+				args.push_back(build(*rit));
+		}
+		args.push_back(build(destruct->rhs));
+		binds();
+		return emit(DESTRUCT_ARRLIKE, args, { static_cast<OpCode>(destruct->lhss.size()) });
+	}
+
+	if (auto assign = dynamic_cast<AssignVariable*>(node); assign != nullptr) {
+		auto val = build(assign->val);
+		auto name = assign->var->sc;
+		if (promoted.count(name) == 0 || read(name, cur) == &undeclared)
+			return sc_imm(SET, name, { val });
+
+		auto copy = fn.new_instr(cur, NOOP, { val });
+		copy->kind = Instr::Copy;
+		copy->var = name;
+		write(name, cur, copy);
+		return val;
+	}
+
+	if (auto assign = dynamic_cast<AssignAccess*>(node); assign != nullptr) {
+		auto key = build(assign->acs->right);
+		auto val = build(assign->val);
+		auto map = build(assign->acs->left);
+		return emit(SET_MAP_VAL, { key, val, map });
+	}
+
+	if (auto acs = dynamic_cast<Access*>(node); acs != nullptr) {
+		auto key = build(acs->right);
+		auto map = build(acs->left);
+		return emit(GET_MAP_VAL, { key, map });
+	}
+
+	if (auto block = dynamic_cast<ast::Block*>(node); block != nullptr) {
+		Instr* res = nullptr;
+		for (auto expr: block->exprs)
+			res = build(expr);
+		return res != nullptr ? res : nil();
+	}
+
+	if (auto ifnode = dynamic_cast<If*>(node); ifnode != nullptr)
+		return build_if(ifnode);
+
+	if (auto loop = dynamic_cast<For*>(node); loop != nullptr)
+		return build_for(loop);
+
+	if (auto mc = map_template(ctx, node); mc != nullptr)
+		return emit(CLONE_MAP, {}, { static_cast<OpCode>(reinterpret_cast<uintptr_t>(mc)) });
+
+	if (auto list = dynamic_cast<List*>(node); list != nullptr) {
+		std::vector<Instr*> args;
+		for (auto val: list->values)
+			args.push_back(build(val));
+		return emit(MAKE_MAP_ARRLIKE, args, { static_cast<OpCode>(list->values.size()) });
+	}
+
+	if (auto map = dynamic_cast<Map*>(node); map != nullptr) {
+		std::vector<Instr*> args;
+		for (auto [key, val]: map->values) {
+			args.push_back(build(val));
+			args.push_back(build(key));
+		}
+		return emit(MAKE_MAP, args, { static_cast<OpCode>(map->values.size()) });
+	}
+
+	if (auto lambda = dynamic_cast<Lambda*>(node); lambda != nullptr) {
+		// compiled once this function is, see compile_function()
+		auto instr = emit(PUSH_LAMBDA, {}, { NOOP });
+		nested.push_back(Nested{ instr, lambda, lambda_name.empty() ? "<lambda>" : lambda_name });
+		lambda_name.clear();
+		return instr;
+	}
+
+	if (auto call = dynamic_cast<Call*>(node); call != nullptr) {
+		std::vector<Instr*> args;
+		for (auto rit = call->args.rbegin(); rit != call->args.rend(); ++rit)
+			args.push_back(build(*rit));
+
+		auto var = dynamic_cast<Variable*>(call->callable);
+		if (auto op = var != nullptr ? intrinsic(ctx, var->sc, call->args.size()) : NOOP; op != NOOP) {
+			auto cell = ctx->global_cell(var->sc);
+			return emit(op, args, { *reinterpret_cast<OpCode*>(&var->sc), *reinterpret_cast<OpCode*>(&cell), static_cast<OpCode>(reinterpret_cast<uintptr_t>(cell->_macro)) });
+		}
+		args.push_back(build(call->callable));
+		return emit(CALL, args, { static_cast<OpCode>(call->args.size()) });
+	}
+
+	throw std::runtime_error("ir: unexpected node");
+}
+
+Instr* Builder::build_infix(InfixOperator* node) {
+	if (node->type == InfixOperator::And || node->type == InfixOperator::Or) {
+		// a & b <-> if a { b } else { false }, a | b <-> if a { true } else { b }
+		auto lhs = build(node->lhs);
+		auto rhs_block = fn.new_block(), join = fn.new_block();
+		auto is_and = node->type == InfixOperator::And;
+		auto shortcut = emit(is_and ? PUSH_FALSE : PUSH_TRUE);
+		if (is_and)
+			branch(lhs, rhs_block, join);
+		else
+			branch(lhs, join, rhs_block);
+		seal(rhs_block);
+
+		cur = rhs_block;
+		auto rhs = build(node->rhs);
+		jump(join);
+		seal(join);
+		cur = join;
+		return phi(join, { shortcut, rhs });
+	}
+
+	auto lhs = build(node->lhs);
+	auto rhs = build(node->rhs);
+	auto num = unchecked(node->numeric, guarded);
+	OpCode op = NOOP;
+	switch (node->type) {
+	case InfixOperator::Add: op = num ? ADD_NUM : ADD; break;
+	case InfixOperator::Sub: op = num ? SUB_NUM : SUB; break;
+	case InfixOperator::Mul: op = num ? MUL_NUM : MUL; break;
+	case InfixOperator::Div: op = num ? DIV_NUM : DIV; break;
+	case InfixOperator::Equals: op = EQUALS; break;
+	case InfixOperator::EqualsNot: op = EQUALS_NOT; break;
+	case InfixOperator::Bigger: op = num ? BIGGER_NUM : BIGGER; break;
+	case InfixOperator::BiggerOrEqual: op = num ? BIGGER_OR_EQUAL_NUM : BIGGER_OR_EQUAL; break;
+	case InfixOperator::Smaller: op = num ? SMALLER_NUM : SMALLER; break;
+	case InfixOperator::SmallerOrEqual: op = num ? SMALLER_OR_EQUAL_NUM : SMALLER_OR_EQUAL; break;
+	default: break;
+	}
+	return emit(op, { lhs, rhs });
+}
+
+Instr* Builder::build_if(If* node) {
+	auto cond = build(node->cond);
+	auto then = fn.new_block(), otherwise = fn.new_block(), join = fn.new_block();
+	branch(cond, then, otherwise);
+	seal(then);
+	seal(otherwise);
+
+	cur = then;
+	enter_scope();
+	auto res_then = build(node->ifbody);
+	leave_scope();
+	jump(join);
+
+	cur = otherwise;
+	enter_scope();
+	auto res_else = node->elsebody ? build(node->elsebody) : nil();
+	leave_scope();
+	jump(join);
+
+	seal(join);
+	cur = join;
+	return phi(join, { res_then, res_else });
+}
+
+Instr* Builder::build_for(For* node) {
+	if (node->init)
+		build(node->init);
+
+	if (node->guards.empty()) {
+		build_loop(node);
+		return nil();
+	}
+
+	// the specialized copy runs if all guarded variables are numbers
+	auto generic = fn.new_block(), join = fn.new_block();
+	for (auto guard: node->guards) {
+		auto next = fn.new_block();
+		cur->term = Block::BranchNotNumber;
+		cur->guard = guard;
+		fn.add_edge(cur, next);
+		fn.add_edge(cur, generic);
+		seal(next);
+		cur = next;
+	}
+	seal(generic);
+
+	auto outer = guarded;
+	guarded = true;
+	build_loop(node);
+	jump(join);
+
+	cur = generic;
+	guarded = false;
+	build_loop(node);
+	jump(join);
+	guarded = outer;
+
+	seal(join);
+	cur = join;
+	return nil();
+}
+
+void Builder::build_loop(For* node) {
+	auto header = fn.new_block();
+	jump(header);
+	cur = header;
+
+	auto cond = build(node->cond);
+	auto body = fn.new_block(), exit = fn.new_block();
+	branch(cond, body, exit);
+	seal(body);
+
+	cur = body;
+	enter_scope();
+	build(node->body);
+	leave_scope();
+	if (node->inc)
+		build(node->inc);
+	jump(header);
+	seal(header);
+
+	seal(exit);
+	cur = exit;
+}
+
+static void compile_function(const Analysis &analysis, Node* body, Lambda* lambda, const std::string &name, std::vector<OpCode> &ops) {
+	auto ctx = analysis.ctx;
+	auto promoted = analysis.promotable(lambda);
+	std::vector<StringContainer*> params;
+	if (lambda != nullptr)
+		params = lambda->argnames;
+	if (lambda != nullptr && lambda->sealed)
+		ops.push_back(SEAL_ENV);
+
+	for (;;) {
+		Builder builder(analysis, name, promoted);
+		builder.build_function(body, params);
+		if (!builder.failed.empty()) {
+			for (auto var: builder.failed)
+				promoted.erase(var);
+			continue;
+		}
+
+		// the lambdas get their code once the function has been lowered
+		std::vector<std::pair<std::vector<OpCode>*, Nested>> nested;
+		for (auto &n: builder.nested) {
+			auto lambdaops = new std::vector<OpCode>();
+			auto lc = new (ctx->heap) LambdaContainer(nullptr, lambdaops, n.lambda->argnames, ctx, false);
+			ctx->lambdas.push_back(lc);
+			n.instr->imms[0] = *reinterpret_cast<OpCode*>(&lc);
+			nested.push_back(std::make_pair(lambdaops, n));
+		}
+
+		Stats stats;
+		optimize(builder.fn, stats);
+		if (ctx->optimizer.dump_ir) {
+			builder.fn.dump(std::cerr);
+			std::cerr << "\t; removed: " << stats.copies << " copies, " << stats.cse << " common subexpressions, "
+				<< stats.dce << " dead instructions, " << stats.branches << " constant branches, "
+				<< stats.threaded << " jumps (threaded), " << stats.blocks << " blocks\n";
+		}
+		lower(builder.fn, ops);
+
+		for (auto &[lambdaops, n]: nested)
+			compile_function(analysis, n.lambda->body, n.lambda, name + "." + n.name, *lambdaops);
+		return;
+	}
+}
+
+void ir::compile(Context* ctx, Node* node, const opt::Unit &unit, std::vector<OpCode> &ops) {
+	Analysis analysis{ ctx, unit, opt::collect_bindings(node).dynamic, {} };
+	analysis.candidates.visit(node);
+	compile_function(analysis, node, nullptr, "<unit>", ops);
+}
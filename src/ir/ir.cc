@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <unordered_set>
+#include "ir.hh"
+
+using namespace asbi;
+using namespace asbi::ir;
+
+bool Instr::pushes() const {
+	return kind != Op || (op != ENTER_SCOPE && op != LEAVE_SCOPE);
+}
+
+bool Instr::pure() const {
+	if (kind != Op || removable)
+		return true;
+
+	switch (op) {
+	case PUSH_NUMBER: case PUSH_BOOLEAN: case PUSH_TRUE: case PUSH_FALSE:
+	case PUSH_NIL: case PUSH_SYMBOL: case PUSH_STRING: case PUSH_LAMBDA:
+	case PUSH_STACK_PLACEHOLDER:
+	case ADD_NUM: case SUB_NUM: case MUL_NUM: case DIV_NUM:
+	case SMALLER_NUM: case BIGGER_NUM: case SMALLER_OR_EQUAL_NUM: case BIGGER_OR_EQUAL_NUM:
+	case EQUALS: case EQUALS_NOT:
+	case MAKE_MAP: case MAKE_MAP_ARRLIKE: case CLONE_MAP:
+	case LOOKUP_GLOBAL: // bound, it cannot throw
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool Instr::rematerializable() const {
+	if (kind != Op)
+		return false;
+
+	switch (op) {
+	case PUSH_NUMBER: case PUSH_BOOLEAN: case PUSH_TRUE: case PUSH_FALSE:
+	case PUSH_NIL: case PUSH_SYMBOL: case PUSH_STRING: case PUSH_STACK_PLACEHOLDER:
+		return true;
+	default:
+		return false;
+	}
+}
+
+Block* Function::new_block() {
+	blocks.push_back(std::make_unique<Block>());
+	auto block = blocks.back().get();
+	block->id = blocks.size() - 1;
+	return block;
+}
+
+Instr* Function::new_instr(Block* block, OpCode op, std::vector<Instr*> args, std::vector<OpCode> imms) {
+	instrs.push_back(std::make_unique<Instr>());
+	auto instr = instrs.back().get();
+	instr->kind = Instr::Op;
+	instr->op = op;
+	instr->args = args;
+	instr->imms = imms;
+	instr->block = block;
+	instr->id = instrs.size();
+	if (block != nullptr)
+		block->instrs.push_back(instr);
+	return instr;
+}
+
+Instr* Function::new_phi(Block* block, StringContainer* var) {
+	auto phi = new_instr(nullptr, NOOP);
+	phi->kind = Instr::Phi;
+	phi->var = var;
+	phi->block = block;
+	auto pos = std::find_if(block->instrs.begin(), block->instrs.end(), [](auto instr) { return instr->kind != Instr::Phi; });
+	block->instrs.insert(pos, phi);
+	return phi;
+}
+
+void Function::add_edge(Block* from, Block* to) {
+	from->succs.push_back(to);
+	to->preds.push_back(from);
+}
+
+// the phis of `to` need an argument for `from` afterwards
+void Function::replace_edge(Block* from, Block* old, Block* to) {
+	*std::find(from->succs.begin(), from->succs.end(), old) = to;
+
+	auto idx = std::find(old->preds.begin(), old->preds.end(), from) - old->preds.begin();
+	old->preds.erase(old->preds.begin() + idx);
+	for (auto instr: old->instrs)
+		if (instr->kind == Instr::Phi)
+			instr->args.erase(instr->args.begin() + idx);
+
+	to->preds.push_back(from);
+}
+
+std::vector<Block*> Function::order() {
+	std::vector<Block*> postorder;
+	std::unordered_set<Block*> visited;
+	std::vector<std::pair<Block*, std::size_t>> stack;
+
+	visited.insert(entry);
+	stack.push_back(std::make_pair(entry, 0));
+	while (!stack.empty()) {
+		auto &[block, next] = stack.back();
+		if (next < block->succs.size()) {
+			// last successor first: the first one comes right after the block
+			auto succ = block->succs[block->succs.size() - ++next];
+			if (visited.insert(succ).second)
+				stack.push_back(std::make_pair(succ, 0));
+			continue;
+		}
+		postorder.push_back(block);
+		stack.pop_back();
+	}
+
+	std::reverse(postorder.begin(), postorder.end());
+	for (std::size_t i = 0; i < postorder.size(); i++)
+		postorder[i]->rpo = i;
+	return postorder;
+}
+
+void Function::remove_unreachable() {
+	auto reachable = order();
+	std::unordered_set<Block*> live(reachable.begin(), reachable.end());
+
+	for (auto block: reachable) {
+		for (std::size_t i = block->preds.size(); i-- > 0;) {
+			if (live.count(block->preds[i]) != 0)
+				continue;
+
+			block->preds.erase(block->preds.begin() + i);
+			for (auto instr: block->instrs)
+				if (instr->kind == Instr::Phi)
+					instr->args.erase(instr->args.begin() + i);
+		}
+	}
+
+	for (auto &block: blocks)
+		if (live.count(block.get()) == 0)
+			for (auto instr: block->instrs)
+				instr->block = nullptr;
+
+	blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&](auto &block) {
+		return live.count(block.get()) == 0;
+	}), blocks.end());
+}
+
+// copies for phis have a place to go on every edge into a block with phis
+void Function::split_critical_edges() {
+	auto n = blocks.size();
+	for (std::size_t b = 0; b < n; b++) {
+		auto block = blocks[b].get();
+		if (block->succs.size() < 2)
+			continue;
+
+		for (auto &succ: block->succs) {
+			if (succ->preds.size() < 2 || succ->instrs.empty() || succ->instrs[0]->kind != Instr::Phi)
+				continue;
+
+			auto edge = new_block();
+			*std::find(succ->preds.begin(), succ->preds.end(), block) = edge;
+			edge->preds.push_back(block);
+			edge->succs.push_back(succ);
+			succ = edge;
+		}
+	}
+}
+
+// Cooper, Harvey, Kennedy: "A Simple, Fast Dominance Algorithm"
+void Function::compute_dominators() {
+	auto rpo = order();
+	for (auto block: rpo)
+		block->idom = nullptr;
+	entry->idom = entry;
+
+	auto intersect = [](Block* a, Block* b) {
+		while (a != b) {
+			while (a->rpo > b->rpo) a = a->idom;
+			while (b->rpo > a->rpo) b = b->idom;
+		}
+		return a;
+	};
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto block: rpo) {
+			if (block == entry)
+				continue;
+
+			Block* idom = nullptr;
+			for (auto pred: block->preds)
+				if (pred->idom != nullptr)
+					idom = idom == nullptr ? pred : intersect(pred, idom);
+
+			if (block->idom != idom) {
+				block->idom = idom;
+				changed = true;
+			}
+		}
+	}
+}
+
+bool Function::dominates(Block* a, Block* b) const {
+	for (;;) {
+		if (a == b)
+			return true;
+		if (b == entry)
+			return false;
+		b = b->idom;
+	}
+}
+
+Instr* Function::resolve(Instr* instr) {
+	while (instr != nullptr && instr->forward != nullptr)
+		instr = instr->forward;
+	return instr;
+}
+
+void Function::resolve_all() {
+	for (auto &block: blocks) {
+		auto &instrs = block->instrs;
+		instrs.erase(std::remove_if(instrs.begin(), instrs.end(), [](auto instr) { return instr->dead(); }), instrs.end());
+		for (auto instr: instrs)
+			for (auto &arg: instr->args)
+				arg = resolve(arg);
+		block->cond = resolve(block->cond);
+	}
+}
+
+static void dump_imm(std::ostream &os, const Instr* instr, OpCode imm) {
+	switch (instr->op) {
+	case PUSH_NUMBER:
+		os << *reinterpret_cast<const double*>(&imm);
+		return;
+	case PUSH_SYMBOL:
+		os << ':' << reinterpret_cast<StringContainer*>(imm)->data;
+		return;
+	case PUSH_STRING:
+		os << '"' << reinterpret_cast<StringContainer*>(imm)->data << '"';
+		return;
+	case PUSH_LAMBDA:
+		os << (instr->var != nullptr ? instr->var->data : "<lambda>");
+		return;
+	case LOOKUP_GLOBAL: case LEN: case TYPEOF: case MOD: case TO_INT:
+		if (imm == instr->imms[0])
+			os << reinterpret_cast<StringContainer*>(imm)->data;
+		else
+			os << (imm == instr->imms[1] ? "<cell>" : "<builtin>");
+		return;
+	case CLONE_MAP:
+		os << Value::map(reinterpret_cast<MapContainer*>(imm)).to_string(true);
+		return;
+	case PUSH_STACK_PLACEHOLDER: case LOOKUP: case DECL: case SET:
+		os << reinterpret_cast<StringContainer*>(imm)->data;
+		return;
+	default:
+		os << static_cast<uint64_t>(imm);
+		return;
+	}
+}
+
+void Function::dump(std::ostream &os) {
+	auto rpo = order();
+	unsigned int n = 0;
+	for (auto block: rpo)
+		for (auto instr: block->instrs)
+			instr->id = ++n;
+
+	os << "==asbi==: ir " << name << " (" << rpo.size() << " blocks, " << n << " instructions)\n";
+	for (auto block: rpo) {
+		os << "b" << block->rpo << ":";
+		if (!block->preds.empty()) {
+			os << "\t; preds";
+			for (auto pred: block->preds)
+				os << " b" << pred->rpo;
+			if (block->idom != nullptr && block->idom != block)
+				os << ", idom b" << block->idom->rpo;
+		}
+		os << "\n";
+
+		for (auto instr: block->instrs) {
+			os << "\t";
+			if (instr->pushes())
+				os << "%" << instr->id << " = ";
+
+			switch (instr->kind) {
+			case Instr::Phi:
+				os << "phi";
+				if (instr->var != nullptr)
+					os << " " << instr->var->data;
+				for (std::size_t i = 0; i < instr->args.size(); i++)
+					os << " [%" << instr->args[i]->id << ", b" << block->preds[i]->rpo << "]";
+				break;
+			case Instr::Copy:
+				os << "copy " << instr->var->data << " %" << instr->args[0]->id;
+				break;
+			case Instr::Undeclared:
+				os << "undeclared";
+				break;
+			case Instr::Op:
+				os << opcode_name(instr->op);
+				for (auto imm: instr->imms) {
+					os << " ";
+					dump_imm(os, instr, imm);
+				}
+				for (auto arg: instr->args)
+					os << " %" << arg->id;
+				break;
+			}
+			os << "\n";
+		}
+
+		switch (block->term) {
+		case Block::Goto:
+			os << "\tgoto b" << block->succs[0]->rpo << "\n";
+			break;
+		case Block::Branch:
+			os << "\tbranch %" << block->cond->id << " b" << block->succs[0]->rpo << " b" << block->succs[1]->rpo << "\n";
+			break;
+		case Block::BranchNotNumber:
+			os << "\tif number " << block->guard->data << " b" << block->succs[0]->rpo << " else b" << block->succs[1]->rpo << "\n";
+			break;
+		case Block::Return:
+			os << "\treturn %" << block->cond->id << "\n";
+			break;
+		}
+	}
+}
+
+const char* ir::opcode_name(OpCode op) {
+	switch (op) {
+	case PUSH_NUMBER: return "PUSH_NUMBER";
+	case PUSH_BOOLEAN: return "PUSH_BOOLEAN";
+	case PUSH_TRUE: return "PUSH_TRUE";
+	case PUSH_FALSE: return "PUSH_FALSE";
+	case PUSH_NIL: return "PUSH_NIL";
+	case PUSH_SYMBOL: return "PUSH_SYMBOL";
+	case PUSH_STRING: return "PUSH_STRING";
+	case PUSH_LAMBDA: return "PUSH_LAMBDA";
+	case PUSH_STACK_PLACEHOLDER: return "PUSH_STACK_PLACEHOLDER";
+	case POP: return "POP";
+	case ENTER_SCOPE: return "ENTER_SCOPE";
+	case LEAVE_SCOPE: return "LEAVE_SCOPE";
+	case SEAL_ENV: return "SEAL_ENV";
+	case CALL: return "CALL";
+	case LOOKUP: return "LOOKUP";
+	case LOOKUP_GLOBAL: return "LOOKUP_GLOBAL";
+	case DECL: return "DECL";
+	case SET: return "SET";
+	case DECL_POP: return "DECL_POP";
+	case SET_POP: return "SET_POP";
+	case ADD: return "ADD";
+	case SUB: return "SUB";
+	case MUL: return "MUL";
+	case DIV: return "DIV";
+	case EQUALS: return "EQUALS";
+	case EQUALS_NOT: return "EQUALS_NOT";
+	case SMALLER: return "SMALLER";
+	case BIGGER: return "BIGGER";
+	case SMALLER_OR_EQUAL: return "SMALLER_OR_EQUAL";
+	case BIGGER_OR_EQUAL: return "BIGGER_OR_EQUAL";
+	case ADD_NUM: return "ADD_NUM";
+	case SUB_NUM: return "SUB_NUM";
+	case MUL_NUM: return "MUL_NUM";
+	case DIV_NUM: return "DIV_NUM";
+	case SMALLER_NUM: return "SMALLER_NUM";
+	case BIGGER_NUM: return "BIGGER_NUM";
+	case SMALLER_OR_EQUAL_NUM: return "SMALLER_OR_EQUAL_NUM";
+	case BIGGER_OR_EQUAL_NUM: return "BIGGER_OR_EQUAL_NUM";
+	case NEG: return "NEG";
+	case LEN: return "LEN";
+	case TYPEOF: return "TYPEOF";
+	case MOD: return "MOD";
+	case TO_INT: return "TO_INT";
+	case NEG_NUM: return "NEG_NUM";
+	case NOT: return "NOT";
+	case MAKE_MAP: return "MAKE_MAP";
+	case MAKE_MAP_ARRLIKE: return "MAKE_MAP_ARRLIKE";
+	case CLONE_MAP: return "CLONE_MAP";
+	case GET_MAP_VAL: return "GET_MAP_VAL";
+	case SET_MAP_VAL: return "SET_MAP_VAL";
+	case DESTRUCT_ARRLIKE: return "DESTRUCT_ARRLIKE";
+	case GOTO: return "GOTO";
+	case IF_TRUE_GOTO: return "IF_TRUE_GOTO";
+	case IF_FALSE_GOTO: return "IF_FALSE_GOTO";
+	case IF_NOT_NUMBER_GOTO: return "IF_NOT_NUMBER_GOTO";
+	case LOAD_SLOT: return "LOAD_SLOT";
+	case STORE_SLOT: return "STORE_SLOT";
+	case RESERVE: return "RESERVE";
+	case FREE: return "FREE";
+	case NOOP: return "NOOP";
+	}
+	return "?";
+}
@@ -0,0 +1,118 @@
+#ifndef IR_HH
+#define IR_HH
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <ostream>
+#include "../include/vm.hh"
+#include "../opt/passes.hh"
+
+namespace ast { class Node; } // forward decl.
+
+/*
+ * Middle-end between the AST and the bytecode: every function (a unit or a
+ * lambda body) becomes a control flow graph of basic blocks in SSA form.
+ *
+ * An instruction is one VM opcode with its immediates, its operands are the
+ * values the opcode expects on the stack (bottom to top). Local variables
+ * that are bound once, only used by their own function and never seen by
+ * `eval` and the like are not kept in the env at all but are SSA values
+ * (with phis where control flow merges), all other variables are still
+ * looked up in and stored to the env.
+ *
+ * The lowering back to bytecode keeps values on the stack where they are
+ * used in order and puts the others (phis, values used more than once or in
+ * other blocks) into slots of the frame, at the bottom of the function's
+ * part of the stack.
+ */
+namespace asbi::ir {
+
+	struct Block;
+
+	struct Instr {
+		enum Kind {
+			Op,         // `op` with `imms`
+			Phi,        // one argument per predecessor of the block
+			Copy,       // assignment of a promoted variable
+			Undeclared, // placeholder: a promoted variable not declared (yet)
+		} kind = Op;
+		OpCode op = NOOP;
+		std::vector<OpCode> imms;
+		std::vector<Instr*> args;
+		Block* block = nullptr;
+		unsigned int id = 0;
+		StringContainer* var = nullptr; // variable of a phi or copy, for dumps
+		Instr* forward = nullptr;       // replaced by
+		bool removable = false;         // no effect even if `op` usually has one
+
+		bool pushes() const;         // does it leave a value on the stack?
+		bool pure() const;           // no effects, cannot fail
+		bool rematerializable() const; // as cheap to repeat as to keep
+		bool dead() const { return forward != nullptr; }
+	};
+
+	struct Block {
+		enum Term { Goto, Branch, BranchNotNumber, Return } term = Goto;
+
+		unsigned int id = 0;
+		std::vector<Instr*> instrs; // phis first
+		Instr* cond = nullptr;            // Branch: condition, Return: result
+		StringContainer* guard = nullptr; // BranchNotNumber: variable checked
+		std::vector<Block*> succs; // Branch: true, false, BranchNotNumber: number, not
+		std::vector<Block*> preds; // in the order of the phi arguments
+
+		Block* idom = nullptr;
+		unsigned int rpo = 0;
+	};
+
+	class Function {
+	public:
+		explicit Function(std::string name): name(name) {}
+
+		std::string name;
+		Block* entry = nullptr;
+		std::vector<std::unique_ptr<Block>> blocks;
+		std::vector<std::unique_ptr<Instr>> instrs;
+
+		Block* new_block();
+		Instr* new_instr(Block*, OpCode, std::vector<Instr*> args = {}, std::vector<OpCode> imms = {});
+		Instr* new_phi(Block*, StringContainer* var = nullptr);
+
+		void add_edge(Block* from, Block* to);
+		void replace_edge(Block* from, Block* old, Block* to);
+
+		// blocks reachable from the entry in reverse postorder, sets rpo
+		std::vector<Block*> order();
+		void remove_unreachable();
+		void split_critical_edges();
+		void compute_dominators();
+		bool dominates(Block*, Block*) const;
+
+		// follows Instr::forward, rewrites all operands to live values
+		static Instr* resolve(Instr*);
+		void resolve_all();
+
+		void dump(std::ostream&);
+	};
+
+	// what the optimizations did to a function (shown by --dump-ir)
+	struct Stats {
+		unsigned int copies = 0, cse = 0, dce = 0, branches = 0, threaded = 0, blocks = 0;
+	};
+
+	// optimize.cc
+	void optimize(Function&, Stats&);
+
+	// lower.cc
+	void lower(Function&, std::vector<OpCode>&);
+
+	// build.cc: the unit through the IR instead of ast::Node::to_vmops()
+	void compile(Context*, ast::Node*, const opt::Unit&, std::vector<OpCode>&);
+
+	// ir.cc
+	const char* opcode_name(OpCode);
+
+}
+
+#endif
@@ -0,0 +1,468 @@
+#include <cassert>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "ir.hh"
+
+using namespace asbi;
+using namespace asbi::ir;
+
+/*
+ * IR to bytecode. Every value is either
+ *  - stacked: pushed where it is defined and consumed from the top of the
+ *    stack by its only use, later in the same block,
+ *  - a constant repeated at each use, or
+ *  - kept in a slot of the frame (phis, values used more than once or in
+ *    other blocks), stored after its definition and loaded at each use.
+ * Values starting as stacked but not on top of the stack in the right order
+ * when used go to a slot instead, until all blocks work out.
+ */
+
+namespace {
+
+	class Lowering {
+	public:
+		Lowering(Function &fn, std::vector<OpCode> &ops): fn(fn), ops(ops) {}
+
+		void run();
+	private:
+		Function &fn;
+		std::vector<OpCode> &ops;
+		std::vector<Block*> layout;
+		std::unordered_map<Instr*, unsigned int> uses;
+		std::unordered_set<Instr*> stacked;
+		std::unordered_map<Instr*, unsigned int> slots;
+		unsigned int nslots = 0;
+		std::unordered_map<Block*, std::size_t> starts;
+		std::vector<std::pair<std::size_t, Block*>> fixups;
+
+		void count_uses();
+		void commute();
+		Block* target(Block*);
+		std::vector<Instr*> phi_args(Block*);
+		bool place(std::vector<Instr*> &pending, const std::vector<Instr*> &args);
+		bool simulate(Block*);
+		void assign_slots();
+
+		void fetch(Instr*);
+		void fetch_args(const std::vector<Instr*> &args);
+		void jump(OpCode op, Block* to);
+		void emit(Block*, Block* next);
+	};
+
+}
+
+// a value defined in the block, used once, by an instruction of the same
+// block, its terminator or the phi copies at its end
+void Lowering::count_uses() {
+	std::unordered_map<Instr*, Block*> used_in;
+	auto use = [&](Instr* instr, Block* block) {
+		uses[instr]++;
+		used_in[instr] = block;
+	};
+
+	for (auto block: layout) {
+		for (auto instr: block->instrs) {
+			if (instr->kind == Instr::Phi) {
+				for (std::size_t i = 0; i < instr->args.size(); i++)
+					use(instr->args[i], block->preds[i]);
+				continue;
+			}
+			for (auto arg: instr->args)
+				use(arg, block);
+		}
+		if (block->cond != nullptr)
+			use(block->cond, block);
+	}
+
+	for (auto block: layout) {
+		for (auto instr: block->instrs)
+			if (instr->kind == Instr::Op && uses[instr] == 1 && used_in[instr] == block)
+				stacked.insert(instr);
+
+		// one phi per block can be passed on the stack, its predecessors
+		// push their value last (the result of an `if` for example)
+		auto &instrs = block->instrs;
+		auto phi = std::find_if(instrs.begin(), instrs.end(), [&](auto instr) {
+			return instr->kind != Instr::Phi || (uses[instr] == 1 && used_in[instr] == block);
+		});
+		if (phi != instrs.end() && (*phi)->kind == Instr::Phi) {
+			stacked.insert(*phi);
+			std::rotate(instrs.begin(), phi, phi + 1);
+		}
+	}
+}
+
+// `a < b` as `b > a`: the operand on top of the stack can stay there if it
+// is the second one
+static bool commuted(OpCode op, OpCode &res) {
+	switch (op) {
+	case ADD_NUM: case MUL_NUM: case MUL: case EQUALS: case EQUALS_NOT: res = op; return true;
+	case SMALLER: res = BIGGER; return true;
+	case BIGGER: res = SMALLER; return true;
+	case SMALLER_OR_EQUAL: res = BIGGER_OR_EQUAL; return true;
+	case BIGGER_OR_EQUAL: res = SMALLER_OR_EQUAL; return true;
+	case SMALLER_NUM: res = BIGGER_NUM; return true;
+	case BIGGER_NUM: res = SMALLER_NUM; return true;
+	case SMALLER_OR_EQUAL_NUM: res = BIGGER_OR_EQUAL_NUM; return true;
+	case BIGGER_OR_EQUAL_NUM: res = SMALLER_OR_EQUAL_NUM; return true;
+	default: return false;
+	}
+}
+
+void Lowering::commute() {
+	for (auto block: layout) {
+		for (auto instr: block->instrs) {
+			OpCode op;
+			if (instr->kind != Instr::Op || instr->args.size() != 2 || !commuted(instr->op, op))
+				continue;
+			if (stacked.count(instr->args[0]) != 0 || stacked.count(instr->args[1]) == 0)
+				continue;
+
+			std::swap(instr->args[0], instr->args[1]);
+			instr->op = op;
+		}
+	}
+}
+
+// blocks only jumping on are left out, jumps go to where they lead
+Block* Lowering::target(Block* block) {
+	auto start = block;
+	while (block != fn.entry && block->instrs.empty() && block->term == Block::Goto && phi_args(block).empty()) {
+		block = block->succs[0];
+		if (block == start)
+			break;
+	}
+	return block;
+}
+
+// what the phis of the successor get from a block ending in a goto
+std::vector<Instr*> Lowering::phi_args(Block* block) {
+	std::vector<Instr*> args;
+	if (block->term != Block::Goto)
+		return args;
+
+	auto succ = block->succs[0];
+	auto idx = std::find(succ->preds.begin(), succ->preds.end(), block) - succ->preds.begin();
+	for (auto instr: succ->instrs)
+		if (instr->kind == Instr::Phi)
+			args.push_back(instr->args[idx]);
+	return args;
+}
+
+// can the stacked operands be taken from the top of the stack? if not, they
+// (and what is above them) are not stacked anymore
+bool Lowering::place(std::vector<Instr*> &pending, const std::vector<Instr*> &args) {
+	std::size_t n = 0;
+	while (n < args.size() && stacked.count(args[n]) != 0)
+		n++;
+
+	bool ok = n <= pending.size() && std::equal(args.begin(), args.begin() + n, pending.end() - n);
+	for (std::size_t i = n; ok && i < args.size(); i++)
+		ok = stacked.count(args[i]) == 0;
+	if (ok) {
+		pending.resize(pending.size() - n);
+		return true;
+	}
+
+	auto lowest = pending.size();
+	for (auto arg: args) {
+		if (stacked.erase(arg) == 0)
+			continue;
+		if (auto pos = std::find(pending.begin(), pending.end(), arg); pos != pending.end())
+			lowest = std::min(lowest, static_cast<std::size_t>(pos - pending.begin()));
+	}
+	for (auto i = lowest; i < pending.size(); i++)
+		stacked.erase(pending[i]);
+	return false;
+}
+
+bool Lowering::simulate(Block* block) {
+	std::vector<Instr*> pending;
+	if (!block->instrs.empty() && stacked.count(block->instrs[0]) != 0)
+		pending.push_back(block->instrs[0]);
+	for (auto instr: block->instrs) {
+		if (instr->kind == Instr::Phi)
+			continue;
+		if (!place(pending, instr->args))
+			return false;
+		if (stacked.count(instr) != 0)
+			pending.push_back(instr);
+	}
+
+	switch (block->term) {
+	case Block::Goto:
+		return place(pending, phi_args(block));
+	case Block::Branch: case Block::Return:
+		return place(pending, { block->cond });
+	case Block::BranchNotNumber:
+		return true;
+	}
+	return true;
+}
+
+// Values live at the same time get different slots, except for a phi and
+// its argument holding the same value. A phi shares its slot with its
+// arguments where possible, the copy for them is left out then.
+void Lowering::assign_slots() {
+	std::vector<Instr*> values;
+	std::unordered_set<Instr*> slotted;
+	for (auto block: layout) {
+		for (auto instr: block->instrs) {
+			if (instr->kind == Instr::Op && (!instr->pushes() || uses[instr] == 0))
+				continue;
+			if (stacked.count(instr) != 0 || instr->rematerializable())
+				continue;
+			values.push_back(instr);
+			slotted.insert(instr);
+		}
+	}
+
+	// liveness, phis are written by the copies at the end of their predecessors
+	std::unordered_map<Block*, std::unordered_set<Instr*>> live_in;
+	std::unordered_map<Instr*, std::unordered_set<Instr*>> interferes;
+	auto scan = [&](Block* block, bool record) {
+		std::unordered_set<Instr*> live;
+		for (auto succ: block->succs)
+			for (auto val: live_in[succ])
+				live.insert(val);
+		auto add = [&](Instr* val) {
+			if (slotted.count(val) != 0)
+				live.insert(val);
+		};
+		auto def = [&](Instr* val, Instr* same) {
+			for (auto other: live) {
+				if (record && other != val && other != same) {
+					interferes[val].insert(other);
+					interferes[other].insert(val);
+				}
+			}
+		};
+
+		if (block->term == Block::Goto) {
+			auto args = phi_args(block);
+			auto succ = block->succs[0];
+			for (std::size_t i = 0; i < args.size(); i++) {
+				def(succ->instrs[i], args[i]);
+				for (std::size_t j = 0; record && j < i; j++) {
+					interferes[succ->instrs[i]].insert(succ->instrs[j]);
+					interferes[succ->instrs[j]].insert(succ->instrs[i]);
+				}
+			}
+			for (std::size_t i = 0; i < args.size(); i++)
+				live.erase(succ->instrs[i]);
+			for (auto arg: args)
+				add(arg);
+		} else if (block->cond != nullptr) {
+			add(block->cond);
+		}
+
+		for (auto rit = block->instrs.rbegin(); rit != block->instrs.rend(); ++rit) {
+			if ((*rit)->kind == Instr::Phi)
+				break;
+			if (slotted.count(*rit) != 0) {
+				def(*rit, nullptr);
+				live.erase(*rit);
+			}
+			for (auto arg: (*rit)->args)
+				add(arg);
+		}
+		return live;
+	};
+
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto rit = layout.rbegin(); rit != layout.rend(); ++rit) {
+			auto live = scan(*rit, false);
+			if (live != live_in[*rit]) {
+				live_in[*rit] = live;
+				changed = true;
+			}
+		}
+	}
+	for (auto block: layout)
+		scan(block, true);
+
+	// classes of values sharing a slot
+	std::unordered_map<Instr*, Instr*> leader;
+	std::unordered_map<Instr*, std::vector<Instr*>> members;
+	for (auto val: values) {
+		leader[val] = val;
+		members[val].push_back(val);
+	}
+	auto conflict = [&](Instr* a, Instr* b) {
+		for (auto x: members[a])
+			for (auto y: members[b])
+				if (interferes[x].count(y) != 0)
+					return true;
+		return false;
+	};
+	for (auto block: layout) {
+		for (auto phi: block->instrs) {
+			if (phi->kind != Instr::Phi)
+				break;
+			for (auto arg: phi->args) {
+				if (slotted.count(phi) == 0 || slotted.count(arg) == 0)
+					continue;
+				auto a = leader[phi], b = leader[arg];
+				if (a == b || conflict(a, b))
+					continue;
+				for (auto val: members[b]) {
+					leader[val] = a;
+					members[a].push_back(val);
+				}
+				members.erase(b);
+			}
+		}
+	}
+
+	std::unordered_map<Instr*, unsigned int> class_slots;
+	for (auto val: values) {
+		auto cls = leader[val];
+		if (class_slots.count(cls) == 0) {
+			std::unordered_set<unsigned int> taken;
+			for (auto [other, slot]: class_slots)
+				if (conflict(cls, other))
+					taken.insert(slot);
+			unsigned int slot = 0;
+			while (taken.count(slot) != 0)
+				slot++;
+			class_slots[cls] = slot;
+			nslots = std::max(nslots, slot + 1);
+		}
+		slots[val] = class_slots[cls];
+	}
+}
+
+void Lowering::fetch(Instr* instr) {
+	if (stacked.count(instr) != 0)
+		return;
+
+	if (auto slot = slots.find(instr); slot != slots.end()) {
+		ops.push_back(LOAD_SLOT);
+		ops.push_back(static_cast<OpCode>(slot->second));
+		return;
+	}
+
+	assert(instr->rematerializable());
+	ops.push_back(instr->op);
+	ops.insert(ops.end(), instr->imms.begin(), instr->imms.end());
+}
+
+void Lowering::fetch_args(const std::vector<Instr*> &args) {
+	for (auto arg: args)
+		fetch(arg);
+}
+
+void Lowering::jump(OpCode op, Block* to) {
+	ops.push_back(op);
+	fixups.push_back(std::make_pair(ops.size(), target(to)));
+	ops.push_back(NOOP);
+}
+
+void Lowering::emit(Block* block, Block* next) {
+	starts[block] = ops.size();
+	for (auto instr: block->instrs) {
+		if (instr->kind == Instr::Phi)
+			continue;
+		if (instr->rematerializable() && stacked.count(instr) == 0)
+			continue;
+
+		fetch_args(instr->args);
+		ops.push_back(instr->op);
+		ops.insert(ops.end(), instr->imms.begin(), instr->imms.end());
+		if (!instr->pushes() || stacked.count(instr) != 0)
+			continue;
+
+		if (uses[instr] == 0) {
+			ops.push_back(POP);
+		} else {
+			ops.push_back(STORE_SLOT);
+			ops.push_back(static_cast<OpCode>(slots.at(instr)));
+		}
+	}
+
+	switch (block->term) {
+	case Block::Goto:{
+		// a parallel copy: all values are pushed before the first store,
+		// values already in the slot of their phi stay there
+		auto succ = block->succs[0];
+		std::vector<Instr*> phis;
+		for (auto arg: phi_args(block)) {
+			auto phi = succ->instrs[phis.size()];
+			phis.push_back(phi);
+			if (auto slot = slots.find(arg); slot != slots.end() && slots.count(phi) != 0 && slot->second == slots.at(phi))
+				phis.back() = nullptr;
+			else
+				fetch(arg);
+		}
+		for (auto rit = phis.rbegin(); rit != phis.rend(); ++rit) {
+			if (*rit == nullptr || stacked.count(*rit) != 0)
+				continue;
+			ops.push_back(STORE_SLOT);
+			ops.push_back(static_cast<OpCode>(slots.at(*rit)));
+		}
+		if (target(succ) != next)
+			jump(GOTO, succ);
+		break;
+	}
+	case Block::Branch:
+		fetch(block->cond);
+		if (target(block->succs[0]) == next) {
+			jump(IF_FALSE_GOTO, block->succs[1]);
+		} else {
+			jump(IF_TRUE_GOTO, block->succs[0]);
+			if (target(block->succs[1]) != next)
+				jump(GOTO, block->succs[1]);
+		}
+		break;
+	case Block::BranchNotNumber:
+		ops.push_back(IF_NOT_NUMBER_GOTO);
+		ops.push_back(*reinterpret_cast<OpCode*>(&block->guard));
+		fixups.push_back(std::make_pair(ops.size(), target(block->succs[1])));
+		ops.push_back(NOOP);
+		if (target(block->succs[0]) != next)
+			jump(GOTO, block->succs[0]);
+		break;
+	case Block::Return:
+		fetch(block->cond);
+		if (nslots > 0) {
+			ops.push_back(FREE);
+			ops.push_back(static_cast<OpCode>(nslots));
+		}
+		break;
+	}
+}
+
+void Lowering::run() {
+	fn.split_critical_edges();
+	layout = fn.order();
+	auto ret = std::find_if(layout.begin(), layout.end(), [](auto block) { return block->term == Block::Return; });
+	if (ret != layout.end())
+		std::rotate(ret, ret + 1, layout.end());
+	layout.erase(std::remove_if(layout.begin(), layout.end(), [&](auto block) { return target(block) != block; }), layout.end());
+
+	count_uses();
+	commute();
+	for (bool done = false; !done;) {
+		done = true;
+		for (auto block: layout)
+			if (!simulate(block))
+				done = false;
+	}
+
+	assign_slots();
+	if (nslots > 0) {
+		ops.push_back(RESERVE);
+		ops.push_back(static_cast<OpCode>(nslots));
+	}
+	for (std::size_t i = 0; i < layout.size(); i++)
+		emit(layout[i], i + 1 < layout.size() ? layout[i + 1] : nullptr);
+
+	for (auto [pos, block]: fixups)
+		ops[pos] = static_cast<OpCode>(starts.at(block));
+}
+
+void ir::lower(Function &fn, std::vector<OpCode> &ops) {
+	Lowering(fn, ops).run();
+}
@@ -0,0 +1,293 @@
+#include <map>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "ir.hh"
+
+using namespace asbi;
+using namespace asbi::ir;
+
+namespace {
+
+	bool is_const(Instr* instr, OpCode op) {
+		return instr->kind == Instr::Op && instr->op == op;
+	}
+
+	// drops the edge from `from` to `to` (and the phi arguments for it)
+	void remove_edge(Block* from, Block* to) {
+		from->succs.erase(std::find(from->succs.begin(), from->succs.end(), to));
+		auto idx = std::find(to->preds.begin(), to->preds.end(), from) - to->preds.begin();
+		to->preds.erase(to->preds.begin() + idx);
+		for (auto instr: to->instrs)
+			if (instr->kind == Instr::Phi)
+				instr->args.erase(instr->args.begin() + idx);
+	}
+
+	// copies and phis with only one distinct argument are replaced by their value
+	void copyprop(Function &fn, Stats &stats) {
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (auto &block: fn.blocks) {
+				for (auto instr: block->instrs) {
+					if (instr->dead())
+						continue;
+
+					if (instr->kind == Instr::Copy) {
+						instr->forward = Function::resolve(instr->args[0]);
+						stats.copies++;
+						changed = true;
+						continue;
+					}
+					if (instr->kind != Instr::Phi)
+						continue;
+
+					Instr* same = nullptr;
+					bool trivial = true;
+					for (auto arg: instr->args) {
+						arg = Function::resolve(arg);
+						if (arg == instr || arg == same)
+							continue;
+						if (same != nullptr) {
+							trivial = false;
+							break;
+						}
+						same = arg;
+					}
+					if (trivial && same != nullptr) {
+						instr->forward = same;
+						stats.copies++;
+						changed = true;
+					}
+				}
+			}
+		}
+		fn.resolve_all();
+	}
+
+	// branches on constants become gotos
+	void fold_branches(Function &fn, Stats &stats) {
+		for (auto &block: fn.blocks) {
+			if (block->term != Block::Branch)
+				continue;
+
+			bool value;
+			if (is_const(block->cond, PUSH_TRUE))
+				value = true;
+			else if (is_const(block->cond, PUSH_FALSE))
+				value = false;
+			else
+				continue;
+
+			remove_edge(block.get(), block->succs[value ? 1 : 0]);
+			block->term = Block::Goto;
+			block->cond = nullptr;
+			stats.branches++;
+		}
+	}
+
+	// a block that only merges a boolean and branches on it: predecessors
+	// passing a constant go to the target directly (`if a & b`, where `a`
+	// being false means the else branch)
+	void thread_jumps(Function &fn, Stats &stats) {
+		std::unordered_map<Instr*, unsigned int> uses;
+		for (auto &block: fn.blocks) {
+			for (auto instr: block->instrs)
+				for (auto arg: instr->args)
+					uses[arg]++;
+			if (block->cond != nullptr)
+				uses[block->cond]++;
+		}
+
+		for (auto &block: fn.blocks) {
+			auto b = block.get();
+			if (b->term != Block::Branch || b->instrs.size() != 1 || b->instrs[0] != b->cond)
+				continue;
+			auto phi = b->cond;
+			if (phi->kind != Instr::Phi || uses[phi] != 1)
+				continue;
+
+			for (std::size_t i = phi->args.size(); i-- > 0;) {
+				auto arg = phi->args[i];
+				Block* target;
+				if (is_const(arg, PUSH_TRUE))
+					target = b->succs[0];
+				else if (is_const(arg, PUSH_FALSE))
+					target = b->succs[1];
+				else
+					continue;
+
+				auto pred = b->preds[i];
+				if (target == b || std::find(target->preds.begin(), target->preds.end(), pred) != target->preds.end())
+					continue;
+
+				// what the phis of the target got from `b` dominates `pred` too
+				auto from_b = std::find(target->preds.begin(), target->preds.end(), b) - target->preds.begin();
+				fn.replace_edge(pred, b, target);
+				for (auto instr: target->instrs)
+					if (instr->kind == Instr::Phi)
+						instr->args.push_back(instr->args[from_b]);
+				stats.threaded++;
+			}
+		}
+	}
+
+	// a goto to a block with no other predecessor: the blocks become one
+	void merge_blocks(Function &fn, Stats &stats) {
+		std::unordered_set<Block*> merged;
+		for (auto block: fn.order()) {
+			if (merged.count(block) != 0)
+				continue;
+
+			while (block->term == Block::Goto) {
+				auto succ = block->succs[0];
+				if (succ == block || succ == fn.entry || succ->preds.size() != 1)
+					break;
+
+				for (auto instr: succ->instrs)
+					instr->block = block;
+				block->instrs.insert(block->instrs.end(), succ->instrs.begin(), succ->instrs.end());
+				succ->instrs.clear();
+				block->term = succ->term;
+				block->cond = succ->cond;
+				block->guard = succ->guard;
+				block->succs = succ->succs;
+				for (auto next: succ->succs)
+					*std::find(next->preds.begin(), next->preds.end(), succ) = block;
+				succ->succs.clear();
+				merged.insert(succ);
+				stats.blocks++;
+			}
+		}
+
+		fn.blocks.erase(std::remove_if(fn.blocks.begin(), fn.blocks.end(), [&](auto &block) {
+			return merged.count(block.get()) != 0;
+		}), fn.blocks.end());
+	}
+
+	bool cse_candidate(const Instr* instr) {
+		if (instr->kind != Instr::Op)
+			return false;
+
+		switch (instr->op) {
+		case SUB: case MUL: case DIV:
+		case SMALLER: case BIGGER: case SMALLER_OR_EQUAL: case BIGGER_OR_EQUAL:
+		case ADD_NUM: case SUB_NUM: case MUL_NUM: case DIV_NUM:
+		case SMALLER_NUM: case BIGGER_NUM: case SMALLER_OR_EQUAL_NUM: case BIGGER_OR_EQUAL_NUM:
+		case NOT:
+			return true;
+		default:
+			// ADD and EQUALS can look into maps, which can change
+			return false;
+		}
+	}
+
+	// common subexpression elimination over the dominator tree
+	class CSE {
+	public:
+		CSE(Function &fn, Stats &stats): stats(stats) {
+			for (auto &block: fn.blocks)
+				if (block.get() != fn.entry)
+					children[block->idom].push_back(block.get());
+			walk(fn.entry);
+		}
+	private:
+		using Key = std::vector<uint64_t>;
+
+		Stats &stats;
+		std::unordered_map<Block*, std::vector<Block*>> children;
+		std::map<Key, Instr*> available;
+
+		void walk(Block* block) {
+			std::vector<Key> added;
+			for (auto instr: block->instrs) {
+				if (!cse_candidate(instr))
+					continue;
+
+				Key key{ static_cast<uint64_t>(instr->op) };
+				for (auto imm: instr->imms)
+					key.push_back(static_cast<uint64_t>(imm));
+				for (auto arg: instr->args) {
+					// constants by value: each use keeps its own, where it can
+					// be pushed right before it is needed (see lower.cc)
+					arg = Function::resolve(arg);
+					if (arg->rematerializable()) {
+						key.push_back(1);
+						key.push_back(static_cast<uint64_t>(arg->op));
+						key.insert(key.end(), arg->imms.begin(), arg->imms.end());
+					} else {
+						key.push_back(0);
+						key.push_back(reinterpret_cast<uint64_t>(arg));
+					}
+				}
+
+				if (auto pos = available.find(key); pos != available.end()) {
+					instr->forward = pos->second;
+					stats.cse++;
+					continue;
+				}
+				available[key] = instr;
+				added.push_back(key);
+			}
+
+			for (auto child: children[block])
+				walk(child);
+			for (auto &key: added)
+				available.erase(key);
+		}
+	};
+
+	// removes pure instructions nothing depends on
+	void dce(Function &fn, Stats &stats) {
+		std::unordered_set<Instr*> live;
+		std::vector<Instr*> worklist;
+		auto mark = [&](Instr* instr) {
+			if (instr != nullptr && live.insert(instr).second)
+				worklist.push_back(instr);
+		};
+
+		for (auto &block: fn.blocks) {
+			for (auto instr: block->instrs)
+				if (!instr->pure())
+					mark(instr);
+			mark(block->cond);
+		}
+		while (!worklist.empty()) {
+			auto instr = worklist.back();
+			worklist.pop_back();
+			for (auto arg: instr->args)
+				mark(arg);
+		}
+
+		for (auto &block: fn.blocks) {
+			auto &instrs = block->instrs;
+			auto end = std::remove_if(instrs.begin(), instrs.end(), [&](auto instr) { return live.count(instr) == 0; });
+			stats.dce += instrs.end() - end;
+			instrs.erase(end, instrs.end());
+		}
+	}
+
+	void remove_unreachable(Function &fn, Stats &stats) {
+		auto before = fn.blocks.size();
+		fn.remove_unreachable();
+		stats.blocks += before - fn.blocks.size();
+	}
+
+}
+
+void ir::optimize(Function &fn, Stats &stats) {
+	copyprop(fn, stats);
+	fold_branches(fn, stats);
+	remove_unreachable(fn, stats);
+	copyprop(fn, stats);
+
+	thread_jumps(fn, stats);
+	remove_unreachable(fn, stats);
+	copyprop(fn, stats);
+	merge_blocks(fn, stats);
+
+	fn.compute_dominators();
+	CSE(fn, stats);
+	fn.resolve_all();
+	dce(fn, stats);
+}
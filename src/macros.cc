@@ -5,6 +5,7 @@
 #include <cassert>
 #include "include/types.hh"
 #include "include/context.hh"
+#include "include/vm.hh"
 #include "include/utils.hh"
 #include "events/utils.hh"
 
@@ -36,6 +37,10 @@ static Value macro_mod(int n, Context* ctx, std::shared_ptr<Env>) {
 
 	auto a = ctx->pop();
 	auto b = ctx->pop();
+	return builtin_mod(a, b);
+}
+
+Value asbi::builtin_mod(Value a, Value b) {
 	if (a.type != type_t::Number || b.type != type_t::Number)
 		throw std::runtime_error("mod macro usage error");
 
@@ -53,7 +58,10 @@ static Value macro_toInt(int n, Context* ctx, std::shared_ptr<Env>) {
 	if (n != 1)
 		throw std::runtime_error("toInt macro usage error");
 
-	auto num = ctx->pop();
+	return builtin_to_int(ctx->pop());
+}
+
+Value asbi::builtin_to_int(Value num) {
 	if (num.type != type_t::Number)
 		throw std::runtime_error("toInt macro usage error");
 
@@ -64,7 +72,10 @@ static Value macro_len(int n, Context* ctx, std::shared_ptr<Env>) {
 	if (n != 1)
 		throw std::runtime_error("len macro usage error");
 
-	auto val = ctx->pop();
+	return builtin_len(ctx->pop());
+}
+
+Value asbi::builtin_len(Value val) {
 	if (val.type == type_t::Map)
 		return Value::number(val._map->vecdata.size());
 
@@ -90,6 +101,8 @@ static Value macro_debug(int n, Context* ctx, std::shared_ptr<Env>) {
 static Value macro_scope(int n, Context* ctx, std::shared_ptr<Env> env) {
 	if (n != 0)
 		throw std::runtime_error("__scope macro usage error");
+	if (env->isSealed())
+		throw std::runtime_error("__scope called under another name in code compiled with -O2");
 
 	return env->to_map(ctx);
 }
@@ -114,14 +127,12 @@ static Value macro_import(int n, Context* ctx, std::shared_ptr<Env> env) {
 
 	// std::cout << "loading file: " << filepath << '\n';
 
-	std::string content;
-	utils::readfile(path, content);
-
 	auto new_env = std::make_shared<Env>(ctx, ctx->global_env);
 	new_env->decl(ctx->names.__file, filepathvalue);
-	new_env->decl(ctx->names.exports, Value::map(new MapContainer(ctx)));
+	new_env->decl(ctx->names.exports, Value::map(new (ctx->heap) MapContainer(ctx)));
+	new_env->setCaller(env); // the GC has to see the importing script
 
-	ctx->run(content, new_env);
+	ctx->run_file(path, new_env);
 
 	auto data = new_env->lookup(ctx->names.exports);
 	__imports._map->set(filepathvalue, data);
@@ -132,28 +143,12 @@ static Value macro_typeof(int n, Context* ctx, std::shared_ptr<Env>) {
 	if (n != 1)
 		throw std::runtime_error("typeof macro usage error");
 
-	auto arg = ctx->pop();
-	switch (arg.type) {
-	case type_t::Bool:
-		return Value::symbol("bool", ctx);
-	case type_t::Number:
-		return Value::symbol("number", ctx);
-	case type_t::Nil:
-		return Value::symbol("nil", ctx);
-	case type_t::Symbol:
-		return Value::symbol("symbol", ctx);
-	case type_t::String:
-		return Value::symbol("string", ctx);
-	case type_t::Lambda:
-		return Value::symbol("function", ctx);
-	case type_t::Map:
-		return Value::symbol("map", ctx);
-	case type_t::Macro:
-		return Value::symbol("function", ctx);
-	case type_t::StackPlaceholder:
-		assert(false);
-		return Value::symbol("internal_stack_placeholder", ctx);
-	}
+	return builtin_typeof(ctx, ctx->pop());
+}
+
+Value asbi::builtin_typeof(Context* ctx, Value arg) {
+	assert(arg.type != type_t::StackPlaceholder);
+	return Value::symbol(ctx->type_names[static_cast<int>(arg.type)]);
 }
 
 static Value macro_reduce(int n, Context* ctx, std::shared_ptr<Env> env) {
@@ -166,6 +161,10 @@ static Value macro_reduce(int n, Context* ctx, std::shared_ptr<Env> env) {
 	if (map.type != type_t::Map || fn.type != type_t::Lambda)
 		throw std::runtime_error("reduce macro usage error");
 
+	// kept on the stack for the GC while fn runs
+	ctx->push(fn);
+	ctx->push(map);
+
 	auto &vecdata = map._map->vecdata;
 	for (unsigned int i = 0; i < vecdata.size(); ++i) {
 		ctx->push(vecdata[i]);
@@ -181,6 +180,8 @@ static Value macro_reduce(int n, Context* ctx, std::shared_ptr<Env> env) {
 		acc = fn.call(ctx, 3, env);
 	}
 
+	ctx->pop();
+	ctx->pop();
 	return acc;
 }
 
@@ -193,7 +194,9 @@ static Value macro_map(int n, Context* ctx, std::shared_ptr<Env> env) {
 	if (map.type != type_t::Map || fn.type != type_t::Lambda)
 		throw std::runtime_error("map macro usage error");
 
-	auto res = new MapContainer(ctx);
+	auto res = new (ctx->heap) MapContainer(ctx);
+	ctx->push(fn);
+	ctx->push(map);
 	ctx->push(Value::map(res));
 
 	auto &vecdata = map._map->vecdata;
@@ -210,7 +213,10 @@ static Value macro_map(int n, Context* ctx, std::shared_ptr<Env> env) {
 		res->set(key, fn.call(ctx, 2, env));
 	}
 
-	return ctx->pop(); // res muss auf stack liegen weil GC
+	auto res_value = ctx->pop(); // res muss auf stack liegen weil GC
+	ctx->pop();
+	ctx->pop();
+	return res_value;
 }
 
 static Value macro_io_readline(int n, Context* ctx, std::shared_ptr<Env>) {
@@ -287,6 +293,8 @@ static Value macro_eval(int n, Context* ctx, std::shared_ptr<Env> callerenv) {
 
 		env = callerenv->getOuter();
 	}
+	if (env->isSealed())
+		throw std::runtime_error("eval called under another name in code compiled with -O2");
 
 	return ctx->run(string._string->data, env);
 }
@@ -298,28 +306,28 @@ void Context::load_macros() {
 		srand((unsigned)time(nullptr));
 	}
 
-	global_env->decl(this, "assert",   Value::macro( macro_assert  ));
-	global_env->decl(this, "mod",      Value::macro( macro_mod     ));
-	global_env->decl(this, "random",   Value::macro( macro_random  ));
-	global_env->decl(this, "toInt",    Value::macro( macro_toInt   ));
-	global_env->decl(this, "len",      Value::macro( macro_len     ));
-	global_env->decl(this, "__debug",  Value::macro( macro_debug   ));
-	global_env->decl(this, "__scope",  Value::macro( macro_scope   ));
-	global_env->decl(this, "import",   Value::macro( macro_import  ));
-	global_env->decl(this, "typeof",   Value::macro( macro_typeof  ));
-	global_env->decl(this, "reduce",   Value::macro( macro_reduce  ));
-	global_env->decl(this, "map",      Value::macro( macro_map     ));
-	global_env->decl(this, "eval",     Value::macro( macro_eval    ));
-
-	auto io = new MapContainer(this);
+	declare_builtin("assert",   Value::macro( macro_assert  ));
+	declare_builtin("mod",      Value::macro( macro_mod     ));
+	declare_builtin("random",   Value::macro( macro_random  ));
+	declare_builtin("toInt",    Value::macro( macro_toInt   ));
+	declare_builtin("len",      Value::macro( macro_len     ));
+	declare_builtin("__debug",  Value::macro( macro_debug   ));
+	declare_builtin("__scope",  Value::macro( macro_scope   ));
+	declare_builtin("import",   Value::macro( macro_import  ));
+	declare_builtin("typeof",   Value::macro( macro_typeof  ));
+	declare_builtin("reduce",   Value::macro( macro_reduce  ));
+	declare_builtin("map",      Value::macro( macro_map     ));
+	declare_builtin("eval",     Value::macro( macro_eval    ));
+
+	auto io = new (heap) MapContainer(this);
 	io->set(Value::symbol("print", this), Value::macro(macro_io_print));
 	io->set(Value::symbol("println", this), Value::macro(macro_io_println));
 	io->set(Value::symbol("readline", this), Value::macro(macro_io_readline));
-	global_env->decl(this, "io", Value::map(io));
+	declare_builtin("io", Value::map(io));
 
-	auto time = new MapContainer(this);
+	auto time = new (heap) MapContainer(this);
 	time->set(Value::symbol("now", this), Value::macro(macro_time_now));
 	time->set(Value::symbol("runat", this), Value::macro(macro_time_runAt));
-	global_env->decl(this, "time", Value::map(time));
+	declare_builtin("time", Value::map(time));
 
 }
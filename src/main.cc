@@ -4,9 +4,12 @@
 #include <fstream>
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
 #include "include/types.hh"
 #include "include/utils.hh"
 #include "include/procenv.hh"
+#include "include/cache.hh"
+#include "include/snapshot.hh"
 
 extern "C" {
 	#include <stdlib.h>
@@ -59,7 +62,7 @@ static void repl(Context &ctx) {
 }
 
 static void usage(const char *name) {
-	std::cout << "usage: " << name << " [--eval <code...>] [--help] [<file> | --repl] [script-args...]" << '\n';
+	std::cout << "usage: " << name << " [-O<level>] [-f[no-]<pass>] [--param <name>=<value>] [--time-passes] [--dump-types] [--dump-ir] [--dump-peephole] [--eval <code...>] [--stream] [--no-cache] [--snapshot <out>] [--gc-slice <n>] [--gc-threads <n>] [--gc-stats] [--help] [<file> | - | --repl | --from-snapshot <snapshot>] [script-args...]" << '\n';
 	std::cout << "\tASBI: A Stack Based Interpreter (version " << ASBI_VERSION << ", clang " << __clang_version__ << ")\n";
 	std::cout << "\tGo look at README.md and examples/ for help.\n";
 }
@@ -71,11 +74,80 @@ int main(int argc, const char *argv[]) {
 	}
 
 	Context ctx;
-	ctx.global_env->decl(ctx.names.__imports, Value::map(new MapContainer(&ctx)));
+	ctx.global_env->decl(ctx.names.__imports, Value::map(new (ctx.heap) MapContainer(&ctx)));
+	bool stream = false, cache = true, gc_stats = false;
+	std::string snapshot; // --snapshot: where to save the heap after the script ran
 
 	for (int i = 1; i < argc; i++) {
 		auto arg = argv[i];
-		if (strcmp(arg, "--repl") == 0) {
+		if (arg[0] == '-' && arg[1] == 'O' && '0' <= arg[2] && arg[2] <= '9' && arg[3] == '\0') {
+			ctx.optimizer.level = std::min(static_cast<unsigned int>(arg[2] - '0'), opt::max_level);
+		} else if (strncmp(arg, "-fno-", 5) == 0 || (strncmp(arg, "-f", 2) == 0 && arg[2] != '\0')) {
+			bool enable = strncmp(arg, "-fno-", 5) != 0;
+			if (!ctx.optimizer.set_enabled(arg + (enable ? 2 : 5), enable)) {
+				std::cerr << "unknown pass: " << arg << " (passes:";
+				for (auto &name: ctx.optimizer.pass_names())
+					std::cerr << ' ' << name;
+				std::cerr << ")\n";
+				exit(EXIT_FAILURE);
+			}
+		} else if (strcmp(arg, "--param") == 0 && i + 1 < argc) {
+			std::string param = argv[++i];
+			auto pos = param.find('=');
+			auto value = pos == std::string::npos ? std::string() : param.substr(pos + 1);
+			if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+				std::cerr << "invalid parameter: " << param << " (expected <name>=<value>)\n";
+				exit(EXIT_FAILURE);
+			}
+			if (!ctx.optimizer.set_param(param.substr(0, pos), std::stoul(value))) {
+				std::cerr << "unknown parameter: " << param << " (parameters:";
+				for (auto &name: ctx.optimizer.param_names())
+					std::cerr << ' ' << name;
+				std::cerr << ")\n";
+				exit(EXIT_FAILURE);
+			}
+		} else if (strcmp(arg, "--time-passes") == 0) {
+			ctx.optimizer.time_passes = true;
+		} else if (strcmp(arg, "--dump-types") == 0) {
+			ctx.optimizer.dump_types = true;
+		} else if (strcmp(arg, "--dump-ir") == 0) {
+			ctx.optimizer.dump_ir = true;
+		} else if (strcmp(arg, "--dump-peephole") == 0) {
+			ctx.optimizer.dump_peephole = true;
+		} else if (strcmp(arg, "--stream") == 0) {
+			stream = true;
+		} else if (strcmp(arg, "--no-cache") == 0) {
+			cache = false;
+		} else if (strcmp(arg, "--snapshot") == 0 && i + 1 < argc) {
+			snapshot = argv[++i];
+		} else if (strcmp(arg, "--gc-slice") == 0 && i + 1 < argc) {
+			std::string slice = argv[++i];
+			if (slice.empty() || slice.find_first_not_of("0123456789") != std::string::npos) {
+				std::cerr << "invalid gc slice: " << slice << " (expected a number)\n";
+				exit(EXIT_FAILURE);
+			}
+			ctx.gc_slice = std::stoul(slice);
+		} else if (strcmp(arg, "--gc-threads") == 0 && i + 1 < argc) {
+			std::string threads = argv[++i];
+			if (threads.empty() || threads.find_first_not_of("0123456789") != std::string::npos || std::stoul(threads) == 0) {
+				std::cerr << "invalid gc threads: " << threads << " (expected a number > 0)\n";
+				exit(EXIT_FAILURE);
+			}
+			ctx.gc_threads = std::stoul(threads);
+		} else if (strcmp(arg, "--gc-stats") == 0) {
+			gc_stats = true;
+		} else if (strcmp(arg, "--from-snapshot") == 0 && i + 1 < argc) {
+			// continues with the function `main` of the script
+			load_procenv(&ctx, argc, argv, i + 2);
+			auto env = Snapshot::load(&ctx, argv[i + 1]);
+			auto entry = env->lookup(&ctx, "main");
+			if (entry.type != type_t::Lambda)
+				throw std::runtime_error("snapshot: `main` is not a function");
+
+			entry.call(&ctx, 0, env);
+			ctx.evtloop.start();
+			break;
+		} else if (strcmp(arg, "--repl") == 0) {
 			load_procenv(&ctx, argc, argv, i + 1);
 			repl(ctx);
 			break;
@@ -88,6 +160,14 @@ int main(int argc, const char *argv[]) {
 		} else if (strcmp(arg, "--test") == 0) {
 			tests::run();
 #endif
+		} else if (strcmp(arg, "-") == 0) {
+			load_procenv(&ctx, argc, argv, i + 1);
+			ctx.global_env->decl(ctx.names.__file, Value::string("-", &ctx));
+			ctx.global_env->decl(ctx.names.__main, Value::string("-", &ctx));
+
+			ctx.run(std::cin);
+			ctx.evtloop.start();
+			break;
 		} else if (arg[0] != '-') {
 			auto filepath = std::string(arg);
 			filepath = utils::normalize(filepath);
@@ -96,9 +176,25 @@ int main(int argc, const char *argv[]) {
 			ctx.global_env->decl(ctx.names.__file, Value::string(filepath.c_str(), &ctx));
 			ctx.global_env->decl(ctx.names.__main, Value::string(filepath.c_str(), &ctx));
 
-			std::string content;
-			utils::readfile(filepath, content);
-			ctx.run(content);
+			if (stream && snapshot.empty()) {
+				std::ifstream in(filepath);
+				if (!in.good())
+					throw std::runtime_error("readfile error");
+				ctx.run(in);
+			} else {
+				// the dumps and timings are of the compilation, which the cache skips
+				auto &opts = ctx.optimizer;
+				auto dir = BytecodeCache::default_dir();
+				if (cache && !dir.empty() && !opts.time_passes && !opts.dump_types && !opts.dump_ir && !opts.dump_peephole)
+					ctx.cache = std::make_unique<BytecodeCache>(&ctx, dir);
+				auto env = std::make_shared<Env>(&ctx, ctx.global_env);
+				// `main` is looked up in the env of a snapshot
+				ctx.run_file(filepath, env, !snapshot.empty());
+				if (!snapshot.empty()) {
+					Snapshot::save(&ctx, env, snapshot);
+					break;
+				}
+			}
 			ctx.evtloop.start();
 			break;
 		} else {
@@ -107,5 +203,12 @@ int main(int argc, const char *argv[]) {
 		}
 	}
 
+	if (ctx.optimizer.time_passes)
+		ctx.optimizer.report(std::cerr);
+	if (ctx.optimizer.dump_peephole)
+		ctx.optimizer.report_peephole(std::cerr);
+	if (gc_stats)
+		ctx.report_gc(std::cerr);
+
 	return EXIT_SUCCESS;
 }
@@ -1,54 +1,748 @@
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <sys/mman.h>
 #include "include/mem.hh"
 #include "include/context.hh"
 
 using namespace asbi;
 
+// slots reused by the pool would hide use-after-free from ASan: freed slots
+// are poisoned and only fresh pages are allocated from
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+static constexpr bool pool_reuse = false;
+#else
+#define ASAN_POISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+static constexpr bool pool_reuse = true;
+#endif
+
+asbi::Pool::~Pool(){
+	for (auto page: pages) {
+		ASAN_UNPOISON_MEMORY_REGION(page, page_size);
+		munmap(page, page_size);
+	}
+}
+
+void* asbi::Pool::allocate(std::size_t size){
+	assert(size <= max_size);
+	auto cls = (size - 1) / granule;
+	auto &cur = cursors[cls];
+	if (cur.free == 0)
+		refill(cur, cls);
+
+	auto ptr = cur.page->slot(cur.word * 64 + __builtin_ctzll(cur.free));
+	cur.free &= cur.free - 1;
+	ASAN_UNPOISON_MEMORY_REGION(ptr, cur.page->size);
+	return ptr;
+}
+
+void asbi::Pool::release(void* ptr){
+	auto page = page_of(ptr);
+	auto i = page->index(ptr);
+	auto bit = ~(1ull << (i % 64));
+	page->alloc[i / 64] &= bit;
+	page->young[i / 64] &= bit;
+	page->old[i / 64] &= bit;
+	page->marks[i / 64] &= bit;
+	ASAN_POISON_MEMORY_REGION(ptr, page->size);
+}
+
+void asbi::Pool::refill(Cursor &cur, std::size_t cls){
+	for (;;) {
+		if (auto page = cur.page; page != nullptr) {
+			for (auto n = page->nwords(); cur.next < n; cur.next++) {
+				auto free = ~page->alloc[cur.next] & page->valid(cur.next);
+				if (free != 0) {
+					page->alloc[cur.next] |= free;
+					cur.word = cur.next++;
+					cur.free = free;
+					return;
+				}
+			}
+		}
+
+		auto &list = partial[cls];
+		if (pool_reuse && !list.empty()) {
+			cur.page = list.back();
+			cur.page->partial_listed = false;
+			list.pop_back();
+		} else {
+			cur.page = new_page(cls);
+		}
+		cur.next = 0;
+	}
+}
+
+asbi::Pool::Page* asbi::Pool::new_page(std::size_t cls){
+	// twice the size, what is around the aligned page is unmapped again
+	auto raw = static_cast<char*>(mmap(nullptr, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (raw == MAP_FAILED)
+		throw std::bad_alloc();
+	auto aligned = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(raw) + page_size - 1) & ~(page_size - 1));
+	if (aligned != raw)
+		munmap(raw, aligned - raw);
+	munmap(aligned + page_size, raw + page_size - aligned);
+
+	// zeroed by mmap
+	auto page = reinterpret_cast<Page*>(aligned);
+	page->pool = this;
+	page->size = (cls + 1) * granule;
+	page->slots = (page_size - header) / page->size;
+	page->recip = ((1ull << 32) + page->size - 1) / page->size;
+	ASAN_POISON_MEMORY_REGION(page->slot(0), page_size - header);
+	pages.push_back(page);
+	return page;
+}
+
+bool asbi::Pool::claim(const GCObj* obj){
+	auto page = page_of(obj);
+	auto i = page->index(obj);
+	auto &word = page->marks[i / 64];
+	auto bit = 1ull << (i % 64);
+	// most objects reached twice are already marked, no need to claim them
+	if (__atomic_load_n(&word, __ATOMIC_RELAXED) & bit)
+		return false;
+	return !(__atomic_fetch_or(&word, bit, __ATOMIC_RELAXED) & bit);
+}
+
+void asbi::Pool::add_young(const GCObj* obj){
+	auto page = page_of(obj);
+	auto i = page->index(obj);
+	page->young[i / 64] |= 1ull << (i % 64);
+	if (!page->young_listed) {
+		page->young_listed = true;
+		young_pages.push_back(page);
+	}
+}
+
+template<typename F>
+void asbi::Pool::collect_young(std::vector<GCObj*> &dead, F promote){
+	std::size_t n = 0;
+	for (auto page: young_pages) {
+		bool left = false, freed = false;
+		for (std::size_t w = 0, nw = page->nwords(); w < nw; w++) {
+			auto young = page->young[w], marks = page->marks[w];
+			if (young == 0)
+				continue;
+
+			for (auto bits = young & ~marks; bits != 0; bits &= bits - 1)
+				dead.push_back(reinterpret_cast<GCObj*>(page->slot(w * 64 + __builtin_ctzll(bits))));
+			for (auto bits = young & marks; bits != 0; bits &= bits - 1) {
+				auto bit = bits & -bits;
+				if (promote(reinterpret_cast<GCObj*>(page->slot(w * 64 + __builtin_ctzll(bits))))) {
+					page->old[w] |= bit;
+					young &= ~bit;
+				}
+			}
+
+			page->marks[w] = marks & ~page->young[w];
+			page->young[w] = young & marks;
+			left = left || page->young[w] != 0;
+			freed = freed || (young & ~marks) != 0;
+		}
+
+		if (freed && !page->partial_listed) {
+			page->partial_listed = true;
+			partial[page->size / granule - 1].push_back(page);
+		}
+		page->young_listed = left;
+		if (left)
+			young_pages[n++] = page;
+	}
+	young_pages.resize(n);
+}
+
+template<typename F>
+void asbi::Pool::promote_young(F promote){
+	for (auto page: young_pages) {
+		for (std::size_t w = 0, nw = page->nwords(); w < nw; w++) {
+			for (auto bits = page->young[w]; bits != 0; bits &= bits - 1)
+				promote(reinterpret_cast<GCObj*>(page->slot(w * 64 + __builtin_ctzll(bits))));
+			page->old[w] |= page->young[w];
+			page->young[w] = 0;
+		}
+		page->young_listed = false;
+	}
+	young_pages.clear();
+}
+
+void asbi::Pool::unmark_young(){
+	for (auto page: young_pages)
+		for (std::size_t w = 0, nw = page->nwords(); w < nw; w++)
+			page->marks[w] &= ~page->young[w];
+}
+
+void asbi::Pool::unmark(){
+	for (auto page: pages)
+		std::fill(std::begin(page->marks), std::end(page->marks), 0);
+}
+
+std::size_t asbi::Pool::sweep(std::size_t i, std::size_t &freed){
+	auto page = pages[i];
+	std::size_t n = 0;
+	for (std::size_t w = 0, nw = page->nwords(); w < nw; w++) {
+		auto old = page->old[w];
+		n += __builtin_popcountll(old);
+		for (auto bits = old & ~page->marks[w]; bits != 0; bits &= bits - 1) {
+			auto obj = reinterpret_cast<GCObj*>(page->slot(w * 64 + __builtin_ctzll(bits)));
+			// gc_manage is false for callbacks kept by the event loop
+			if (obj->gc_manage) {
+				freed += obj->gc_size();
+				delete obj;
+			}
+		}
+	}
+	std::fill(std::begin(page->marks), std::end(page->marks), 0);
+	return n;
+}
+
+void asbi::Pool::trim(){
+	for (auto &cur: cursors) {
+		if (cur.free != 0)
+			cur.page->alloc[cur.word] &= ~cur.free;
+		cur = Cursor();
+	}
+	for (auto &list: partial)
+		list.clear();
+
+	std::size_t n = 0;
+	for (auto page: pages) {
+		bool empty = true, full = true;
+		for (std::size_t w = 0, nw = page->nwords(); w < nw; w++) {
+			empty = empty && page->alloc[w] == 0;
+			full = full && page->alloc[w] == page->valid(w);
+		}
+
+		// a page with young objects is not empty, but they could have been
+		// freed without a minor collection looking at the page since
+		if (empty && !page->young_listed) {
+			ASAN_UNPOISON_MEMORY_REGION(page, page_size);
+			munmap(page, page_size);
+			continue;
+		}
+
+		page->partial_listed = !full;
+		if (!full)
+			partial[page->size / granule - 1].push_back(page);
+		pages[n++] = page;
+	}
+	pages.resize(n);
+}
+
 asbi::GCObj::GCObj(Context* ctx, bool gc){
-	gc_inuse = false;
 	gc_manage = gc;
+	gc_old = !gc;
 	if (gc_manage) {
-		this->gc_next = ctx->heap_head;
-		ctx->heap_head = this;
+		ctx->heap.add_young(this);
+		ctx->nursery_count++;
 	}
 }
 
 asbi::GCObj::~GCObj(){
-	assert(!gc_inuse || !gc_manage);
+	assert(!gc_manage || !Pool::marked(this));
 }
 
 void asbi::Context::check_gc(std::shared_ptr<Env> env){
-	// TODO: heap_size und heap_max
-	if (heap_size >= heap_max) {
-		gc(env);
-		heap_max = heap_size * 2;
+	if (gc_phase == GCPhase::Idle && nursery_count < nursery_max && heap_size < heap_max)
+		return;
+
+	auto start = std::chrono::steady_clock::now();
+	if (gc_phase != GCPhase::Idle) {
+		gc_step(env);
+	} else {
+		if (nursery_count >= nursery_max)
+			gc_minor(env);
+
+		if (heap_size >= heap_max && (gc_slice == 0 || gc_threads > 1)) {
+			gc_lazy(env);
+		} else if (heap_size >= heap_max) {
+			gc_start(env);
+		}
 	}
+
+	std::chrono::duration<double, std::micro> pause = std::chrono::steady_clock::now() - start;
+	gc_pauses.push_back(pause.count());
+}
+
+void asbi::Context::report_gc(std::ostream &os) const {
+	auto pauses = gc_pauses;
+	std::sort(pauses.begin(), pauses.end());
+	double total = 0;
+	for (auto pause: pauses)
+		total += pause;
+
+	auto percentile = [&](std::size_t p) {
+		return pauses.empty() ? 0. : pauses[std::min(pauses.size() - 1, pauses.size() * p / 100)];
+	};
+	os << "gc: " << pauses.size() << " pauses, " << total / 1000 << "ms total, p50: "
+		<< percentile(50) << "us, p99: " << percentile(99) << "us, max: "
+		<< (pauses.empty() ? 0. : pauses.back()) << "us\n";
+}
+
+void asbi::Context::remember(MapContainer* mc){
+	mc->gc_remembered = true;
+	remembered_maps.push_back(mc);
+}
+
+void asbi::Context::remember(Env* env){
+	env->gc_remembered = true;
+	env->gc_index = remembered_envs.size();
+	remembered_envs.push_back(env);
+}
+
+void asbi::Context::shade(const Value &val){
+	GCObj* obj;
+	switch (val.type) {
+	case type_t::String:
+	case type_t::Symbol:
+		// string constants are never freed, their pool is not swept
+		if (val._string->gc_manage && !val._string->gc_marked())
+			Pool::mark(val._string);
+		return;
+	case type_t::Lambda:
+		obj = val._lambda;
+		break;
+	case type_t::Map:
+		obj = val._map;
+		break;
+	default:
+		return;
+	}
+
+	if (!obj->gc_marked()) {
+		Pool::mark(obj);
+		gray.push_back(obj);
+	}
+}
+
+void asbi::Context::shade(const Env* env){
+	if (env == nullptr || env->gc_mark == gc_marks)
+		return;
+
+	env->gc_mark = gc_marks;
+	env->gc_gray = true;
+	env->gc_gray_index = gray_envs.size();
+	gray_envs.push_back(env);
+}
+
+// only shaded, gc_mark() does the rest without recursion (long lists)
+void asbi::Context::gc_roots(std::shared_ptr<Env> env){
+	shade(env.get());
+
+	for (auto &elm: stack)
+		shade(elm);
+
+	// kept alive even if rebound, passes compare against them
+	for (auto &[name, val]: builtins)
+		shade(val);
+}
+
+void asbi::Context::gc_finish(){
+	gc_marks++;
+	gc_epoch++;
+}
+
+// only the nursery: the old objects are assumed to be alive, the ones
+// pointing into the nursery are in the remembered sets
+void asbi::Context::gc_minor(std::shared_ptr<Env> env){
+	GCObj::gc_minor = true;
+	gc_roots(env);
+
+	for (auto mc: remembered_maps)
+		mc->gc_scan_dirty();
+
+	for (auto remembered: remembered_envs)
+		shade(remembered);
+
+	gc_mark(SIZE_MAX);
+
+	// freed at the end: a visited env can be kept alive by dead lambdas only
+	std::vector<GCObj*> dead;
+	std::vector<MapContainer*> promoted;
+	heap.collect_young(dead, [&](GCObj* obj) {
+		if (++obj->gc_age < promote_age)
+			return false;
+
+		nursery_count--;
+		obj->gc_old = true;
+		if (obj->gc_promote())
+			promoted.push_back(static_cast<MapContainer*>(obj));
+		return true;
+	});
+	nursery_count -= dead.size();
+	for (auto obj: dead)
+		gc_freed(obj->gc_size());
+	GCObj::gc_minor = false;
+
+	// the old objects still pointing to survivors that stay in the nursery,
+	// only maps have references that can change
+	std::vector<MapContainer*> maps;
+	maps.swap(remembered_maps);
+	for (auto mc: maps) {
+		mc->gc_remembered = false;
+		if (mc->gc_trim())
+			remember(mc);
+	}
+	for (auto mc: promoted)
+		remember(mc);
+
+	// every env with young values was looked into: reached from the roots, a
+	// young object or the remembered set
+	for (auto remembered: remembered_envs)
+		if (remembered != nullptr)
+			remembered->gc_remembered = false;
+	remembered_envs.clear();
+	for (auto visited: minor_envs)
+		if (visited->gc_young_refs())
+			remember(const_cast<Env*>(visited));
+	minor_envs.clear();
+
+	gc_finish();
+	for (auto obj: dead)
+		delete obj;
 }
 
 void asbi::Context::gc(std::shared_ptr<Env> env){
 	// std::cerr << "===ASBI===: GC running..." << '\n';
 
-	if (env != nullptr)
-		env->gc_visit();
+	gc_abort();
+	gc_mark_all(env);
+	if (gc_threads > 1)
+		gc_sweep_parallel();
+	else
+		gc_sweep();
+
+	gc_finish();
+}
+
+// like gc(), but the dead objects are only freed by the following calls of
+// check_gc(), at least a chunk each (gc_step())
+void asbi::Context::gc_lazy(std::shared_ptr<Env> env){
+	gc_mark_all(env);
+	gc_finish();
+	gc_phase = GCPhase::Sweep;
+	sweep_next = 0;
+}
+
+void asbi::Context::gc_mark_all(std::shared_ptr<Env> env){
+	if (gc_threads > 1) {
+		gc_mark_parallel(env);
+	} else {
+		gc_roots(env);
+		gc_mark(SIZE_MAX);
+	}
 
-	for (auto elm: stack)
-		elm.gc_visit();
+	gc_promote_nursery();
+}
+
+void asbi::Context::gc_sweep(){
+	std::size_t freed = 0;
+	for (std::size_t i = 0; i < heap.npages(); i++)
+		heap.sweep(i, freed);
+	gc_freed(freed);
+	heap.trim();
+}
 
-	auto p = &heap_head;
-	while (*p != nullptr) {
-		auto obj = *p;
-		// assert(obj->gc_manage); //
-		if (!obj->gc_inuse && obj->gc_manage) {
-			*p = obj->gc_next;
-			heap_size -= obj->gc_size();
-			delete obj;
+// every marker takes gray values from its own stack, hands some of them out
+// (`shared`) while nobody else has any and steals from the others once it
+// ran out; the mark bits are claimed atomically
+struct asbi::Context::GCMarkers {
+	struct Gray {
+		const Env* env; // or val
+		Value val;
+	};
+	struct Marker {
+		std::vector<Gray> local;
+		std::mutex mtx;
+		std::deque<Gray> shared;
+		std::atomic<std::size_t> nshared{0};
+	};
+	std::vector<std::unique_ptr<Marker>> markers;
+	std::atomic<unsigned int> idle{0};
+
+	static bool steal(Marker &from, Gray &item) {
+		if (from.nshared.load(std::memory_order_relaxed) == 0)
+			return false;
+
+		std::unique_lock<std::mutex> lock(from.mtx);
+		if (from.shared.empty())
+			return false;
+
+		item = from.shared.front();
+		from.shared.pop_front();
+		from.nshared.store(from.shared.size(), std::memory_order_relaxed);
+		return true;
+	}
+
+	static void visit(Marker &me, const Value &val) {
+		const GCObj* obj;
+		switch (val.type) {
+		case type_t::String:
+		case type_t::Symbol:
+			if (val._string->gc_manage)
+				Pool::claim(val._string);
+			return;
+		case type_t::Lambda:
+			obj = val._lambda;
+			break;
+		case type_t::Map:
+			obj = val._map;
+			break;
+		default:
+			return;
+		}
+
+		if (Pool::claim(obj))
+			me.local.push_back({ nullptr, val });
+	}
+
+	static void visit(Marker &me, const Env* env, std::size_t marks) {
+		if (env != nullptr && __atomic_load_n(&env->gc_mark, __ATOMIC_RELAXED) != marks && __atomic_exchange_n(&env->gc_mark, marks, __ATOMIC_RELAXED) != marks)
+			me.local.push_back({ env, Value() });
+	}
+};
+
+void asbi::Context::gc_mark_parallel(std::shared_ptr<Env> env){
+	GCMarkers m;
+	for (unsigned int i = 0; i < gc_threads; i++)
+		m.markers.push_back(std::make_unique<GCMarkers::Marker>());
+
+	// the roots are dealt out to all markers
+	unsigned int next = 0;
+	GCMarkers::visit(*m.markers[next++ % gc_threads], env.get(), gc_marks);
+	for (auto &elm: stack)
+		GCMarkers::visit(*m.markers[next++ % gc_threads], elm);
+	for (auto &[name, val]: builtins)
+		GCMarkers::visit(*m.markers[next++ % gc_threads], val);
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < gc_threads; i++)
+		threads.push_back(std::thread(&Context::gc_mark_worker, this, std::ref(m), i));
+	gc_mark_worker(m, 0);
+	for (auto &thread: threads)
+		thread.join();
+}
+
+void asbi::Context::gc_mark_worker(GCMarkers &m, unsigned int id){
+	auto &me = *m.markers[id];
+	auto n = m.markers.size();
+	for (;;) {
+		GCMarkers::Gray item;
+		if (!me.local.empty()) {
+			item = me.local.back();
+			me.local.pop_back();
 		} else {
-			obj->gc_inuse = false;
-			p = &obj->gc_next;
+			bool found = false;
+			for (std::size_t i = 0; i < n && !found; i++)
+				found = GCMarkers::steal(*m.markers[(id + i) % n], item);
+
+			if (!found) {
+				// done once all markers are out of work: only a marker
+				// that is not idle hands out values
+				m.idle++;
+				for (;;) {
+					if (m.idle.load() == n)
+						return;
+
+					bool work = false;
+					for (auto &marker: m.markers)
+						work = work || marker->nshared.load(std::memory_order_relaxed) > 0;
+					if (work)
+						break;
+
+					std::this_thread::yield();
+				}
+				m.idle--;
+				continue;
+			}
+		}
+
+		if (item.env != nullptr) {
+			for (auto &[key, val]: item.env->vars)
+				GCMarkers::visit(me, val);
+
+			GCMarkers::visit(me, item.env->outer.get(), gc_marks);
+			GCMarkers::visit(me, item.env->caller.get(), gc_marks);
+		} else if (item.val.type == type_t::Lambda) {
+			GCMarkers::visit(me, item.val._lambda->env.get(), gc_marks);
+		} else {
+			auto mc = item.val._map;
+			for (auto &[key, val]: mc->data) {
+				GCMarkers::visit(me, key);
+				GCMarkers::visit(me, val);
+			}
+			for (auto &val: mc->vecdata)
+				GCMarkers::visit(me, val);
+		}
+
+		if (me.local.size() > 1 && me.nshared.load(std::memory_order_relaxed) == 0) {
+			// the oldest half, the most work is likely behind those
+			std::unique_lock<std::mutex> lock(me.mtx);
+			auto half = me.local.size() / 2;
+			me.shared.insert(me.shared.end(), me.local.begin(), me.local.begin() + half);
+			me.local.erase(me.local.begin(), me.local.begin() + half);
+			me.nshared.store(me.shared.size(), std::memory_order_relaxed);
+		}
+	}
+}
+
+// each thread takes the next `sweep_batch` pages left until none are, every
+// page is swept by one thread only
+void asbi::Context::gc_sweep_parallel(){
+	constexpr std::size_t sweep_batch = 16;
+	auto npages = heap.npages();
+	std::vector<std::size_t> freed(gc_threads);
+	std::atomic<std::size_t> next{0};
+	auto sweep = [&](unsigned int id) {
+		for (auto i = next.fetch_add(sweep_batch); i < npages; i = next.fetch_add(sweep_batch))
+			for (auto j = i; j < std::min(i + sweep_batch, npages); j++)
+				heap.sweep(j, freed[id]);
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < gc_threads && i * sweep_batch < npages; i++)
+		threads.push_back(std::thread(sweep, i));
+	sweep(0);
+	for (auto &thread: threads)
+		thread.join();
+
+	for (auto bytes: freed)
+		gc_freed(bytes);
+	heap.trim();
+}
+
+// nothing is young afterwards
+void asbi::Context::gc_promote_nursery(){
+	for (auto mc: remembered_maps) {
+		mc->gc_remembered = mc->gc_dirty_data = false;
+		mc->gc_dirty_lo = mc->gc_dirty_hi = 0;
+	}
+	remembered_maps.clear();
+	for (auto remembered: remembered_envs)
+		if (remembered != nullptr)
+			remembered->gc_remembered = false;
+	remembered_envs.clear();
+
+	// the survivors of the nursery are promoted
+	heap.promote_young([](GCObj* obj) { obj->gc_old = true; });
+	nursery_count = 0;
+}
+
+// the objects of the old heap (everything, see gc_promote_nursery()) are
+// marked a slice at a time while the script runs: gray objects are marked but
+// not yet scanned, the write barriers shade what is stored into a marked map
+// or env, the roots are shaded again at the end (the stack has no barrier)
+void asbi::Context::gc_start(std::shared_ptr<Env> env){
+	gc_promote_nursery();
+	// envs from before the collection are old for Env::write_barrier()
+	gc_epoch++;
+	gc_phase = GCPhase::Mark;
+	gc_roots(env);
+	gc_step(env);
+}
+
+bool asbi::Context::gc_mark(std::size_t budget){
+	std::size_t work = 0;
+	while (work < budget) {
+		if (scanning != nullptr) {
+			auto &vecdata = scanning->vecdata;
+			auto n = std::min(vecdata.size() - std::min(scan_pos, vecdata.size()), budget - work);
+			for (auto i = scan_pos; i < scan_pos + n; i++)
+				shade(vecdata[i]);
+
+			scan_pos += n;
+			work += 1 + n;
+			if (scan_pos >= vecdata.size())
+				scanning = nullptr;
+		} else if (!gray.empty()) {
+			auto obj = gray.back();
+			gray.pop_back();
+			work += obj->gc_scan(this);
+		} else if (!gray_envs.empty()) {
+			auto env = gray_envs.back();
+			gray_envs.pop_back();
+			if (env == nullptr)
+				continue;
+
+			env->gc_gray = false;
+			if (GCObj::gc_minor)
+				minor_envs.push_back(env);
+			for (auto &[key, val]: env->vars)
+				shade(val);
+
+			shade(env->outer.get());
+			shade(env->caller.get());
+			work += 1 + env->vars.size();
+		} else {
+			return true;
 		}
 	}
+	return gray.empty() && gray_envs.empty() && scanning == nullptr;
+}
+
+void asbi::Context::gc_step(std::shared_ptr<Env> env){
+	if (gc_phase == GCPhase::Mark) {
+		if (!gc_mark(gc_slice))
+			return;
+
+		gc_roots(env);
+		gc_mark(SIZE_MAX);
+
+		// only the old heap is swept, whatever was allocated since the start
+		// stays in the nursery
+		heap.unmark_young();
+		gc_marks++;
+
+		// maps remembered since the start that are about to be freed
+		std::vector<MapContainer*> maps;
+		maps.swap(remembered_maps);
+		for (auto mc: maps) {
+			if (Pool::marked(mc))
+				remembered_maps.push_back(mc);
+			else
+				mc->gc_remembered = false;
+		}
+
+		gc_phase = GCPhase::Sweep;
+		sweep_next = 0;
+		return;
+	}
+
+	// whole pages, nothing new is made old until the sweep is done
+	std::size_t freed = 0;
+	for (std::size_t n = 0; (n == 0 || n < gc_slice) && sweep_next < heap.npages(); sweep_next++)
+		n += heap.sweep(sweep_next, freed);
+	gc_freed(freed);
+
+	if (sweep_next == heap.npages()) {
+		gc_phase = GCPhase::Idle;
+		heap.trim();
+		heap_max = std::max(heap_size * 2, heap_min);
+	}
+}
+
+// drops an unfinished incremental collection, its marks would hide objects
+// from another one
+void asbi::Context::gc_abort(){
+	if (gc_phase == GCPhase::Idle)
+		return;
+
+	heap.unmark();
+
+	gray.clear();
+	for (auto env: gray_envs)
+		if (env != nullptr)
+			env->gc_gray = false;
+	gray_envs.clear();
+	scanning = nullptr;
+	gc_marks++;
 
-	if (env != nullptr)
-		env->gc_unvisit();
+	gc_phase = GCPhase::Idle;
 }
@@ -0,0 +1,227 @@
+#include <cassert>
+#include <cstring>
+#include "analysis.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+
+namespace {
+
+	class Collect: public Visitor {
+	public:
+		explicit Collect(opt::Bindings &bindings): bindings(bindings) {}
+
+		Node* visit_variable(Variable* node) override {
+			if (node->sc->data == "eval" || node->sc->data == "__scope")
+				bindings.dynamic = true;
+			return node;
+		}
+
+		Node* visit_decl(VariableDecl* node) override {
+			for (auto [var, val]: node->decls)
+				bindings.bound[var->sc] += 1;
+			return Visitor::visit_decl(node);
+		}
+
+		Node* visit_destruct(DestructList* node) override {
+			for (auto lhs: node->lhss)
+				if (auto var = dynamic_cast<Variable*>(lhs); var != nullptr)
+					bindings.bound[var->sc] += 1;
+			return Visitor::visit_destruct(node);
+		}
+
+		Node* visit_assign_variable(AssignVariable* node) override {
+			bindings.assigned.insert(node->var->sc);
+			return Visitor::visit_assign_variable(node);
+		}
+
+		Node* visit_lambda(Lambda* node) override {
+			for (auto argname: node->argnames)
+				bindings.bound[argname] += 1;
+			return Visitor::visit_lambda(node);
+		}
+	private:
+		opt::Bindings &bindings;
+	};
+
+
+	class Seal: public Visitor {
+	public:
+		Node* visit_lambda(Lambda* node) override {
+			node->sealed = true;
+			return Visitor::visit_lambda(node);
+		}
+	};
+
+	class Uses: public Visitor {
+	public:
+		std::unordered_map<StringContainer*, unsigned int> uses;
+		Node* visit_variable(Variable* node) override {
+			uses[node->sc] += 1;
+			return node;
+		}
+	};
+
+	class Clone: public Visitor {
+	public:
+		explicit Clone(const opt::Renames &renames): renames(renames) {}
+
+		Variable* var(Variable* node) {
+			auto pos = renames.find(node->sc);
+			return new Variable(pos == renames.end() ? node->sc : pos->second);
+		}
+
+		Node* opt(Node* node) { return node == nullptr ? nullptr : visit(node); }
+
+		Node* visit_variable(Variable* node) override { return var(node); }
+		Node* visit_access(Access* node) override {
+			return new Access(visit(node->left), visit(node->right));
+		}
+		Node* visit_infix(InfixOperator* node) override {
+			return new InfixOperator(node->type, visit(node->lhs), visit(node->rhs));
+		}
+		Node* visit_prefix(PrefxOperator* node) override {
+			return new PrefxOperator(node->type, visit(node->operand));
+		}
+		Node* visit_decl(VariableDecl* node) override {
+			std::vector<std::pair<Variable*, Node*>> decls;
+			for (auto [v, val]: node->decls)
+				decls.push_back(std::make_pair(var(v), opt(val)));
+			return new VariableDecl(decls);
+		}
+		Node* visit_destruct(DestructList* node) override {
+			std::vector<Node*> lhss;
+			for (auto lhs: node->lhss) {
+				auto v = dynamic_cast<Variable*>(lhs);
+				lhss.push_back(v != nullptr ? var(v) : visit(lhs));
+			}
+			return new DestructList(lhss, visit(node->rhs));
+		}
+		Node* visit_assign_variable(AssignVariable* node) override {
+			return new AssignVariable(var(node->var), visit(node->val));
+		}
+		Node* visit_assign_access(AssignAccess* node) override {
+			auto acs = new Access(visit(node->acs->left), visit(node->acs->right));
+			return new AssignAccess(acs, visit(node->val));
+		}
+		Node* visit_if(If* node) override {
+			return new If(visit(node->cond), visit(node->ifbody), opt(node->elsebody));
+		}
+		Node* visit_for(For* node) override {
+			return new For(opt(node->init), visit(node->cond), opt(node->inc), visit(node->body));
+		}
+		Node* visit_block(Block* node) override {
+			std::vector<Node*> exprs;
+			for (auto expr: node->exprs)
+				exprs.push_back(visit(expr));
+			return new Block(exprs);
+		}
+		Node* visit_nil(Nil*) override { return new Nil(); }
+		Node* visit_number(Number* node) override { return new Number(node->value); }
+		Node* visit_bool(Bool* node) override { return new Bool(node->value); }
+		Node* visit_string(String* node) override { return new String(node->sc); }
+		Node* visit_symbol(Symbol* node) override { return new Symbol(node->sc); }
+		Node* visit_list(List* node) override {
+			std::vector<Node*> values;
+			for (auto val: node->values)
+				values.push_back(visit(val));
+			return new List(values);
+		}
+		Node* visit_map(Map* node) override {
+			std::vector<std::pair<Node*, Node*>> values;
+			for (auto [key, val]: node->values)
+				values.push_back(std::make_pair(visit(key), visit(val)));
+			return new Map(values);
+		}
+		Node* visit_lambda(Lambda* node) override {
+			assert(node->lazy == nullptr); // only without the passes (see PassManager::lazy_enabled())
+			auto argnames = node->argnames;
+			for (auto &argname: argnames)
+				if (auto pos = renames.find(argname); pos != renames.end())
+					argname = pos->second;
+			return new Lambda(argnames, static_cast<Block*>(visit(node->body)));
+		}
+		Node* visit_call(Call* node) override {
+			std::vector<Node*> args;
+			for (auto arg: node->args)
+				args.push_back(visit(arg));
+			return new Call(visit(node->callable), args);
+		}
+	private:
+		const opt::Renames &renames;
+	};
+
+	class Size: public Visitor {
+	public:
+		unsigned int size = 0;
+		Node* visit_variable(Variable* node) override { size++; return Visitor::visit_variable(node); }
+		Node* visit_access(Access* node) override { size++; return Visitor::visit_access(node); }
+		Node* visit_infix(InfixOperator* node) override { size++; return Visitor::visit_infix(node); }
+		Node* visit_prefix(PrefxOperator* node) override { size++; return Visitor::visit_prefix(node); }
+		Node* visit_decl(VariableDecl* node) override { size++; return Visitor::visit_decl(node); }
+		Node* visit_destruct(DestructList* node) override { size++; return Visitor::visit_destruct(node); }
+		Node* visit_assign_variable(AssignVariable* node) override { size++; return Visitor::visit_assign_variable(node); }
+		Node* visit_assign_access(AssignAccess* node) override { size++; return Visitor::visit_assign_access(node); }
+		Node* visit_if(If* node) override { size++; return Visitor::visit_if(node); }
+		Node* visit_for(For* node) override { size++; return Visitor::visit_for(node); }
+		Node* visit_block(Block* node) override { size++; return Visitor::visit_block(node); }
+		Node* visit_nil(Nil* node) override { size++; return Visitor::visit_nil(node); }
+		Node* visit_number(Number* node) override { size++; return Visitor::visit_number(node); }
+		Node* visit_bool(Bool* node) override { size++; return Visitor::visit_bool(node); }
+		Node* visit_string(String* node) override { size++; return Visitor::visit_string(node); }
+		Node* visit_symbol(Symbol* node) override { size++; return Visitor::visit_symbol(node); }
+		Node* visit_list(List* node) override { size++; return Visitor::visit_list(node); }
+		Node* visit_map(Map* node) override { size++; return Visitor::visit_map(node); }
+		Node* visit_lambda(Lambda* node) override { size++; return Visitor::visit_lambda(node); }
+		Node* visit_call(Call* node) override { size++; return Visitor::visit_call(node); }
+	};
+
+}
+
+opt::Bindings opt::collect_bindings(Node* node) {
+	Bindings bindings;
+	Collect collect(bindings);
+	collect.visit(node);
+	return bindings;
+}
+
+void opt::seal_lambdas(Node* node) {
+	Seal seal;
+	seal.visit(node);
+}
+
+bool opt::is_builtin(const Unit &unit, const Bindings &bindings, StringContainer* name) {
+	if (bindings.bindings(name) != 0 || bindings.assigned.count(name) != 0)
+		return false;
+
+	auto builtin = unit.ctx->builtins.find(name);
+	if (builtin == unit.ctx->builtins.end())
+		return false;
+
+	// identity, maps would be compared by content otherwise
+	auto val = unit.env->find(name);
+	if (val == nullptr || val->type != builtin->second.type)
+		return false;
+
+	if (val->type == type_t::Macro)
+		return val->_macro == builtin->second._macro;
+	return val->_map == builtin->second._map;
+}
+
+std::unordered_map<StringContainer*, unsigned int> opt::count_uses(Node* node) {
+	Uses uses;
+	uses.visit(node);
+	return uses.uses;
+}
+
+Node* opt::clone(Node* node, const Renames &renames) {
+	Clone clone(renames);
+	return clone.visit(node);
+}
+
+unsigned int opt::size(Node* node) {
+	Size size;
+	size.visit(node);
+	return size.size;
+}
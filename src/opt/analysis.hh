@@ -0,0 +1,57 @@
+#ifndef OPT_ANALYSIS_HH
+#define OPT_ANALYSIS_HH
+
+#include <unordered_map>
+#include <unordered_set>
+#include "passes.hh"
+#include "../include/ast.hh"
+
+namespace asbi::opt {
+
+	// where the names of a unit are bound (names are string constants,
+	// so they can be compared by pointer)
+	struct Bindings {
+		// declarations, destructuring placeholders and lambda arguments
+		std::unordered_map<StringContainer*, unsigned int> bound;
+		std::unordered_set<StringContainer*> assigned;
+
+		// `eval` and `__scope` can read and write any variable, no
+		// variable of a unit using them can be reasoned about. Under another
+		// name (e.g. a parameter) they refuse the envs of the other units
+		// (see opt::Unit::sealed)
+		bool dynamic = false;
+
+		unsigned int bindings(StringContainer* name) const {
+			auto pos = bound.find(name);
+			return pos == bound.end() ? 0 : pos->second;
+		}
+
+		// bound exactly once and never assigned
+		bool is_single(StringContainer* name) const {
+			return bindings(name) == 1 && assigned.count(name) == 0;
+		}
+	};
+
+	Bindings collect_bindings(ast::Node*);
+
+	// the lambdas of a sealed unit (see opt::Unit::sealed) seal their envs
+	void seal_lambdas(ast::Node*);
+
+	// does `name` resolve to the builtin of that name, without the unit
+	// binding it anywhere?
+	bool is_builtin(const Unit&, const Bindings&, StringContainer* name);
+
+	// references to a name, bindings and assignments not counted
+	std::unordered_map<StringContainer*, unsigned int> count_uses(ast::Node*);
+
+	using Renames = std::unordered_map<StringContainer*, StringContainer*>;
+
+	// deep copy, variables (uses and bindings) in `renames` get their new name
+	ast::Node* clone(ast::Node*, const Renames& = {});
+
+	// number of nodes
+	unsigned int size(ast::Node*);
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "passes.hh"
+#include "scoped.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+
+/*
+ * Variables declared exactly once with a literal (after folding) and never
+ * assigned are replaced by that literal wherever the declaration has
+ * certainly been executed before: it precedes the use as a statement of the
+ * same or an enclosing scope. All other uses (a lambda defined before the
+ * declaration, ...) are left alone, they may see another variable of the
+ * same name at runtime. Declarations without uses left are removed.
+ */
+
+namespace {
+
+	class ConstProp: public opt::ScopedFold {
+	public:
+		ConstProp(opt::Unit &unit, const opt::Bindings &bindings): ScopedFold(unit, bindings) {}
+
+		Node* run(Node*);
+
+		Node* visit_variable(Variable*) override;
+		Node* visit_call(Call*) override;
+	protected:
+		bool declared(StringContainer*, Node*) override;
+	private:
+		std::unordered_map<StringContainer*, Value> constants;
+	};
+
+	class ConstPropPass: public opt::Pass {
+	public:
+		ConstPropPass(): Pass("constprop", 2) {}
+		Node* run(Node* node, opt::Unit &unit) override {
+			auto bindings = opt::collect_bindings(node);
+			if (bindings.dynamic)
+				return node;
+			unit.sealed = true;
+
+			ConstProp constprop(unit, bindings);
+			return constprop.run(node);
+		}
+	};
+
+}
+
+Node* ConstProp::run(Node* node) {
+	node = visit_unit(node);
+	if (constants.empty())
+		return node;
+
+	auto uses = opt::count_uses(node);
+	std::unordered_set<StringContainer*> dead;
+	for (auto [name, val]: constants)
+		if (uses[name] == 0)
+			dead.insert(name);
+
+	return dead.empty() ? node : opt::remove_decls(ctx, node, dead);
+}
+
+Node* ConstProp::visit_variable(Variable* node) {
+	if (constants.count(node->sc) == 0 || !is_visible(node->sc))
+		return node;
+
+	return opt::literal_node(constants[node->sc]);
+}
+
+bool ConstProp::declared(StringContainer* name, Node* val) {
+	Value constant;
+	if (bindings.assigned.count(name) != 0)
+		return false;
+	if (val == nullptr)
+		constant = Value::nil();
+	else if (!opt::literal_value(val, &constant))
+		return false;
+
+	constants[name] = constant;
+	return true;
+}
+
+// `len` of a literal
+Node* ConstProp::visit_call(Call* node) {
+	Visitor::visit_call(node);
+	auto var = dynamic_cast<Variable*>(node->callable);
+	if (var == nullptr || node->args.size() != 1 || var->sc->data != "len" || !opt::is_builtin(unit, bindings, var->sc))
+		return node;
+
+	Value val;
+	double len = 0;
+	auto arg = node->args[0];
+	if (opt::literal_value(arg, &val) && val.type == type_t::String) {
+		len = val._string->data.size();
+	} else if (auto list = dynamic_cast<List*>(arg); list != nullptr) {
+		for (auto elm: list->values)
+			if (!opt::literal_value(elm, &val))
+				return node;
+		len = list->values.size();
+	} else if (auto map = dynamic_cast<Map*>(arg); map != nullptr) {
+		// only keys usable as index count, see MapContainer::set()
+		for (auto [key, elm]: map->values) {
+			Value keyval;
+			unsigned int idx;
+			if (!opt::literal_value(key, &keyval) || !opt::literal_value(elm, &val))
+				return node;
+			if (keyval.asUint(&idx))
+				len = std::max(len, static_cast<double>(idx) + 1);
+		}
+	} else {
+		return node;
+	}
+
+	return new Number(len);
+}
+
+std::unique_ptr<opt::Pass> opt::constprop_pass() {
+	return std::make_unique<ConstPropPass>();
+}
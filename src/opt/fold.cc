@@ -0,0 +1,239 @@
+#include <string>
+#include "passes.hh"
+#include "fold.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+
+namespace {
+
+	class FoldPass: public opt::Pass {
+	public:
+		FoldPass(): Pass("fold", 1) {}
+		Node* run(Node* node, opt::Unit &unit) override {
+			opt::Fold fold(unit.ctx);
+			return fold.visit(node);
+		}
+		bool local() const override { return true; }
+	};
+
+	class Declares: public Visitor {
+	public:
+		bool found = false;
+		Node* visit_decl(VariableDecl* node) override { found = true; return node; }
+		Node* visit_destruct(DestructList* node) override { found = true; return node; }
+		Node* visit_lambda(Lambda* node) override { return node; }
+		Node* visit_if(If* node) override {
+			visit(node->cond);
+			return node;
+		}
+		Node* visit_for(For* node) override {
+			if (node->init) visit(node->init);
+			visit(node->cond);
+			if (node->inc) visit(node->inc);
+			return node;
+		}
+	};
+
+	class RemoveDecls: public opt::Fold {
+	public:
+		RemoveDecls(Context* ctx, const std::unordered_set<StringContainer*> &dead): Fold(ctx), dead(dead) {}
+		Node* visit_decl(VariableDecl* node) override {
+			auto &decls = node->decls;
+			for (auto it = decls.begin(); it != decls.end();) {
+				if (dead.count(it->first->sc) != 0) {
+					it = decls.erase(it);
+				} else {
+					if (it->second != nullptr)
+						it->second = visit(it->second);
+					++it;
+				}
+			}
+
+			if (!decls.empty())
+				return node;
+
+			return new Nil();
+		}
+	private:
+		const std::unordered_set<StringContainer*> &dead;
+	};
+
+}
+
+bool opt::literal_value(const Node* node, Value* val) {
+	if (dynamic_cast<const Nil*>(node) != nullptr) {
+		*val = Value::nil();
+	} else if (auto num = dynamic_cast<const Number*>(node); num != nullptr) {
+		*val = Value::number(num->value);
+	} else if (auto boolean = dynamic_cast<const Bool*>(node); boolean != nullptr) {
+		*val = Value::boolean(boolean->value);
+	} else if (auto str = dynamic_cast<const String*>(node); str != nullptr) {
+		*val = Value::string(str->sc);
+	} else if (auto sym = dynamic_cast<const Symbol*>(node); sym != nullptr) {
+		*val = Value::symbol(sym->sc);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// strings and symbols have to be string constants, not managed by the GC
+Node* opt::literal_node(Value val) {
+	switch (val.type) {
+	case type_t::Nil:    return new Nil();
+	case type_t::Bool:   return new Bool(val._boolean);
+	case type_t::Number: return new Number(val._number);
+	case type_t::String: return new String(val._string);
+	case type_t::Symbol: return new Symbol(val._string);
+	default:             return nullptr;
+	}
+}
+
+bool opt::declares(Node* node) {
+	Declares declares;
+	declares.visit(node);
+	return declares.found;
+}
+
+Node* opt::Fold::visit_infix(InfixOperator* node) {
+	Visitor::visit_infix(node);
+	return fold_infix(node);
+}
+
+Node* opt::Fold::visit_prefix(PrefxOperator* node) {
+	Visitor::visit_prefix(node);
+	Value a;
+	if (!literal_value(node->operand, &a))
+		return node;
+
+	Node* res = nullptr;
+	if (node->type == PrefxOperator::Neg && a.type == type_t::Number)
+		res = new Number(0.0 - a._number); // same as the `0 - x` executed otherwise
+	else if (node->type == PrefxOperator::Not && a.type == type_t::Bool)
+		res = new Bool(!a._boolean);
+	else
+		return node;
+
+	return res;
+}
+
+Node* opt::Fold::visit_if(If* node) {
+	Visitor::visit_if(node);
+	return fold_if(node);
+}
+
+Node* opt::Fold::visit_for(For* node) {
+	Visitor::visit_for(node);
+	return fold_for(node);
+}
+
+Node* opt::Fold::visit_block(Block* node) {
+	Visitor::visit_block(node);
+	return fold_block(node);
+}
+
+Node* opt::Fold::fold_infix(InfixOperator* node) {
+	Value a, b;
+	bool aconst = literal_value(node->lhs, &a);
+	bool bconst = literal_value(node->rhs, &b);
+
+	// `a & b` <-> `if a { b } else { false }`, `a | b` <-> `if a { true } else { b }`
+	if ((node->type == InfixOperator::And || node->type == InfixOperator::Or) && aconst && a.type == type_t::Bool) {
+		if (a._boolean == (node->type == InfixOperator::And))
+			return node->rhs;
+		return new Bool(a._boolean);
+	}
+
+	if (!aconst || !bconst)
+		return node;
+
+	bool numbers = a.type == type_t::Number && b.type == type_t::Number;
+	Node* res = nullptr;
+	switch (node->type) {
+	case InfixOperator::Add:
+		if (numbers) {
+			res = new Number(a._number + b._number);
+		} else if (a.type == type_t::String) {
+			std::string str = a._string->data + b.to_string(false);
+			res = new String(ctx->new_stringconstant(str));
+		}
+		break;
+	case InfixOperator::Sub:            if (numbers) res = new Number(a._number - b._number); break;
+	case InfixOperator::Mul:            if (numbers) res = new Number(a._number * b._number); break;
+	case InfixOperator::Div:            if (numbers) res = new Number(a._number / b._number); break;
+	case InfixOperator::Bigger:         if (numbers) res = new Bool(a._number > b._number);   break;
+	case InfixOperator::BiggerOrEqual:  if (numbers) res = new Bool(a._number >= b._number);  break;
+	case InfixOperator::Smaller:        if (numbers) res = new Bool(a._number < b._number);   break;
+	case InfixOperator::SmallerOrEqual: if (numbers) res = new Bool(a._number <= b._number);  break;
+	case InfixOperator::Equals:         res = new Bool(a == b);    break;
+	case InfixOperator::EqualsNot:      res = new Bool(!(a == b)); break;
+	case InfixOperator::And:
+	case InfixOperator::Or:
+		break;
+	}
+
+	// everything else fails at runtime, leave that to the vm
+	if (res == nullptr)
+		return node;
+
+	return res;
+}
+
+Node* opt::Fold::fold_if(If* node) {
+	auto cond = dynamic_cast<Bool*>(node->cond);
+	if (cond == nullptr)
+		return node;
+
+	// already reduced to the taken branch
+	if (cond->value && node->elsebody == nullptr && declares(node->ifbody))
+		return node;
+
+	auto taken = cond->value ? node->ifbody : node->elsebody;
+	if (taken == nullptr)
+		return new Nil();
+
+	// a branch declaring variables still needs its own scope
+	if (declares(taken))
+		return new If(new Bool(true), taken, nullptr);
+
+	return taken;
+}
+
+Node* opt::Fold::fold_for(For* node) {
+	auto cond = dynamic_cast<Bool*>(node->cond);
+	if (cond == nullptr || cond->value)
+		return node;
+
+	// only the initialization is ever executed
+	if (node->init == nullptr)
+		return new Nil();
+	return new Block({ node->init, new Nil() });
+}
+
+// literals not producing the value of the block are useless
+Node* opt::Fold::fold_block(Block* node) {
+	auto &exprs = node->exprs;
+	for (auto it = exprs.begin(); it != exprs.end() && it + 1 != exprs.end();) {
+		Value val;
+		if (literal_value(*it, &val))
+			it = exprs.erase(it);
+		else
+			++it;
+	}
+	if (exprs.size() != 1)
+		return node;
+
+	// a block does not open a scope, it is just its expression
+	return exprs[0];
+}
+
+Node* opt::remove_decls(Context* ctx, Node* node, const std::unordered_set<StringContainer*> &dead) {
+	RemoveDecls remove(ctx, dead);
+	return remove.visit(node);
+}
+
+std::unique_ptr<opt::Pass> opt::fold_pass() {
+	return std::make_unique<FoldPass>();
+}
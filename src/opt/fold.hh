@@ -0,0 +1,48 @@
+#ifndef OPT_FOLD_HH
+#define OPT_FOLD_HH
+
+#include <unordered_set>
+#include "../include/ast.hh"
+#include "../include/types.hh"
+
+namespace asbi::opt {
+
+	// Folds operators applied to literals and drops branches and loops
+	// whose condition is a constant. Other passes that create literals
+	// (constprop, ...) derive from it to fold what they produced.
+	class Fold: public ast::Visitor {
+	public:
+		explicit Fold(Context* ctx): ctx(ctx) {}
+
+		ast::Node* visit_infix(ast::InfixOperator*) override;
+		ast::Node* visit_prefix(ast::PrefxOperator*) override;
+		ast::Node* visit_if(ast::If*) override;
+		ast::Node* visit_for(ast::For*) override;
+		ast::Node* visit_block(ast::Block*) override;
+	protected:
+		Context* ctx;
+
+		// the folding part of the visit_*() above, children already visited
+		ast::Node* fold_infix(ast::InfixOperator*);
+		ast::Node* fold_if(ast::If*);
+		ast::Node* fold_for(ast::For*);
+		ast::Node* fold_block(ast::Block*);
+	};
+
+	// literal node (nil, bool, number, string, symbol) -> value
+	bool literal_value(const ast::Node*, Value*);
+
+	// value -> literal node, nullptr for values without literal syntax
+	ast::Node* literal_node(Value);
+
+	// can evaluating the node declare variables in the scope it runs in?
+	// (lambda bodies and if/for bodies get their own scope)
+	bool declares(ast::Node*);
+
+	// removes the declarations of `dead` (and their values, which must be
+	// free of side effects), folding what becomes empty
+	ast::Node* remove_decls(Context*, ast::Node*, const std::unordered_set<StringContainer*> &dead);
+
+}
+
+#endif
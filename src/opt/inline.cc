@@ -0,0 +1,214 @@
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "passes.hh"
+#include "scoped.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+
+/*
+ * Calls of small lambdas are replaced by their body. The callee has to be a
+ * variable declared exactly once with a lambda and never assigned, and its
+ * declaration has to be certainly executed before the call (see ScopedFold).
+ * The arguments are declared as fresh variables in the scope of the call,
+ * in reverse order, as that is the order calls evaluate them in:
+ *
+ *     f := (a, b) -> a * b; ... f(x, y)
+ *  => ... { b#2 := y, a#1 := x; a#1 * b#2 }
+ *
+ * Lambda literals called right away are inlined the same way.
+ *
+ * Bodies declaring variables or containing lambdas are not inlined, all
+ * their other variables have to resolve to the same binding at the call:
+ * either one the unit does not bind at all or one bound once and certainly
+ * declared when the lambda is created as well as at the call. This also
+ * rules out recursion. Declarations of lambdas without calls left are
+ * removed.
+ */
+
+namespace {
+
+	struct Callee {
+		Lambda* lambda;
+		std::vector<StringContainer*> free; // have to be visible at the call
+		std::vector<StringContainer*> temps; // declared by calls inlined into it
+	};
+
+	// what a lambda body binds and references
+	class Scan: public Visitor {
+	public:
+		std::unordered_set<StringContainer*> declared, referenced;
+		bool lambdas = false;
+
+		Node* visit_variable(Variable* node) override {
+			referenced.insert(node->sc);
+			return node;
+		}
+		Node* visit_decl(VariableDecl* node) override {
+			for (auto [var, val]: node->decls)
+				declared.insert(var->sc);
+			return Visitor::visit_decl(node);
+		}
+		Node* visit_destruct(DestructList* node) override {
+			for (auto lhs: node->lhss)
+				if (auto var = dynamic_cast<Variable*>(lhs); var != nullptr)
+					declared.insert(var->sc);
+			return Visitor::visit_destruct(node);
+		}
+		Node* visit_assign_variable(AssignVariable* node) override {
+			referenced.insert(node->var->sc);
+			return Visitor::visit_assign_variable(node);
+		}
+		Node* visit_lambda(Lambda* node) override {
+			lambdas = true;
+			return node;
+		}
+	};
+
+	class Inliner: public opt::ScopedFold {
+	public:
+		Inliner(opt::Unit &unit, const opt::Bindings &bindings):
+			ScopedFold(unit, bindings), params(unit.ctx->optimizer.params) {}
+
+		Node* run(Node*);
+
+		Node* visit_call(Call*) override;
+	protected:
+		bool declared(StringContainer*, Node*) override;
+	private:
+		const opt::Params &params;
+		std::unordered_map<StringContainer*, Callee> callees;
+		std::unordered_set<StringContainer*> inlined; // declarations to remove if unused
+		std::unordered_set<StringContainer*> temps; // argument variables introduced
+		unsigned int growth = 0, ntemps = 0;
+
+		StringContainer* temp(StringContainer*);
+		bool inlinable(Lambda*, Callee*);
+	};
+
+	class InlinePass: public opt::Pass {
+	public:
+		InlinePass(): Pass("inline", 2) {}
+		Node* run(Node* node, opt::Unit &unit) override {
+			auto bindings = opt::collect_bindings(node);
+			if (bindings.dynamic)
+				return node;
+			unit.sealed = true;
+
+			Inliner inliner(unit, bindings);
+			return inliner.run(node);
+		}
+	};
+
+}
+
+Node* Inliner::run(Node* node) {
+	node = visit_unit(node);
+	if (inlined.empty())
+		return node;
+
+	auto uses = opt::count_uses(node);
+	std::unordered_set<StringContainer*> dead;
+	for (auto name: inlined)
+		if (uses[name] == 0)
+			dead.insert(name);
+
+	return dead.empty() ? node : opt::remove_decls(ctx, node, dead);
+}
+
+StringContainer* Inliner::temp(StringContainer* name) {
+	std::string str = name->data.substr(0, name->data.find('#')) + "#" + std::to_string(++ntemps);
+	auto res = ctx->new_stringconstant(str);
+	temps.insert(res);
+	return res;
+}
+
+// can calls of the lambda be inlined where it is created?
+bool Inliner::inlinable(Lambda* lambda, Callee* callee) {
+	if (opt::size(lambda->body) > params.inline_size)
+		return false;
+
+	Scan scan;
+	scan.visit(lambda->body);
+	if (scan.lambdas)
+		return false;
+
+	// bodies with calls inlined already declare argument variables
+	*callee = Callee{ lambda, {}, {} };
+	for (auto var: scan.declared) {
+		if (temps.count(var) == 0)
+			return false;
+		callee->temps.push_back(var);
+	}
+
+	for (auto var: scan.referenced) {
+		if (temps.count(var) != 0 || std::find(lambda->argnames.begin(), lambda->argnames.end(), var) != lambda->argnames.end())
+			continue;
+
+		auto n = bindings.bindings(var);
+		if (n == 0)
+			continue;
+		if (n != 1 || !is_visible(var))
+			return false;
+		callee->free.push_back(var);
+	}
+	return true;
+}
+
+// every variable declared once is visible, only lambdas are callees
+bool Inliner::declared(StringContainer* name, Node* val) {
+	Callee callee;
+	auto lambda = dynamic_cast<Lambda*>(val);
+	if (lambda != nullptr && bindings.assigned.count(name) == 0 && inlinable(lambda, &callee))
+		callees[name] = callee;
+	return true;
+}
+
+Node* Inliner::visit_call(Call* node) {
+	Callee callee;
+	auto var = dynamic_cast<Variable*>(node->callable);
+	auto lambda = dynamic_cast<Lambda*>(node->callable);
+	if (var != nullptr && is_visible(var->sc) && callees.count(var->sc) != 0) {
+		callee = callees[var->sc];
+		inlined.insert(var->sc);
+	} else if (lambda == nullptr || !inlinable(lambda, &callee)) {
+		return Visitor::visit_call(node);
+	}
+
+	auto size = opt::size(callee.lambda->body);
+	bool inlinable = callee.lambda->argnames.size() == node->args.size()
+		&& growth + size <= params.inline_growth;
+	for (auto free: callee.free)
+		inlinable = inlinable && is_visible(free);
+
+	if (!inlinable)
+		return Visitor::visit_call(node);
+
+	opt::Renames renames;
+	std::vector<std::pair<Variable*, Node*>> decls;
+	for (std::size_t i = node->args.size(); i-- > 0;) {
+		auto argname = callee.lambda->argnames[i];
+		renames[argname] = temp(argname);
+		decls.push_back(std::make_pair(new Variable(renames[argname]), node->args[i]));
+	}
+	for (auto name: callee.temps)
+		renames[name] = temp(name);
+
+	std::vector<Node*> exprs;
+	if (!decls.empty())
+		exprs.push_back(new VariableDecl(decls));
+	for (auto expr: callee.lambda->body->exprs)
+		exprs.push_back(opt::clone(expr, renames));
+	if (callee.lambda->body->exprs.empty())
+		exprs.push_back(new Nil());
+
+	growth += size;
+	return visit(new Block(exprs));
+}
+
+std::unique_ptr<opt::Pass> opt::inline_pass() {
+	return std::make_unique<InlinePass>();
+}
@@ -0,0 +1,276 @@
+#include <string>
+#include <unordered_set>
+#include "passes.hh"
+#include "fold.hh"
+#include "analysis.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+
+/*
+ * Loop-invariant code motion: pure expressions of a `for` loop whose inputs
+ * do not change while it runs are evaluated once, after the initialization,
+ * and kept in fresh variables:
+ *
+ *     for i := 0; i < len(arr); i = i + 1 { sum = sum + arr.(n * 2) }
+ *  => { i := 0, licm#1 := len(arr);
+ *       if i < licm#1 { licm#2 := arr.(n * 2); for i < licm#1; i = i + 1 { sum = sum + licm#2 } } }
+ *
+ * Only expressions evaluated whenever their part of the loop runs are moved
+ * (not the right side of `&`/`|`, not inside nested bodies), so hoisting
+ * can only make an error happen earlier in the same iteration. Expressions
+ * of the body and increment are only moved if the condition is free of side
+ * effects, it is evaluated once more to guard them.
+ */
+
+namespace {
+
+	const char* const pure_builtins[] = { "len", "typeof", "mod", "toInt" };
+
+	bool pure_call(const opt::Unit &unit, const opt::Bindings &bindings, Call* node) {
+		auto var = dynamic_cast<Variable*>(node->callable);
+		if (var == nullptr || !opt::is_builtin(unit, bindings, var->sc))
+			return false;
+
+		for (auto name: pure_builtins)
+			if (var->sc->data == name)
+				return true;
+		return false;
+	}
+
+	// what running (a part of) a loop can change
+	struct Effects {
+		std::unordered_set<StringContainer*> declared, assigned;
+		bool map_writes = false;
+		bool calls = false; // calls of anything but pure builtins
+
+		// can the contents of maps change?
+		bool writes() const { return map_writes || calls; }
+		bool none() const { return declared.empty() && assigned.empty() && !writes(); }
+	};
+
+	class Licm: public opt::Fold {
+	public:
+		Licm(opt::Unit &unit, const opt::Bindings &bindings):
+			Fold(unit.ctx), unit(unit), bindings(bindings) {}
+
+		Node* visit_for(For*) override;
+	private:
+		using Decls = std::vector<std::pair<Variable*, Node*>>;
+
+		opt::Unit &unit;
+		const opt::Bindings &bindings;
+		unsigned int ntemps = 0;
+
+		Effects effects(const std::vector<Node*>&) const;
+		bool invariant(Node*, const Effects&) const;
+		void hoist(Node* &slot, const Effects&, Decls&);
+	};
+
+	class Scan: public Visitor {
+	public:
+		Scan(const opt::Unit &unit, const opt::Bindings &bindings, Effects &fx):
+			unit(unit), bindings(bindings), fx(fx) {}
+
+		Node* visit_decl(VariableDecl* node) override {
+			for (auto [var, val]: node->decls)
+				fx.declared.insert(var->sc);
+			return Visitor::visit_decl(node);
+		}
+		Node* visit_destruct(DestructList* node) override {
+			for (auto lhs: node->lhss)
+				if (auto var = dynamic_cast<Variable*>(lhs); var != nullptr)
+					fx.declared.insert(var->sc);
+			return Visitor::visit_destruct(node);
+		}
+		Node* visit_assign_variable(AssignVariable* node) override {
+			fx.assigned.insert(node->var->sc);
+			return Visitor::visit_assign_variable(node);
+		}
+		Node* visit_assign_access(AssignAccess* node) override {
+			fx.map_writes = true;
+			return Visitor::visit_assign_access(node);
+		}
+		Node* visit_lambda(Lambda* node) override {
+			for (auto argname: node->argnames)
+				fx.declared.insert(argname);
+			return Visitor::visit_lambda(node);
+		}
+		Node* visit_call(Call* node) override {
+			if (!pure_call(unit, bindings, node))
+				fx.calls = true;
+			return Visitor::visit_call(node);
+		}
+	private:
+		const opt::Unit &unit;
+		const opt::Bindings &bindings;
+		Effects &fx;
+	};
+
+	class LicmPass: public opt::Pass {
+	public:
+		LicmPass(): Pass("licm", 2) {}
+		Node* run(Node* node, opt::Unit &unit) override {
+			auto bindings = opt::collect_bindings(node);
+			if (bindings.dynamic)
+				return node;
+			unit.sealed = true;
+
+			Licm licm(unit, bindings);
+			return licm.visit(node);
+		}
+	};
+
+}
+
+Effects Licm::effects(const std::vector<Node*> &nodes) const {
+	Effects fx;
+	Scan scan(unit, bindings, fx);
+	for (auto node: nodes)
+		if (node != nullptr)
+			scan.visit(node);
+	return fx;
+}
+
+bool Licm::invariant(Node* node, const Effects &fx) const {
+	Value val;
+	if (opt::literal_value(node, &val))
+		return true;
+
+	if (auto var = dynamic_cast<Variable*>(node); var != nullptr) {
+		auto name = var->sc;
+		if (fx.declared.count(name) != 0 || fx.assigned.count(name) != 0)
+			return false;
+		if (!fx.calls)
+			return true;
+
+		// a lambda called in the loop can assign anything it can see
+		if (bindings.bindings(name) == 0)
+			return opt::is_builtin(unit, bindings, name);
+		return bindings.assigned.count(name) == 0;
+	}
+
+	if (auto infix = dynamic_cast<InfixOperator*>(node); infix != nullptr) {
+		// strings append maps printed, maps are compared by content
+		auto reads = infix->type == InfixOperator::Add
+			|| infix->type == InfixOperator::Equals
+			|| infix->type == InfixOperator::EqualsNot;
+		return !(reads && fx.writes()) && invariant(infix->lhs, fx) && invariant(infix->rhs, fx);
+	}
+
+	if (auto prefx = dynamic_cast<PrefxOperator*>(node); prefx != nullptr)
+		return invariant(prefx->operand, fx);
+
+	if (auto acs = dynamic_cast<Access*>(node); acs != nullptr)
+		return !fx.writes() && invariant(acs->left, fx) && invariant(acs->right, fx);
+
+	if (auto call = dynamic_cast<Call*>(node); call != nullptr) {
+		if (!pure_call(unit, bindings, call))
+			return false;
+
+		auto name = static_cast<Variable*>(call->callable)->sc;
+		if (name->data == "len" && fx.writes())
+			return false;
+
+		for (auto arg: call->args)
+			if (!invariant(arg, fx))
+				return false;
+		return true;
+	}
+
+	return false;
+}
+
+// replace the largest invariant expressions evaluated whenever `slot` is
+void Licm::hoist(Node* &slot, const Effects &fx, Decls &decls) {
+	Value val;
+	auto node = slot;
+	if (!opt::literal_value(node, &val) && dynamic_cast<Variable*>(node) == nullptr && invariant(node, fx)) {
+		std::string str = "licm#" + std::to_string(++ntemps);
+		auto name = ctx->new_stringconstant(str);
+		decls.push_back(std::make_pair(new Variable(name), node));
+		slot = new Variable(name);
+		return;
+	}
+
+	if (auto infix = dynamic_cast<InfixOperator*>(node); infix != nullptr) {
+		hoist(infix->lhs, fx, decls);
+		if (infix->type != InfixOperator::And && infix->type != InfixOperator::Or)
+			hoist(infix->rhs, fx, decls);
+	} else if (auto prefx = dynamic_cast<PrefxOperator*>(node); prefx != nullptr) {
+		hoist(prefx->operand, fx, decls);
+	} else if (auto acs = dynamic_cast<Access*>(node); acs != nullptr) {
+		hoist(acs->left, fx, decls);
+		hoist(acs->right, fx, decls);
+	} else if (auto call = dynamic_cast<Call*>(node); call != nullptr) {
+		for (auto &arg: call->args)
+			hoist(arg, fx, decls);
+		hoist(call->callable, fx, decls);
+	} else if (auto decl = dynamic_cast<VariableDecl*>(node); decl != nullptr) {
+		for (auto &[var, val]: decl->decls)
+			if (val != nullptr)
+				hoist(val, fx, decls);
+	} else if (auto destruct = dynamic_cast<DestructList*>(node); destruct != nullptr) {
+		hoist(destruct->rhs, fx, decls);
+	} else if (auto assign = dynamic_cast<AssignVariable*>(node); assign != nullptr) {
+		hoist(assign->val, fx, decls);
+	} else if (auto assign = dynamic_cast<AssignAccess*>(node); assign != nullptr) {
+		hoist(assign->acs->left, fx, decls);
+		hoist(assign->acs->right, fx, decls);
+		hoist(assign->val, fx, decls);
+	} else if (auto block = dynamic_cast<Block*>(node); block != nullptr) {
+		for (auto &expr: block->exprs)
+			hoist(expr, fx, decls);
+	} else if (auto ifnode = dynamic_cast<If*>(node); ifnode != nullptr) {
+		hoist(ifnode->cond, fx, decls);
+	} else if (auto loop = dynamic_cast<For*>(node); loop != nullptr) {
+		if (loop->init) hoist(loop->init, fx, decls);
+		hoist(loop->cond, fx, decls);
+	} else if (auto list = dynamic_cast<List*>(node); list != nullptr) {
+		for (auto &val: list->values)
+			hoist(val, fx, decls);
+	} else if (auto map = dynamic_cast<Map*>(node); map != nullptr) {
+		for (auto &[key, val]: map->values) {
+			hoist(key, fx, decls);
+			hoist(val, fx, decls);
+		}
+	}
+}
+
+// inner loops first, their hoisted expressions may move further out
+Node* Licm::visit_for(For* node) {
+	auto res = Fold::visit_for(node);
+	if (res != node || opt::declares(node->cond) || (node->inc && opt::declares(node->inc)))
+		return res;
+
+	auto fx = effects({ node->cond, node->body, node->inc });
+	Decls before, guarded;
+	hoist(node->cond, fx, before);
+	if (effects({ node->cond }).none()) {
+		hoist(node->body, fx, guarded);
+		if (node->inc) hoist(node->inc, fx, guarded);
+	}
+
+	if (before.empty() && guarded.empty())
+		return node;
+
+	std::vector<Node*> exprs;
+	if (node->init) {
+		exprs.push_back(node->init);
+		node->init = nullptr;
+	}
+	if (!before.empty())
+		exprs.push_back(new VariableDecl(before));
+	if (guarded.empty()) {
+		exprs.push_back(node);
+	} else {
+		std::vector<Node*> body = { new VariableDecl(guarded), node };
+		exprs.push_back(new If(opt::clone(node->cond), new Block(body), nullptr));
+	}
+	return new Block(exprs);
+}
+
+std::unique_ptr<opt::Pass> opt::licm_pass() {
+	return std::make_unique<LicmPass>();
+}
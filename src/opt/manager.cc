@@ -0,0 +1,154 @@
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+#include "passes.hh"
+#include "../include/ast.hh"
+
+using namespace asbi;
+
+opt::PassManager::PassManager() {
+	passes.push_back(fold_pass());
+	passes.push_back(inline_pass());
+	passes.push_back(sroa_pass());
+	passes.push_back(constprop_pass());
+	passes.push_back(licm_pass());
+	passes.push_back(types_pass()); // last, it only annotates
+}
+
+// steps of the code generation switched on and off like passes: the
+// lowest level they run at
+static const std::pair<const char*, unsigned int> codegen_table[] = {
+	{ "ir",       2 }, // ir/, instead of ast::Node::to_vmops()
+	{ "peephole", 1 }, // opt/peephole.cc
+	{ "lazy",     1 }, // lambda bodies compiled on their first call
+};
+
+static const std::pair<const char*, unsigned int opt::Params::*> param_table[] = {
+	{ "inline-size",   &opt::Params::inline_size },
+	{ "inline-growth", &opt::Params::inline_growth },
+};
+
+bool opt::PassManager::set_param(const std::string &name, unsigned int value) {
+	for (auto [pname, member]: param_table) {
+		if (name == pname) {
+			params.*member = value;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<std::string> opt::PassManager::param_names() const {
+	std::vector<std::string> names;
+	for (auto [pname, member]: param_table)
+		names.push_back(pname);
+	return names;
+}
+
+bool opt::PassManager::set_enabled(const std::string &name, bool enabled) {
+	auto pos = std::find_if(passes.begin(), passes.end(), [&](auto &pass) { return name == pass->name; });
+	auto step = std::find_if(std::begin(codegen_table), std::end(codegen_table), [&](auto &step) { return name == step.first; });
+	if (pos == passes.end() && step == std::end(codegen_table))
+		return false;
+
+	overrides.push_back(std::make_pair(name, enabled));
+	return true;
+}
+
+bool opt::PassManager::is_enabled(const Pass* pass) const {
+	// last -f/-fno- given wins
+	for (auto rit = overrides.rbegin(); rit != overrides.rend(); ++rit)
+		if (rit->first == pass->name)
+			return rit->second;
+
+	return pass->level <= level;
+}
+
+bool opt::PassManager::is_enabled(const char* step) const {
+	for (auto rit = overrides.rbegin(); rit != overrides.rend(); ++rit)
+		if (rit->first == step)
+			return rit->second;
+
+	for (auto [name, lowest]: codegen_table)
+		if (strcmp(name, step) == 0)
+			return lowest <= level;
+	return false;
+}
+
+std::vector<std::string> opt::PassManager::pass_names() const {
+	std::vector<std::string> names;
+	for (auto &pass: passes)
+		names.push_back(pass->name);
+	for (auto [name, lowest]: codegen_table)
+		names.push_back(name);
+	return names;
+}
+
+std::string opt::PassManager::config() const {
+	std::string config = "-O" + std::to_string(level);
+	for (auto &pass: passes)
+		config += std::string(is_enabled(pass.get()) ? " -f" : " -fno-") + pass->name;
+	for (auto [name, lowest]: codegen_table)
+		config += std::string(is_enabled(name) ? " -f" : " -fno-") + name;
+	for (auto [pname, member]: param_table)
+		config += std::string(" ") + pname + "=" + std::to_string(params.*member);
+	return config;
+}
+
+ast::Node* opt::PassManager::run(ast::Node* node, Unit &unit) {
+	for (auto &pass: passes) {
+		if (!is_enabled(pass.get()))
+			continue;
+
+		node = timed(pass->name, [&]() { return pass->run(node, unit); });
+	}
+	return node;
+}
+
+void opt::PassManager::record(const char* phase, std::chrono::duration<double, std::milli> duration) {
+	for (auto &timing: timings) {
+		if (timing.name == phase) {
+			timing.total += duration;
+			timing.runs += 1;
+			return;
+		}
+	}
+	timings.push_back(Timing{ phase, duration, 1 });
+}
+
+void opt::PassManager::report(std::ostream &os) const {
+	std::chrono::duration<double, std::milli> total(0);
+	for (auto &timing: timings)
+		total += timing.total;
+
+	os << "==asbi==: pass timings (-O" << level << ")\n";
+	os << std::fixed << std::setprecision(3);
+	for (auto &timing: timings) {
+		os << "\t" << std::left << std::setw(16) << timing.name
+			<< std::right << std::setw(6) << timing.runs << " runs "
+			<< std::setw(10) << timing.total.count() << " ms "
+			<< std::setw(6) << std::setprecision(1) << (total.count() > 0 ? 100.0 * timing.total / total : 0.0) << " %\n"
+			<< std::setprecision(3);
+	}
+	os << "\t" << std::left << std::setw(27) << "total" << std::right << std::setw(10) << total.count() << " ms\n";
+}
+
+bool opt::PassManager::lazy_enabled() const {
+	if (!is_enabled("lazy") || is_enabled("ir"))
+		return false;
+
+	for (auto &pass: passes)
+		if (is_enabled(pass.get()) && !pass->local())
+			return false;
+	return true;
+}
+
+void opt::PassManager::report_peephole(std::ostream &os) const {
+	os << "==asbi==: peephole\n";
+	unsigned long total = 0;
+	for (auto [pattern, hits]: peephole_hits) {
+		os << "\t" << std::left << std::setw(16) << pattern << std::right << std::setw(8) << hits << "\n";
+		total += hits;
+	}
+	os << "\t" << std::left << std::setw(16) << "total" << std::right << std::setw(8) << total << "\n";
+}
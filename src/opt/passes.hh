@@ -0,0 +1,148 @@
+#ifndef OPT_PASSES_HH
+#define OPT_PASSES_HH
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <chrono>
+#include <type_traits>
+#include <ostream>
+
+namespace ast { class Node; } // forward decl.
+
+namespace asbi {
+	class Context; // forward decl.
+	class Env;     // forward decl.
+	enum OpCode: uint64_t; // forward decl.
+};
+
+namespace asbi::opt {
+
+	// highest level accepted by -O<n>
+	constexpr unsigned int max_level = 2;
+
+	// one compilation unit: a file, an `eval` string or a repl line
+	struct Unit {
+		Context* ctx;
+		std::shared_ptr<Env> env; // env the top level will run in
+
+		// can code compiled later (repl lines, `eval`) see and change the
+		// top level variables of this unit?
+		bool open;
+
+		// did a pass or the IR reason about the variables of this unit
+		// (opt::Bindings::dynamic was false)? Its functions seal their envs
+		// then (SEAL_ENV), `eval` and `__scope` under another name refuse them
+		bool sealed = false;
+	};
+
+	// a named transformation of a whole compilation unit, returns the root
+	// of the transformed tree
+	class Pass {
+	public:
+		Pass(const char* name, unsigned int level): name(name), level(level) {}
+		virtual ~Pass() = default;
+		virtual ast::Node* run(ast::Node*, Unit&) = 0;
+		// works on single nodes, can run on a lambda body without the rest
+		// of the unit (see PassManager::lazy_enabled())
+		virtual bool local() const { return false; }
+
+		const char* const name;
+		const unsigned int level; // lowest -O level the pass runs at
+	};
+
+	// tuning knobs of the passes, --param <name>=<value>
+	struct Params {
+		unsigned int inline_size = 40;     // max. nodes of an inlined lambda body
+		unsigned int inline_growth = 2000; // max. nodes added by inlining per unit
+	};
+
+	class PassManager {
+	public:
+		PassManager();
+
+		unsigned int level = 1;
+		bool time_passes = false;
+		bool dump_types = false; // print what opt/types.cc inferred
+		bool dump_ir = false;    // print the IR of every function (see ir/)
+		bool dump_peephole = false; // print how often each peephole pattern matched
+		Params params;
+
+		// returns false for unknown parameters
+		bool set_param(const std::string &name, unsigned int value);
+		std::vector<std::string> param_names() const;
+
+		// -f<name>/-fno-<name>, returns false for unknown passes
+		bool set_enabled(const std::string &name, bool enabled);
+		bool is_enabled(const Pass*) const;
+		// steps of the code generation: "ir", "peephole", "lazy"
+		bool is_enabled(const char* step) const;
+		// compile lambda bodies on their first call? only if all passes are local
+		bool lazy_enabled() const;
+		std::vector<std::string> pass_names() const;
+		// what the generated bytecode depends on: the level, the passes and
+		// steps enabled and the params (see BytecodeCache)
+		std::string config() const;
+
+		ast::Node* run(ast::Node*, Unit&);
+
+		// time any other compilation phase (parsing, codegen, ...) for --time-passes
+		template<typename Fn> auto timed(const char* phase, Fn fn) {
+			if (!time_passes)
+				return fn();
+
+			auto start = std::chrono::steady_clock::now();
+			if constexpr (std::is_void_v<decltype(fn())>) {
+				fn();
+				record(phase, std::chrono::steady_clock::now() - start);
+			} else {
+				auto res = fn();
+				record(phase, std::chrono::steady_clock::now() - start);
+				return res;
+			}
+		}
+
+		void report(std::ostream&) const;
+		void report_peephole(std::ostream&) const;
+
+		// hits per pattern of opt/peephole.cc, summed over all functions
+		std::vector<std::pair<const char*, unsigned long>> peephole_hits;
+	private:
+		struct Timing {
+			std::string name;
+			std::chrono::duration<double, std::milli> total;
+			unsigned long runs;
+		};
+
+		std::vector<std::unique_ptr<Pass>> passes; // in pipeline order
+		std::vector<std::pair<std::string, bool>> overrides;
+		std::vector<Timing> timings;
+
+		void record(const char*, std::chrono::duration<double, std::milli>);
+	};
+
+	// opt/fold.cc
+	std::unique_ptr<Pass> fold_pass();
+
+	// opt/constprop.cc
+	std::unique_ptr<Pass> constprop_pass();
+
+	// opt/inline.cc
+	std::unique_ptr<Pass> inline_pass();
+
+	// opt/sroa.cc
+	std::unique_ptr<Pass> sroa_pass();
+
+	// opt/licm.cc
+	std::unique_ptr<Pass> licm_pass();
+
+	// opt/types.cc
+	std::unique_ptr<Pass> types_pass();
+
+	// opt/peephole.cc, rewrites the bytecode of one function after codegen
+	void peephole(std::vector<OpCode>&, std::vector<std::pair<const char*, unsigned long>> &hits);
+
+}
+
+#endif
@@ -0,0 +1,322 @@
+#include <cstring>
+#include <cassert>
+#include "passes.hh"
+#include "../include/vm.hh"
+
+using namespace asbi;
+
+/*
+ * Peephole optimizer on the bytecode of one function, after codegen (AST or
+ * ir/). The ops are decoded into instructions with their jump targets as
+ * instruction indices, rewritten until nothing matches anymore and encoded
+ * again:
+ *
+ *     GOTO L1 ... L1: GOTO L2          => GOTO L2 ... (jumps to jumps)
+ *     IF_TRUE_GOTO L1; GOTO L2; L1:    => IF_FALSE_GOTO L2; L1:
+ *     GOTO L1; L1:                     => L1:
+ *     GOTO L1; <no jump target>...     => GOTO L1 (unreachable code)
+ *     PUSH_TRUE; IF_TRUE_GOTO L1       => GOTO L1
+ *     PUSH_NIL; POP                    => (any push without side effects)
+ *     DECL x; POP                      => DECL_POP x
+ *     SET x; POP                       => SET_POP x
+ *     PUSH_NUMBER 0; LOOKUP x; SUB     => LOOKUP x; NEG
+ *     PUSH_NUMBER 0; PUSH_NUMBER 3; SUB  => PUSH_NUMBER -3
+ *     ENTER_SCOPE; LOOKUP x; LEAVE_SCOPE => LOOKUP x (scopes nothing is declared in)
+ *
+ * Only the first instruction of a pattern may be a jump target.
+ */
+
+namespace {
+
+	struct Insn {
+		OpCode op;
+		std::vector<OpCode> imms;
+		std::size_t target; // instruction index, for jumps
+		bool dead;
+	};
+
+	enum Pattern {
+		THREAD, INVERT, GOTO_NEXT, UNREACHABLE, CONST_BRANCH,
+		PUSH_POP, DECL_SET_POP, NEGATE, EMPTY_SCOPE,
+		NPATTERNS
+	};
+
+	const char* const pattern_names[NPATTERNS] = {
+		"thread-jumps", "invert-branch", "goto-next", "unreachable", "const-branch",
+		"push-pop", "decl-set-pop", "negate", "empty-scope",
+	};
+
+	bool is_jump(OpCode op) {
+		return op == GOTO || op == IF_TRUE_GOTO || op == IF_FALSE_GOTO || op == IF_NOT_NUMBER_GOTO;
+	}
+
+	// index of the immediate holding the jump target
+	std::size_t target_imm(OpCode op) {
+		return op == IF_NOT_NUMBER_GOTO ? 1 : 0;
+	}
+
+	// pushes one value and does nothing else
+	bool pure_push(OpCode op) {
+		switch (op) {
+		case PUSH_NUMBER: case PUSH_BOOLEAN: case PUSH_TRUE: case PUSH_FALSE: case PUSH_NIL:
+		case PUSH_SYMBOL: case PUSH_STRING: case PUSH_LAMBDA: case LOAD_SLOT: case CLONE_MAP:
+		case LOOKUP_GLOBAL:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// can run in an extra, empty scope without noticing it
+	bool scope_neutral(OpCode op) {
+		switch (op) {
+		case PUSH_NUMBER: case PUSH_BOOLEAN: case PUSH_TRUE: case PUSH_FALSE: case PUSH_NIL:
+		case PUSH_SYMBOL: case PUSH_STRING: case POP:
+		case LOOKUP: case LOOKUP_GLOBAL: case SET: case SET_POP:
+		case ADD: case SUB: case MUL: case DIV:
+		case EQUALS: case EQUALS_NOT:
+		case SMALLER: case BIGGER: case SMALLER_OR_EQUAL: case BIGGER_OR_EQUAL:
+		case ADD_NUM: case SUB_NUM: case MUL_NUM: case DIV_NUM:
+		case SMALLER_NUM: case BIGGER_NUM: case SMALLER_OR_EQUAL_NUM: case BIGGER_OR_EQUAL_NUM:
+		case NEG: case NEG_NUM: case NOT:
+		case MAKE_MAP: case MAKE_MAP_ARRLIKE: case CLONE_MAP: case GET_MAP_VAL: case SET_MAP_VAL:
+		case LOAD_SLOT: case STORE_SLOT:
+			return true;
+		default:
+			// PUSH_LAMBDA would capture the scope, CALL could be `__scope`
+			return false;
+		}
+	}
+
+	double number(OpCode imm) {
+		double d;
+		memcpy(&d, &imm, sizeof(d));
+		return d;
+	}
+
+	OpCode number_imm(double d) {
+		OpCode imm;
+		memcpy(&imm, &d, sizeof(d));
+		return imm;
+	}
+
+	class Peephole {
+	public:
+		Peephole(std::vector<OpCode> &ops) {
+			std::vector<std::size_t> index(ops.size() + 1);
+			for (std::size_t pc = 0; pc < ops.size();) {
+				index[pc] = insns.size();
+				Insn insn{ ops[pc++], {}, 0, false };
+				for (auto n = immediates(insn.op); n > 0; n--)
+					insn.imms.push_back(ops[pc++]);
+				insns.push_back(std::move(insn));
+			}
+			index[ops.size()] = insns.size();
+
+			for (auto &insn: insns)
+				if (is_jump(insn.op))
+					insn.target = index[static_cast<std::size_t>(insn.imms[target_imm(insn.op)])];
+		}
+
+		void run() {
+			targeted.assign(insns.size() + 1, 0);
+			for (auto &insn: insns)
+				if (is_jump(insn.op))
+					targeted[insn.target]++;
+
+			bool changed = true;
+			while (changed) {
+				changed = false;
+				for (std::size_t i = 0; i < insns.size(); i++)
+					if (!insns[i].dead && rewrite(i))
+						changed = true;
+			}
+		}
+
+		void encode(std::vector<OpCode> &ops) {
+			// dead instructions are at the position of the next live one
+			std::vector<std::size_t> pcs(insns.size() + 1);
+			std::size_t pc = 0;
+			for (std::size_t i = 0; i < insns.size(); i++) {
+				pcs[i] = pc;
+				if (!insns[i].dead)
+					pc += 1 + insns[i].imms.size();
+			}
+			pcs[insns.size()] = pc;
+
+			ops.clear();
+			ops.reserve(pc);
+			for (auto &insn: insns) {
+				if (insn.dead)
+					continue;
+
+				if (is_jump(insn.op))
+					insn.imms[target_imm(insn.op)] = static_cast<OpCode>(pcs[insn.target]);
+				ops.push_back(insn.op);
+				ops.insert(ops.end(), insn.imms.begin(), insn.imms.end());
+			}
+			assert(ops.size() == pc);
+		}
+
+		unsigned long hits[NPATTERNS] = {};
+	private:
+		std::vector<Insn> insns;
+		std::vector<unsigned int> targeted; // jumps to each live instruction
+
+		// first live instruction at or after `i`
+		std::size_t live(std::size_t i) const {
+			while (i < insns.size() && insns[i].dead)
+				i++;
+			return i;
+		}
+
+		std::size_t next(std::size_t i) const {
+			return live(i + 1);
+		}
+
+		bool is(std::size_t i, OpCode op) const {
+			return i < insns.size() && insns[i].op == op;
+		}
+
+		// `i` can be the second or later instruction of a pattern
+		bool inner(std::size_t i) const {
+			return i < insns.size() && targeted[i] == 0;
+		}
+
+		// a removed jump target moves to the next live instruction
+		std::size_t target(Insn &insn) {
+			return insn.target = live(insn.target);
+		}
+
+		void retarget(Insn &insn, std::size_t t) {
+			targeted[target(insn)]--;
+			targeted[insn.target = t]++;
+		}
+
+		// keeps `targeted` up to date instead of counting again after every
+		// rewrite, which made long functions quadratic
+		void kill(std::size_t i) {
+			insns[i].dead = true;
+			if (is_jump(insns[i].op))
+				targeted[target(insns[i])]--;
+			if (targeted[i] > 0) {
+				targeted[next(i)] += targeted[i];
+				targeted[i] = 0;
+			}
+		}
+
+		bool rewrite(std::size_t i) {
+			auto &insn = insns[i];
+			auto j = next(i);
+
+			if (is_jump(insn.op)) {
+				// jumps to an unconditional jump go to its target, `steps`
+				// stops at loops of gotos
+				auto to = target(insn);
+				for (unsigned int steps = 0; is(to, GOTO) && steps < 16; steps++) {
+					auto t = target(insns[to]);
+					if (t == to || t == insn.target)
+						break;
+					to = t;
+				}
+				if (to != insn.target) {
+					retarget(insn, to);
+					hits[THREAD]++;
+					return true;
+				}
+			}
+
+			if (insn.op == GOTO && target(insn) == j) {
+				kill(i);
+				hits[GOTO_NEXT]++;
+				return true;
+			}
+
+			if ((insn.op == IF_TRUE_GOTO || insn.op == IF_FALSE_GOTO) && is(j, GOTO) && inner(j) && target(insn) == next(j)) {
+				insn.op = insn.op == IF_TRUE_GOTO ? IF_FALSE_GOTO : IF_TRUE_GOTO;
+				retarget(insn, target(insns[j]));
+				kill(j);
+				hits[INVERT]++;
+				return true;
+			}
+
+			if (insn.op == GOTO && inner(j)) {
+				for (; inner(j); j = next(j)) {
+					kill(j);
+					hits[UNREACHABLE]++;
+				}
+				return true;
+			}
+
+			if ((insn.op == PUSH_TRUE || insn.op == PUSH_FALSE) && (is(j, IF_TRUE_GOTO) || is(j, IF_FALSE_GOTO)) && inner(j)) {
+				kill(i);
+				if ((insn.op == PUSH_TRUE) == (insns[j].op == IF_TRUE_GOTO))
+					insns[j].op = GOTO;
+				else
+					kill(j);
+				hits[CONST_BRANCH]++;
+				return true;
+			}
+
+			if (pure_push(insn.op) && is(j, POP) && inner(j)) {
+				kill(i);
+				kill(j);
+				hits[PUSH_POP]++;
+				return true;
+			}
+
+			if ((insn.op == DECL || insn.op == SET) && is(j, POP) && inner(j)) {
+				insn.op = insn.op == DECL ? DECL_POP : SET_POP;
+				kill(j);
+				hits[DECL_SET_POP]++;
+				return true;
+			}
+
+			// the bits of +0.0, not -0.0: -0 - x differs from 0 - x for x = 0
+			if (insn.op == PUSH_NUMBER && insn.imms[0] == number_imm(0.0) && inner(j)) {
+				auto k = next(j);
+				if ((is(k, SUB) || is(k, SUB_NUM)) && inner(k)) {
+					if (is(j, PUSH_NUMBER)) {
+						insns[j].imms[0] = number_imm(0.0 - number(insns[j].imms[0]));
+						kill(i);
+						kill(k);
+						hits[NEGATE]++;
+						return true;
+					}
+					if (is(j, LOOKUP) || is(j, LOOKUP_GLOBAL) || is(j, LOAD_SLOT)) {
+						insns[k].op = insns[k].op == SUB ? NEG : NEG_NUM;
+						kill(i);
+						hits[NEGATE]++;
+						return true;
+					}
+				}
+			}
+
+			if (insn.op == ENTER_SCOPE) {
+				for (; inner(j) && scope_neutral(insns[j].op); j = next(j))
+					;
+				if (is(j, LEAVE_SCOPE) && inner(j)) {
+					kill(i);
+					kill(j);
+					hits[EMPTY_SCOPE]++;
+					return true;
+				}
+			}
+
+			return false;
+		}
+	};
+
+}
+
+void opt::peephole(std::vector<OpCode> &ops, std::vector<std::pair<const char*, unsigned long>> &hits) {
+	Peephole peephole(ops);
+	peephole.run();
+	peephole.encode(ops);
+
+	if (hits.empty())
+		for (auto name: pattern_names)
+			hits.push_back({ name, 0 });
+	for (std::size_t i = 0; i < NPATTERNS; i++)
+		hits[i].second += peephole.hits[i];
+}
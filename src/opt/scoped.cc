@@ -0,0 +1,92 @@
+#include <algorithm>
+#include "scoped.hh"
+
+using namespace ast;
+using namespace asbi;
+
+bool opt::ScopedFold::is_visible(StringContainer* name) const {
+	return std::find(visible.begin(), visible.end(), name) != visible.end();
+}
+
+Node* opt::ScopedFold::declare(VariableDecl* node, bool statement) {
+	for (auto &[var, val]: node->decls) {
+		if (val != nullptr)
+			val = visit(val);
+
+		// the top level of an open unit may be changed by the next one
+		if (!statement || bindings.bindings(var->sc) != 1 || (unit.open && depth == 0))
+			continue;
+
+		if (declared(var->sc, val))
+			visible.push_back(var->sc);
+	}
+	return node;
+}
+
+// executed unconditionally after the previous statements of its scope
+Node* opt::ScopedFold::statement(Node* node) {
+	if (auto block = dynamic_cast<Block*>(node); block != nullptr) {
+		for (auto &expr: block->exprs)
+			expr = statement(expr);
+		return fold_block(block);
+	}
+
+	if (auto decl = dynamic_cast<VariableDecl*>(node); decl != nullptr)
+		return declare(decl, true);
+
+	return visit(node);
+}
+
+Node* opt::ScopedFold::scoped(Node* node) {
+	auto mark = visible.size();
+	depth++;
+	node = statement(node);
+	depth--;
+	visible.resize(mark);
+	return node;
+}
+
+Node* opt::ScopedFold::visit_decl(VariableDecl* node) {
+	return declare(node, false);
+}
+
+// a block inside an expression may not be executed at all, its declarations
+// only count inside of it
+Node* opt::ScopedFold::visit_block(Block* node) {
+	auto mark = visible.size();
+	for (auto &expr: node->exprs)
+		expr = statement(expr);
+	visible.resize(mark);
+	return fold_block(node);
+}
+
+// arguments bound once are visible in the whole body
+Node* opt::ScopedFold::visit_lambda(Lambda* node) {
+	auto mark = visible.size();
+	for (auto argname: node->argnames)
+		if (bindings.bindings(argname) == 1)
+			visible.push_back(argname);
+	auto body = scoped(node->body);
+	visible.resize(mark);
+	if (node->body = dynamic_cast<Block*>(body); node->body == nullptr) {
+		std::vector<Node*> vec = { body };
+		node->body = new Block(vec);
+	}
+	return node;
+}
+
+Node* opt::ScopedFold::visit_if(If* node) {
+	node->cond = visit(node->cond);
+	node->ifbody = scoped(node->ifbody);
+	if (node->elsebody != nullptr)
+		node->elsebody = scoped(node->elsebody);
+	return fold_if(node);
+}
+
+Node* opt::ScopedFold::visit_for(For* node) {
+	if (node->init) node->init = statement(node->init);
+	node->cond = visit(node->cond);
+	node->body = scoped(node->body);
+	if (node->inc) node->inc = visit(node->inc);
+	return fold_for(node);
+}
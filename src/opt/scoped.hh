@@ -0,0 +1,50 @@
+#ifndef OPT_SCOPED_HH
+#define OPT_SCOPED_HH
+
+#include <vector>
+#include "passes.hh"
+#include "fold.hh"
+#include "analysis.hh"
+
+namespace asbi::opt {
+
+	// Fold that knows which declarations have certainly been executed when a
+	// node runs: those preceding it as statements of the same or an
+	// enclosing scope. Only names bound once in the unit are tracked, a use
+	// of such a name after its declaration can not refer to anything else.
+	class ScopedFold: public Fold {
+	public:
+		ScopedFold(Unit &unit, const Bindings &bindings):
+			Fold(unit.ctx), unit(unit), bindings(bindings) {}
+
+		// the statements of the top level run unconditionally
+		ast::Node* visit_unit(ast::Node* node) { return statement(node); }
+
+		ast::Node* visit_decl(ast::VariableDecl*) override;
+		ast::Node* visit_block(ast::Block*) override;
+		ast::Node* visit_lambda(ast::Lambda*) override;
+		ast::Node* visit_if(ast::If*) override;
+		ast::Node* visit_for(ast::For*) override;
+	protected:
+		Unit &unit;
+		const Bindings &bindings;
+
+		// called when the declaration of a name bound once is certainly
+		// executed (with its value already visited), the name is visible from
+		// then on if this returns true (lambda arguments bound once are
+		// visible without it)
+		virtual bool declared(StringContainer*, ast::Node*) { return true; }
+		bool is_visible(StringContainer*) const;
+
+		ast::Node* statement(ast::Node*);
+		ast::Node* scoped(ast::Node*);
+	private:
+		unsigned int depth = 0; // scopes entered
+		std::vector<StringContainer*> visible;
+
+		ast::Node* declare(ast::VariableDecl*, bool statement);
+	};
+
+}
+
+#endif
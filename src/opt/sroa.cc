@@ -0,0 +1,362 @@
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "passes.hh"
+#include "scoped.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+
+/*
+ * Scalar replacement of map and list literals that do not escape. A variable
+ * declared once with a literal whose keys are all literals, never assigned
+ * and only used to read or write fields by keys present in the literal, is
+ * replaced by one variable per field, no map is allocated:
+ *
+ *     e := [:value ~ v, :next ~ nil]; e.:value = e.:value + 1
+ *  => e#1 := v, e#2 := nil; e#1 = e#1 + 1
+ *
+ * A list literal destructured right away, with the result (the list) not
+ * used, binds its values directly. Patterns that are no variables have to
+ * match at compile time:
+ *
+ *     [a, :test, b] := [x, :test, f()]
+ *  => a := x, b := f()
+ *
+ * (with the values evaluated into temporaries first if they could see the
+ * new variables). A field read right away from a literal whose other values
+ * are literals as well is just that field.
+ */
+
+namespace {
+
+	using Fields = std::vector<std::pair<Value, StringContainer*>>;
+
+	// literal keys of a map or list literal, false if not all of them are
+	// literals or a key is used twice
+	bool literal_keys(Node* node, std::vector<Value>* keys) {
+		if (auto list = dynamic_cast<List*>(node); list != nullptr) {
+			for (std::size_t i = 0; i < list->values.size(); i++)
+				keys->push_back(Value::number(i));
+			return true;
+		}
+
+		auto map = dynamic_cast<Map*>(node);
+		if (map == nullptr)
+			return false;
+
+		for (auto [key, val]: map->values) {
+			Value keyval;
+			if (!opt::literal_value(key, &keyval))
+				return false;
+			for (auto &other: *keys)
+				if (other == keyval)
+					return false;
+			keys->push_back(keyval);
+		}
+		return true;
+	}
+
+	// the values of a map or list literal, in evaluation order
+	std::vector<Node*> literal_values(Node* node) {
+		if (auto list = dynamic_cast<List*>(node); list != nullptr)
+			return list->values;
+
+		std::vector<Node*> values;
+		for (auto [key, val]: static_cast<Map*>(node)->values)
+			values.push_back(val);
+		return values;
+	}
+
+
+	bool find_key(const std::vector<Value> &keys, Node* key, std::size_t* idx) {
+		Value keyval;
+		if (!opt::literal_value(key, &keyval))
+			return false;
+
+		for (std::size_t i = 0; i < keys.size(); i++) {
+			if (keys[i] == keyval) {
+				*idx = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// variables declared with a literal and the uses of them that could
+	// be replaced
+	class Escapes: public opt::ScopedFold {
+	public:
+		Escapes(opt::Unit &unit, const opt::Bindings &bindings): ScopedFold(unit, bindings) {}
+
+		std::unordered_map<StringContainer*, std::vector<Value>> candidates;
+		std::unordered_map<StringContainer*, unsigned int> replaceable;
+
+		Node* visit_access(Access* node) override {
+			if (field(node))
+				return node;
+			return Visitor::visit_access(node);
+		}
+
+		Node* visit_assign_access(AssignAccess* node) override {
+			if (!field(node->acs))
+				return Visitor::visit_assign_access(node);
+
+			node->val = visit(node->val);
+			return node;
+		}
+	protected:
+		bool declared(StringContainer* name, Node* val) override {
+			std::vector<Value> keys;
+			if (bindings.assigned.count(name) == 0 && val != nullptr && literal_keys(val, &keys))
+				candidates[name] = keys;
+			return true;
+		}
+	private:
+		bool field(Access* node) {
+			std::size_t idx;
+			auto var = dynamic_cast<Variable*>(node->left);
+			if (var == nullptr || !is_visible(var->sc) || candidates.count(var->sc) == 0
+					|| !find_key(candidates[var->sc], node->right, &idx))
+				return false;
+
+			replaceable[var->sc] += 1;
+			return true;
+		}
+	};
+
+	// does evaluating the node read variables (or call something that could)?
+	class Observes: public Visitor {
+	public:
+		explicit Observes(const std::unordered_set<StringContainer*> &names): names(names) {}
+
+		bool found = false;
+		Node* visit_variable(Variable* node) override {
+			found = found || names.count(node->sc) != 0;
+			return node;
+		}
+		Node* visit_call(Call* node) override {
+			found = true;
+			return node;
+		}
+	private:
+		const std::unordered_set<StringContainer*> &names;
+	};
+
+	class Replace: public opt::Fold {
+	public:
+		Replace(Context* ctx, std::unordered_map<StringContainer*, Fields> &replaced):
+			Fold(ctx), replaced(replaced) {}
+
+		Node* visit_decl(VariableDecl*) override;
+		Node* visit_access(Access*) override;
+		Node* visit_assign_access(AssignAccess*) override;
+		Node* visit_block(Block*) override;
+		Node* visit_for(For*) override;
+	private:
+		std::unordered_map<StringContainer*, Fields> &replaced;
+		unsigned int ntemps = 0;
+
+		StringContainer* field(Access*);
+		StringContainer* temp(const std::string&);
+		Node* destruct(Node*);
+	};
+
+	class SroaPass: public opt::Pass {
+	public:
+		SroaPass(): Pass("sroa", 2) {}
+		Node* run(Node* node, opt::Unit &unit) override {
+			auto bindings = opt::collect_bindings(node);
+			if (bindings.dynamic)
+				return node;
+			unit.sealed = true;
+
+			Escapes escapes(unit, bindings);
+			node = escapes.visit_unit(node);
+
+			// every use has to be replaced, others may come before the
+			// declaration (or are not visible)
+			std::unordered_map<StringContainer*, Fields> replaced;
+			auto uses = opt::count_uses(node);
+			for (auto &[name, keys]: escapes.candidates) {
+				if (uses[name] != escapes.replaceable[name])
+					continue;
+
+				auto &fields = replaced[name];
+				for (auto key: keys)
+					fields.push_back(std::make_pair(key, nullptr));
+			}
+
+			Replace replace(unit.ctx, replaced);
+			return replace.visit(node);
+		}
+	};
+
+}
+
+StringContainer* Replace::temp(const std::string &name) {
+	std::string str = name + "#" + std::to_string(++ntemps);
+	return ctx->new_stringconstant(str);
+}
+
+StringContainer* Replace::field(Access* node) {
+	auto var = dynamic_cast<Variable*>(node->left);
+	if (var == nullptr || replaced.count(var->sc) == 0)
+		return nullptr;
+
+	Value key;
+	opt::literal_value(node->right, &key);
+	for (auto [fkey, name]: replaced[var->sc])
+		if (fkey == key)
+			return name;
+	return nullptr;
+}
+
+Node* Replace::visit_decl(VariableDecl* node) {
+	std::vector<std::pair<Variable*, Node*>> decls;
+	for (auto [var, val]: node->decls) {
+		if (replaced.count(var->sc) == 0) {
+			decls.push_back(std::make_pair(var, val != nullptr ? visit(val) : nullptr));
+			continue;
+		}
+
+		auto &fields = replaced[var->sc];
+		auto values = literal_values(val);
+		for (std::size_t i = 0; i < values.size(); i++) {
+			fields[i].second = temp(var->sc->data);
+			decls.push_back(std::make_pair(new Variable(fields[i].second), visit(values[i])));
+		}
+	}
+
+	node->decls = decls;
+	if (!decls.empty())
+		return node;
+
+	return new Nil();
+}
+
+Node* Replace::visit_access(Access* node) {
+	if (auto name = field(node); name != nullptr)
+		return new Variable(name);
+
+	Visitor::visit_access(node);
+
+	// a field of a literal, whose other values can be dropped
+	std::vector<Value> keys;
+	std::size_t idx;
+	if (!literal_keys(node->left, &keys) || !find_key(keys, node->right, &idx))
+		return node;
+
+	auto values = literal_values(node->left);
+	for (std::size_t i = 0; i < values.size(); i++) {
+		Value val;
+		if (i != idx && !opt::literal_value(values[i], &val))
+			return node;
+	}
+
+	return values[idx];
+}
+
+Node* Replace::visit_assign_access(AssignAccess* node) {
+	auto name = field(node->acs);
+	if (name == nullptr)
+		return Visitor::visit_assign_access(node);
+
+	return new AssignVariable(new Variable(name), visit(node->val));
+}
+
+// destructuring of a list literal (or a block ending in one) whose result
+// is not used
+Node* Replace::destruct(Node* node) {
+	auto destruct = dynamic_cast<DestructList*>(node);
+	if (destruct == nullptr)
+		return node;
+
+	auto block = dynamic_cast<Block*>(destruct->rhs);
+	auto list = dynamic_cast<List*>(block != nullptr && !block->exprs.empty() ? block->exprs.back() : destruct->rhs);
+	if (list == nullptr)
+		return node;
+
+	auto &lhss = destruct->lhss;
+	auto &values = list->values;
+	std::unordered_set<StringContainer*> names;
+	for (std::size_t i = 0; i < lhss.size(); i++) {
+		if (auto var = dynamic_cast<Variable*>(lhss[i]); var != nullptr) {
+			names.insert(var->sc);
+			continue;
+		}
+
+		Value pattern, val = Value::nil();
+		if (!opt::literal_value(lhss[i], &pattern) || (i < values.size() && !opt::literal_value(values[i], &val)) || !(pattern == val))
+			return node;
+	}
+
+	Observes observes(names);
+	for (std::size_t i = 1; i < values.size(); i++)
+		observes.visit(values[i]);
+
+	std::vector<Node*> exprs;
+	if (block != nullptr) {
+		exprs = block->exprs;
+		exprs.pop_back();
+	}
+
+	std::vector<std::pair<Variable*, Node*>> temps, decls;
+	for (std::size_t i = 0; i < values.size(); i++) {
+		Value val;
+		if (!observes.found || opt::literal_value(values[i], &val))
+			continue;
+
+		auto name = temp("destruct");
+		temps.push_back(std::make_pair(new Variable(name), values[i]));
+		values[i] = new Variable(name);
+	}
+	if (!temps.empty())
+		exprs.push_back(new VariableDecl(temps));
+
+	for (std::size_t i = 0; i < lhss.size(); i++) {
+		if (auto var = dynamic_cast<Variable*>(lhss[i]); var != nullptr) {
+			decls.push_back(std::make_pair(var, i < values.size() ? values[i] : new Nil()));
+		}
+	}
+	if (!decls.empty())
+		exprs.push_back(new VariableDecl(decls));
+
+	// values without a variable: literals matched already, the others
+	// are evaluated for their side effects (or have been into temporaries)
+	for (std::size_t i = lhss.size(); i < values.size() && temps.empty(); i++)
+		exprs.push_back(values[i]);
+	if (exprs.empty())
+		exprs.push_back(new Nil());
+
+	return fold_block(new Block(exprs));
+}
+
+Node* Replace::visit_block(Block* node) {
+	auto &exprs = node->exprs;
+	for (std::size_t i = 0; i < exprs.size(); i++) {
+		exprs[i] = visit(exprs[i]);
+		if (i + 1 < exprs.size())
+			exprs[i] = destruct(exprs[i]);
+	}
+	return fold_block(node);
+}
+
+// the value of the body is not used
+Node* Replace::visit_for(For* node) {
+	if (node->init) node->init = visit(node->init);
+	node->cond = visit(node->cond);
+	node->body = visit(node->body);
+	if (node->inc) node->inc = visit(node->inc);
+
+	if (auto block = dynamic_cast<Block*>(node->body); block != nullptr && !block->exprs.empty())
+		block->exprs.back() = destruct(block->exprs.back());
+	else
+		node->body = destruct(node->body);
+	return fold_for(node);
+}
+
+std::unique_ptr<opt::Pass> opt::sroa_pass() {
+	return std::make_unique<SroaPass>();
+}
@@ -0,0 +1,614 @@
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "passes.hh"
+#include "analysis.hh"
+#include "../include/context.hh"
+
+using namespace ast;
+using namespace asbi;
+
+/*
+ * Flow-sensitive type inference. The types a variable can have are tracked
+ * through the unit (as a set of possible types), starting from literals and
+ * the results of operators, and narrowed by operators that would have failed
+ * otherwise (after `a - b`, both are numbers). Arithmetic and comparisons of
+ * operands proven to be numbers use opcodes not checking their types:
+ *
+ *     sum := 0; for i := 0; i < 100; i = i + 1 { sum = sum + i * i }
+ *
+ * Innermost loops using variables that are likely numbers (`n` in
+ * `(n) -> { for i := 0; i < n; ... }`) get a guard: if those variables are
+ * numbers when the loop is entered, a copy of it specialized for that runs
+ * instead.
+ *
+ * Only variables bound once in the unit are tracked. Variables that lambdas
+ * could assign, or another unit if the top level is open, can change with
+ * every call. Lambda bodies only know the types of variables never assigned
+ * at all.
+ */
+
+namespace {
+
+	// sets of types
+	constexpr unsigned int NUM = 1 << 0, BOOL = 1 << 1, STR = 1 << 2, NIL = 1 << 3,
+		SYM = 1 << 4, MAP = 1 << 5, FN = 1 << 6, ANY = (1 << 7) - 1;
+
+	const std::pair<unsigned int, const char*> type_names[] = {
+		{ NUM, "number" }, { BOOL, "bool" }, { STR, "string" }, { NIL, "nil" },
+		{ SYM, "symbol" }, { MAP, "map" }, { FN, "function" },
+	};
+
+	const std::pair<const char*, unsigned int> pure_builtins[] = {
+		{ "len", NUM }, { "typeof", SYM }, { "mod", NUM }, { "toInt", NUM }
+	};
+
+	using State = std::unordered_map<StringContainer*, unsigned int>;
+
+	// variables known in both states
+	State merge(const State &a, const State &b) {
+		State res;
+		for (auto [name, types]: a)
+			if (auto pos = b.find(name); pos != b.end())
+				res[name] = types | pos->second;
+		return res;
+	}
+
+	// where variables are bound and assigned
+	class Scan: public Visitor {
+	public:
+		std::unordered_map<StringContainer*, Lambda*> owner; // nullptr: the top level
+		std::unordered_set<StringContainer*> unstable, clobbered;
+
+		Node* visit_decl(VariableDecl* node) override {
+			for (auto [var, val]: node->decls)
+				bind(var->sc);
+			return Visitor::visit_decl(node);
+		}
+		Node* visit_destruct(DestructList* node) override {
+			for (auto lhs: node->lhss)
+				if (auto var = dynamic_cast<Variable*>(lhs); var != nullptr)
+					bind(var->sc);
+			return Visitor::visit_destruct(node);
+		}
+		Node* visit_assign_variable(AssignVariable* node) override {
+			assigns.push_back(std::make_pair(node->var->sc, fn));
+			return Visitor::visit_assign_variable(node);
+		}
+		Node* visit_lambda(Lambda* node) override {
+			for (auto argname: node->argnames)
+				owner[argname] = node;
+
+			auto outer = fn;
+			fn = node;
+			Visitor::visit_lambda(node);
+			fn = outer;
+			return node;
+		}
+		Node* visit_for(For* node) override {
+			// declarations there run again with every iteration
+			if (node->init) visit(node->init);
+			loop_header++;
+			visit(node->cond);
+			if (node->inc) visit(node->inc);
+			loop_header--;
+			visit(node->body);
+			return node;
+		}
+
+		// assigned in another function than the one binding them
+		void finish() {
+			for (auto [name, fn]: assigns)
+				if (auto pos = owner.find(name); pos == owner.end() || pos->second != fn)
+					clobbered.insert(name);
+		}
+	private:
+		Lambda* fn = nullptr;
+		unsigned int loop_header = 0;
+		std::vector<std::pair<StringContainer*, Lambda*>> assigns;
+
+		void bind(StringContainer* name) {
+			owner[name] = fn;
+			if (loop_header > 0)
+				unstable.insert(name);
+		}
+	};
+
+	// variables used as operands of arithmetic or comparisons
+	class NumericUses: public Visitor {
+	public:
+		std::vector<StringContainer*> names;
+
+		Node* visit_infix(InfixOperator* node) override {
+			if (numeric(node->type)) {
+				use(node->lhs);
+				use(node->rhs);
+			}
+			return Visitor::visit_infix(node);
+		}
+		Node* visit_prefix(PrefxOperator* node) override {
+			if (node->type == PrefxOperator::Neg)
+				use(node->operand);
+			return Visitor::visit_prefix(node);
+		}
+		Node* visit_lambda(Lambda* node) override {
+			return node;
+		}
+
+		static bool numeric(InfixOperator::optype_t type) {
+			return type != InfixOperator::And && type != InfixOperator::Or
+				&& type != InfixOperator::Equals && type != InfixOperator::EqualsNot;
+		}
+	private:
+		void use(Node* node) {
+			auto var = dynamic_cast<Variable*>(node);
+			if (var != nullptr && std::find(names.begin(), names.end(), var->sc) == names.end())
+				names.push_back(var->sc);
+		}
+	};
+
+	// does the loop contain another one (lambdas not counted)?
+	class Loops: public Visitor {
+	public:
+		bool found = false;
+		Node* visit_for(For* node) override {
+			found = true;
+			return node;
+		}
+		Node* visit_lambda(Lambda* node) override {
+			return node;
+		}
+	};
+
+	class Infer {
+	public:
+		Infer(opt::Unit &unit, const opt::Bindings &bindings, const Scan &scan):
+			unit(unit), bindings(bindings), scan(scan) {}
+
+		unsigned int eval(Node*);
+		void dump(std::ostream&) const;
+	private:
+		// Analyse: loop iterations until the types do not change anymore,
+		// Annotate: mark operators (once per node), Guard: mark operators
+		// of the specialized copy of a loop
+		enum Mode { Analyse, Annotate, Guard } mode = Annotate;
+
+		opt::Unit &unit;
+		const opt::Bindings &bindings;
+		const Scan &scan;
+		State state;
+
+		std::string fn, lambda_name; // dotted names of the lambdas entered
+		std::vector<std::pair<std::string, StringContainer*>> order;
+		std::unordered_map<std::string, unsigned int> seen;
+		unsigned int nguarded = 0;
+
+		bool tracked(StringContainer* name) const {
+			return bindings.bindings(name) == 1 && scan.unstable.count(name) == 0;
+		}
+		void bind(StringContainer*, unsigned int types);
+		void note(StringContainer*);
+		void assign(StringContainer*, unsigned int types);
+		void refine(Node*, unsigned int types);
+		void mark(Numeric&, bool numbers);
+
+		unsigned int infix(InfixOperator*);
+		unsigned int call(Call*);
+		unsigned int lambda(Lambda*);
+		unsigned int scoped(Node*);
+		State fixpoint(For*, const State &entry);
+		State loop(For*, const State &head);
+		void guard(For*, const State &entry, const State &head);
+	};
+
+	class TypesPass: public opt::Pass {
+	public:
+		TypesPass(): Pass("types", 2) {}
+		Node* run(Node* node, opt::Unit &unit) override {
+			auto bindings = opt::collect_bindings(node);
+			if (bindings.dynamic)
+				return node;
+			unit.sealed = true;
+
+			Scan scan;
+			scan.visit(node);
+			scan.finish();
+
+			Infer infer(unit, bindings, scan);
+			infer.eval(node);
+			if (unit.ctx->optimizer.dump_types)
+				infer.dump(std::cerr);
+			return node;
+		}
+	};
+
+}
+
+void Infer::bind(StringContainer* name, unsigned int types) {
+	if (!tracked(name))
+		return;
+
+	state[name] = types;
+	note(name);
+	if (mode == Annotate)
+		seen[fn + name->data] |= types;
+}
+
+// in the order of the declarations for --dump-types
+void Infer::note(StringContainer* name) {
+	auto key = fn + name->data;
+	if (mode == Annotate && tracked(name) && seen.count(key) == 0) {
+		order.push_back(std::make_pair(fn, name));
+		seen[key] = 0;
+	}
+}
+
+void Infer::assign(StringContainer* name, unsigned int types) {
+	auto pos = state.find(name);
+	if (pos == state.end())
+		return;
+
+	pos->second = types;
+	if (mode == Annotate)
+		seen[fn + name->data] |= types;
+}
+
+// the operand of an operation that succeeded has one of `types`
+void Infer::refine(Node* node, unsigned int types) {
+	if (auto var = dynamic_cast<Variable*>(node); var != nullptr)
+		if (auto pos = state.find(var->sc); pos != state.end())
+			pos->second &= types;
+}
+
+void Infer::mark(Numeric &numeric, bool numbers) {
+	if (!numbers)
+		return;
+
+	if (mode == Annotate) {
+		numeric = Numeric::Proven;
+	} else if (mode == Guard && numeric == Numeric::Checked) {
+		numeric = Numeric::Guarded;
+		nguarded++;
+	}
+}
+
+unsigned int Infer::eval(Node* node) {
+	if (dynamic_cast<Number*>(node) != nullptr)
+		return NUM;
+	if (dynamic_cast<Bool*>(node) != nullptr)
+		return BOOL;
+	if (dynamic_cast<String*>(node) != nullptr)
+		return STR;
+	if (dynamic_cast<Nil*>(node) != nullptr)
+		return NIL;
+	if (dynamic_cast<Symbol*>(node) != nullptr)
+		return SYM;
+
+	if (auto var = dynamic_cast<Variable*>(node); var != nullptr) {
+		auto pos = state.find(var->sc);
+		return pos != state.end() ? pos->second : ANY;
+	}
+
+	if (auto infix = dynamic_cast<InfixOperator*>(node); infix != nullptr)
+		return this->infix(infix);
+
+	if (auto prefx = dynamic_cast<PrefxOperator*>(node); prefx != nullptr) {
+		auto types = eval(prefx->operand);
+		if (prefx->type == PrefxOperator::Not) {
+			refine(prefx->operand, BOOL);
+			return BOOL;
+		}
+		mark(prefx->numeric, types == NUM);
+		refine(prefx->operand, NUM);
+		return NUM;
+	}
+
+	if (auto decl = dynamic_cast<VariableDecl*>(node); decl != nullptr) {
+		for (auto [var, val]: decl->decls) {
+			if (dynamic_cast<Lambda*>(val) != nullptr) {
+				lambda_name = var->sc->data;
+				note(var->sc);
+			}
+			bind(var->sc, val != nullptr ? eval(val) : NIL);
+		}
+		return NIL;
+	}
+
+	if (auto destruct = dynamic_cast<DestructList*>(node); destruct != nullptr) {
+		eval(destruct->rhs);
+		for (auto lhs: destruct->lhss)
+			if (auto var = dynamic_cast<Variable*>(lhs); var != nullptr)
+				bind(var->sc, ANY);
+		return ANY;
+	}
+
+	if (auto assign = dynamic_cast<AssignVariable*>(node); assign != nullptr) {
+		auto types = eval(assign->val);
+		this->assign(assign->var->sc, types);
+		return types;
+	}
+
+	if (auto assign = dynamic_cast<AssignAccess*>(node); assign != nullptr) {
+		eval(assign->acs->left);
+		eval(assign->acs->right);
+		auto types = eval(assign->val);
+		return types;
+	}
+
+	if (auto acs = dynamic_cast<Access*>(node); acs != nullptr) {
+		eval(acs->left);
+		eval(acs->right);
+		return ANY;
+	}
+
+	if (auto block = dynamic_cast<Block*>(node); block != nullptr) {
+		unsigned int types = NIL;
+		for (auto expr: block->exprs)
+			types = eval(expr);
+		return types;
+	}
+
+	if (auto ifnode = dynamic_cast<If*>(node); ifnode != nullptr) {
+		eval(ifnode->cond);
+		refine(ifnode->cond, BOOL);
+		auto before = state;
+		auto types = scoped(ifnode->ifbody);
+		auto after = state;
+		state = before;
+		types |= ifnode->elsebody ? scoped(ifnode->elsebody) : NIL;
+		state = merge(after, state);
+		return types;
+	}
+
+	if (auto loop = dynamic_cast<For*>(node); loop != nullptr) {
+		if (loop->init)
+			eval(loop->init);
+
+		auto entry = state;
+		auto head = fixpoint(loop, entry);
+		auto exit = head;
+		if (mode == Analyse) {
+			state = head;
+			eval(loop->cond);
+			exit = state;
+		} else {
+			exit = this->loop(loop, head);
+			Loops loops;
+			loops.visit(loop->cond);
+			loops.visit(loop->body);
+			if (loop->inc) loops.visit(loop->inc);
+			if (mode == Annotate && !loops.found)
+				guard(loop, entry, head);
+		}
+
+		// left when the condition is false
+		state = exit;
+		return NIL;
+	}
+
+	if (auto list = dynamic_cast<List*>(node); list != nullptr) {
+		for (auto val: list->values)
+			eval(val);
+		return MAP;
+	}
+
+	if (auto map = dynamic_cast<Map*>(node); map != nullptr) {
+		for (auto [key, val]: map->values) {
+			eval(key);
+			eval(val);
+		}
+		return MAP;
+	}
+
+	if (auto lambda = dynamic_cast<Lambda*>(node); lambda != nullptr)
+		return this->lambda(lambda);
+
+	if (auto call = dynamic_cast<Call*>(node); call != nullptr)
+		return this->call(call);
+
+	return ANY;
+}
+
+unsigned int Infer::infix(InfixOperator* node) {
+	auto lhs = eval(node->lhs);
+	if (node->type == InfixOperator::And || node->type == InfixOperator::Or) {
+		refine(node->lhs, BOOL);
+		auto before = state;
+		auto rhs = eval(node->rhs);
+		state = merge(before, state);
+		return BOOL | rhs;
+	}
+
+	auto rhs = eval(node->rhs);
+	// the rhs could have changed the variable read as lhs
+	auto lhs_stable = dynamic_cast<Variable*>(node->rhs) != nullptr || dynamic_cast<Number*>(node->rhs) != nullptr;
+
+	switch (node->type) {
+	case InfixOperator::Equals:
+	case InfixOperator::EqualsNot:
+		return BOOL;
+	case InfixOperator::Add:{
+		mark(node->numeric, lhs == NUM && rhs == NUM);
+		auto types = (lhs & STR) | ((lhs & NUM) && (rhs & NUM) ? NUM : 0);
+		if (lhs_stable)
+			refine(node->lhs, NUM | STR);
+		if (!(lhs & STR))
+			refine(node->rhs, NUM);
+		return types;
+	}
+	default:
+		break;
+	}
+
+	mark(node->numeric, lhs == NUM && rhs == NUM);
+	if (lhs_stable)
+		refine(node->lhs, NUM);
+	refine(node->rhs, NUM);
+	return node->type == InfixOperator::Sub || node->type == InfixOperator::Mul || node->type == InfixOperator::Div
+		? NUM : BOOL;
+}
+
+unsigned int Infer::call(Call* node) {
+	for (auto it = node->args.rbegin(); it != node->args.rend(); ++it)
+		eval(*it);
+	eval(node->callable);
+
+	auto var = dynamic_cast<Variable*>(node->callable);
+	if (var != nullptr && opt::is_builtin(unit, bindings, var->sc))
+		for (auto [name, types]: pure_builtins)
+			if (var->sc->data == name)
+				return types;
+
+	// the callee could assign variables
+	for (auto &[name, types]: state) {
+		auto owner = scan.owner.find(name);
+		if (scan.clobbered.count(name) != 0 || (unit.open && owner != scan.owner.end() && owner->second == nullptr))
+			types = ANY;
+	}
+	return ANY;
+}
+
+// bodies are only analysed once, when annotating
+unsigned int Infer::lambda(Lambda* node) {
+	auto name = lambda_name.empty() ? "<lambda>" : lambda_name;
+	lambda_name.clear();
+	if (mode != Annotate)
+		return FN;
+
+	// only variables nobody can change keep their types
+	State inner;
+	for (auto [var, types]: state) {
+		auto owner = scan.owner.find(var);
+		auto toplevel = owner != scan.owner.end() && owner->second == nullptr;
+		if (bindings.assigned.count(var) == 0 && !(unit.open && toplevel))
+			inner[var] = types;
+	}
+
+	auto outer_state = state;
+	auto outer_fn = fn;
+	state = inner;
+	fn += name + ".";
+	for (auto argname: node->argnames)
+		bind(argname, ANY);
+	eval(node->body);
+
+	state = outer_state;
+	fn = outer_fn;
+	return FN;
+}
+
+// variables declared in a scope are not known after it
+unsigned int Infer::scoped(Node* node) {
+	auto before = state;
+	auto types = eval(node);
+	auto after = state;
+	state.clear();
+	for (auto [name, t]: before)
+		state[name] = after[name];
+	return types;
+}
+
+// the types of the variables whenever the condition is evaluated
+State Infer::fixpoint(For* node, const State &entry) {
+	auto outer = mode;
+	mode = Analyse;
+
+	auto head = entry;
+	for (;;) {
+		state = head;
+		eval(node->cond);
+		refine(node->cond, BOOL);
+		scoped(node->body);
+		if (node->inc)
+			eval(node->inc);
+
+		auto next = merge(head, state);
+		if (next == head)
+			break;
+		head = next;
+	}
+
+	mode = outer;
+	return head;
+}
+
+// one more iteration, annotating, returns the types after the condition
+State Infer::loop(For* node, const State &head) {
+	state = head;
+	eval(node->cond);
+	refine(node->cond, BOOL);
+	auto exit = state;
+	scoped(node->body);
+	if (node->inc)
+		eval(node->inc);
+	return exit;
+}
+
+// the loop specialized for variables likely to be numbers
+void Infer::guard(For* node, const State &entry, const State &head) {
+	NumericUses uses;
+	uses.visit(node->cond);
+	uses.visit(node->body);
+	if (node->inc) uses.visit(node->inc);
+
+	std::vector<StringContainer*> guards;
+	for (auto name: uses.names) {
+		auto pos = head.find(name);
+		if (pos != head.end() && (pos->second & NUM) && pos->second != NUM && entry.count(name) != 0)
+			guards.push_back(name);
+	}
+
+	// numbers at the entry have to stay numbers
+	State guarded_head;
+	for (;;) {
+		if (guards.empty())
+			return;
+
+		auto guarded_entry = entry;
+		for (auto name: guards)
+			guarded_entry[name] = NUM;
+		guarded_head = fixpoint(node, guarded_entry);
+
+		auto size = guards.size();
+		guards.erase(std::remove_if(guards.begin(), guards.end(), [&](auto name) {
+			return guarded_head[name] != NUM;
+		}), guards.end());
+		if (guards.size() == size)
+			break;
+	}
+
+	auto outer_guarded = nguarded;
+	mode = Guard;
+	loop(node, guarded_head);
+	mode = Annotate;
+
+	if (nguarded > outer_guarded)
+		node->guards = guards;
+}
+
+void Infer::dump(std::ostream &os) const {
+	os << "==asbi==: types\n";
+	for (auto [fn, name]: order) {
+		auto types = seen.at(fn + name->data);
+		os << "\t" << fn << name->data << ": ";
+		if (types == ANY) {
+			os << "any\n";
+			continue;
+		}
+
+		auto sep = "";
+		for (auto [type, tname]: type_names) {
+			if (types & type) {
+				os << sep << tname;
+				sep = "|";
+			}
+		}
+		os << "\n";
+	}
+}
+
+std::unique_ptr<opt::Pass> opt::types_pass() {
+	return std::make_unique<TypesPass>();
+}
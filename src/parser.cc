@@ -1,4 +1,5 @@
 #include <vector>
+#include <cassert>
 #include <memory>
 #include <map>
 #include <utility>
@@ -10,7 +11,7 @@
 
 using namespace asbi;
 
-Parser::Parser(tok::Tokenizer toker, Context* ctx): tokenizer(toker), ctx(ctx) {}
+Parser::Parser(tok::Tokenizer toker, Context* ctx, bool lazy, bool checked): tokenizer(toker), ctx(ctx), lazy(lazy), checked(checked) {}
 
 void Parser::expect(tok::Type type) {
 	auto t = tokenizer.next();
@@ -131,10 +132,7 @@ ast::Node* Parser::parse_assign() {
 
 		ast::List* list = dynamic_cast<ast::List*>(left);
 		if (list != nullptr) {
-			auto node = new ast::DestructList(std::move(list->values), right);
-			list->values.clear();
-			delete list;
-			return node;
+			return new ast::DestructList(std::move(list->values), right);
 		}
 
 		ast::Map* map = dynamic_cast<ast::Map*>(left);
@@ -147,8 +145,6 @@ ast::Node* Parser::parse_assign() {
 
 				vars.push_back(std::make_pair(var, key));
 			}
-			map->values.clear();
-			delete map;
 			return new ast::DestructMap(std::move(vars), right);*/
 
 			throw utils::parser_error("unimplemented!", left);
@@ -255,8 +251,7 @@ ast::Node* Parser::parse_factor() {
 			if (token.type != tok::Identifier)
 				throw utils::parser_error("expected identifier/symbol after ':'", token);
 
-			node = new ast::Access(node, new ast::Symbol(ctx->new_stringconstant(*token.str)));
-			delete token.str;
+			node = new ast::Access(node, new ast::Symbol(ctx->new_stringconstant(token.str())));
 		} else if (t == tok::DoubleColon) {
 			/*auto token = tokenizer.next();
 			if (token.type != tok::Identifier)
@@ -286,14 +281,10 @@ ast::Node* Parser::parse_final() {
 	case tok::Bool:
 		return new ast::Bool(t.integer != 0 ? true : false);
 	case tok::String:{
-		auto str = new ast::String(ctx->new_stringconstant(*t.str));
-		delete t.str;
-		return str;
+		return new ast::String(ctx->new_stringconstant(t.str()));
 	}
 	case tok::Identifier:{
-		auto var = new ast::Variable(ctx->new_stringconstant(*t.str));
-		delete t.str;
-		return var;
+		return new ast::Variable(ctx->new_stringconstant(t.str()));
 	}
 	case tok::Nil:
 		return new ast::Nil();
@@ -301,9 +292,7 @@ ast::Node* Parser::parse_final() {
 		t = tokenizer.next();
 		if (t.type != tok::Identifier)
 			throw utils::parser_error("expected identifier (symbol)", t);
-		auto sym = new ast::Symbol(ctx->new_stringconstant(*t.str));
-		delete t.str;
-		return sym;
+		return new ast::Symbol(ctx->new_stringconstant(t.str()));
 	}
 	case tok::LeftBracket:{
 		if (tokenizer.peek().type == tok::RightBracket) {
@@ -385,7 +374,14 @@ ast::Lambda* Parser::parse_lambda(std::vector<ast::Node*> argnamenodes) {
 			throw utils::parser_error("lambda-litteral args should only be identifiers", node);
 
 		argnames.push_back(var->sc);
-		delete var;
+	}
+
+	if (lazy && tokenizer.peek().type == tok::LeftCurlyBracket) {
+		if (auto source = skim_body(); source != nullptr) {
+			auto lambda = new ast::Lambda(std::move(argnames), new ast::Block(std::vector<ast::Node*>()));
+			lambda->lazy = source;
+			return lambda;
+		}
 	}
 
 	ast::Block* body;
@@ -415,6 +411,57 @@ ast::Map* Parser::parse_map(ast::Node* firstkey) {
 	return new ast::Map(std::move(values));
 }
 
+// The source of a lambda body in `{...}`, parsed into a scratch arena only
+// to report syntax errors now (the tree is thrown away). It is parsed again
+// and compiled when the lambda is called for the first time (see
+// Context::compile_lazy()), that parser only has to find the closing
+// bracket of nested bodies. nullptr if the block is only the start of a
+// longer expression (`() -> { a } + 1`).
+LazyBody* Parser::skim_body() {
+	auto t = tokenizer.peek();
+	auto start = tokenizer.offset() - 1;
+	auto line = t.line;
+	assert(t.type == tok::LeftCurlyBracket && tokenizer.text()[start] == '{');
+
+	if (checked) {
+		unsigned int depth = 0;
+		do {
+			t = tokenizer.next();
+			if (t.type == tok::LeftCurlyBracket)
+				depth++;
+			else if (t.type == tok::RightCurlyBracket)
+				depth--;
+			else if (t.type == tok::EOFTok)
+				throw utils::parser_error("expected '}'", t);
+		} while (depth > 0);
+	} else {
+		// nested bodies are checked along with this one
+		ast::Arena scratch;
+		ast::Arena::Scope scope(scratch);
+		lazy = false;
+		tokenizer.next();
+		parse_block();
+		lazy = true;
+	}
+
+	auto end = tokenizer.offset();
+	switch (tokenizer.peek().type) {
+	case tok::Semicolon: case tok::Comma: case tok::EOFTok:
+	case tok::RightBracket: case tok::RightCurlyBracket: case tok::RightSquareBracket:
+		break;
+	default:
+		tokenizer.seek(start, line);
+		return nullptr;
+	}
+
+	auto body = new LazyBody{ tokenizer.text().substr(start, end - start), line, false };
+	{
+		std::lock_guard<std::mutex> lock(ctx->parse_mtx);
+		ctx->lazy_bodies.push_back(body);
+	}
+	return body;
+}
+
 ast::Block* Parser::parse_block() {
 	if (tokenizer.peek().type == tok::RightCurlyBracket) {
 		tokenizer.next();
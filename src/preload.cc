@@ -0,0 +1,134 @@
+#include <algorithm>
+#include "include/preload.hh"
+#include "include/parser.hh"
+#include "include/tokenizer.hh"
+#include "include/context.hh"
+#include "include/utils.hh"
+#include "include/cache.hh"
+
+using namespace asbi;
+
+static const unsigned int max_threads = 4;
+
+Preloader::~Preloader() {
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		for (unsigned int i = 0; i < threads.size(); ++i) {
+			queue.push_back(std::string());
+			queued.release();
+		}
+	}
+
+	for (auto &thread: threads)
+		thread.join();
+}
+
+void Preloader::scan(const std::string &source, const std::string &path) {
+	// `import ( "..." )`, other calls of import() are left to macro_import
+	std::vector<std::string> found;
+	try {
+		tok::Tokenizer tokenizer(source);
+		unsigned int matched = 0;
+		std::string arg;
+		for (auto t = tokenizer.next(); t.type != tok::EOFTok; t = tokenizer.next()) {
+			if (matched == 1 && t.type == tok::LeftBracket) {
+				matched = 2;
+			} else if (matched == 2 && t.type == tok::String) {
+				arg = t.str();
+				matched = 3;
+			} else if (matched == 3 && t.type == tok::RightBracket) {
+				found.push_back(arg);
+				matched = 0;
+			} else {
+				matched = t.type == tok::Identifier && t.str() == "import" ? 1 : 0;
+			}
+		}
+	} catch (utils::tokenizer_error&) {
+		// reported when the module is parsed
+	}
+
+	auto dir = utils::dirname(path);
+	for (auto &arg: found) {
+		std::string resolved;
+		try {
+			resolved = utils::join(dir, arg);
+		} catch (std::runtime_error&) {
+			continue; // no such file, import() fails
+		}
+
+		std::unique_lock<std::mutex> lock(mtx);
+		if (modules.count(resolved) != 0)
+			continue;
+
+		modules[resolved];
+		queue.push_back(resolved);
+		if (threads.size() < std::min(max_threads, std::max(1u, std::thread::hardware_concurrency())))
+			threads.push_back(std::thread(&Preloader::worker, this));
+		queued.release();
+	}
+}
+
+std::unique_ptr<Preloaded> Preloader::take(const std::string &path) {
+	std::unique_lock<std::mutex> lock(mtx);
+	auto pos = modules.find(path);
+	if (pos == modules.end()) {
+		// imported without being preloaded, later scans skip it
+		modules[path].done = true;
+		return nullptr;
+	}
+
+	auto &module = pos->second;
+	loaded.wait(lock, [&]() { return module.done; });
+	if (auto error = module.error; error != nullptr) {
+		module.error = nullptr;
+		std::rethrow_exception(error);
+	}
+	return std::move(module.parsed);
+}
+
+void Preloader::worker() {
+	for (;;) {
+		queued.acquire();
+		std::string path;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			path = queue.front();
+			queue.pop_front();
+		}
+		if (path.empty())
+			return;
+
+		std::unique_ptr<Preloaded> parsed;
+		std::exception_ptr error;
+		try {
+			parsed = load(path);
+		} catch (...) {
+			error = std::current_exception();
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			auto &module = modules[path];
+			module.parsed = std::move(parsed);
+			module.error = error;
+			module.done = true;
+		}
+		loaded.notify_all();
+	}
+}
+
+// runs on a worker: only the interning of names and lazy bodies touch the
+// context (see Context::parse_mtx)
+std::unique_ptr<Preloaded> Preloader::load(std::string path) {
+	auto parsed = std::make_unique<Preloaded>();
+	utils::readfile(path, parsed->source);
+	scan(parsed->source, path);
+	if (ctx->cache != nullptr && ctx->cache->stored(path, parsed->source))
+		return parsed;
+
+	parsed->arena = std::make_unique<ast::Arena>();
+	ast::Arena::Scope scope(*parsed->arena);
+	Parser parser(tok::Tokenizer(parsed->source), ctx, ctx->optimizer.lazy_enabled());
+	parsed->ast = parser.parse();
+	return parsed;
+}
@@ -22,7 +22,7 @@ static Value all_env_vars(int n, Context* ctx, std::shared_ptr<Env>) {
 	if (n != 0)
 		throw std::runtime_error("env:all usage error");
 
-	auto vars = new MapContainer(ctx);
+	auto vars = new (ctx->heap) MapContainer(ctx);
 	for (int i = 0; environ[i] != NULL; ++i) {
 		const char* str = environ[i];
 		const char* pos = std::strchr(str, '=');
@@ -125,8 +125,8 @@ static Value macro_exit(int n, Context* ctx, std::shared_ptr<Env>) {
 }
 
 void asbi::load_procenv(Context* ctx, int argc, const char* argv[], int scriptArgs) {
-	auto env = new MapContainer(ctx);
-	auto args = new MapContainer(ctx);
+	auto env = new (ctx->heap) MapContainer(ctx);
+	auto args = new (ctx->heap) MapContainer(ctx);
 	for (int i = scriptArgs, j = 0; i < argc; ++i, ++j)
 		args->set(Value::number(j), Value::string(ctx->new_string(argv[i])));
 
@@ -136,5 +136,5 @@ void asbi::load_procenv(Context* ctx, int argc, const char* argv[], int scriptAr
 	env->set(Value::symbol("argv", ctx), Value::map(args));
 	env->set(Value::symbol("$",    ctx), Value::macro(macro_system));
 	env->set(Value::symbol("exit", ctx), Value::macro(macro_exit));
-	ctx->global_env->decl(ctx, "env", Value::map(env));
+	ctx->declare_builtin("env", Value::map(env));
 }
@@ -0,0 +1,487 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include "include/snapshot.hh"
+#include "include/context.hh"
+#include "include/types.hh"
+#include "include/vm.hh"
+#include "include/utils.hh"
+#include "include/procenv.hh"
+
+using namespace asbi;
+
+// bumped whenever the layout below or the opcodes change
+static const char magic[] = "asbi-snapshot 2 " ASBI_VERSION "\n";
+
+// flags of the saved strings
+static const uint64_t interned = 1, local = 2;
+
+// the builtin functions of a context by name: `len`, `io:println`, ...
+static std::unordered_map<std::string, Value::macro_t> builtin_macros(Context* ctx) {
+	std::unordered_map<std::string, Value::macro_t> macros;
+	for (auto [sc, val]: ctx->builtins) {
+		if (val.type == type_t::Macro)
+			macros[sc->data] = val._macro;
+		if (val.type != type_t::Map)
+			continue;
+
+		for (auto [key, elm]: val._map->data)
+			if (key.type == type_t::Symbol && elm.type == type_t::Macro)
+				macros[sc->data + ":" + key._string->data] = elm._macro;
+	}
+	return macros;
+}
+
+static void put(std::string &out, uint64_t word) {
+	out.append(reinterpret_cast<const char*>(&word), sizeof(word));
+}
+
+static void put(std::string &out, const std::string &str) {
+	put(out, str.size());
+	out += str;
+}
+
+namespace {
+
+	// reads the words of a snapshot, throws if it ends early
+	struct Reader {
+		const std::string &data;
+		std::size_t pos;
+
+		uint64_t word() {
+			uint64_t word;
+			if (data.size() - pos < sizeof(word))
+				throw std::runtime_error("snapshot: truncated file");
+			std::memcpy(&word, data.data() + pos, sizeof(word));
+			pos += sizeof(word);
+			return word;
+		}
+
+		uint64_t index(std::size_t size) {
+			auto i = word();
+			if (i >= size)
+				throw std::runtime_error("snapshot: index out of range");
+			return i;
+		}
+
+		std::string string() {
+			auto size = word();
+			if (data.size() - pos < size)
+				throw std::runtime_error("snapshot: truncated file");
+			auto str = data.substr(pos, size);
+			pos += size;
+			return str;
+		}
+	};
+
+}
+
+void Snapshot::save(Context* ctx, std::shared_ptr<Env> env, const std::string &path) {
+	// names of the functions and maps any new context has
+	std::unordered_map<Value::macro_t, std::string> macro_names;
+	{
+		Context pristine;
+		load_procenv(&pristine, 0, nullptr, 0);
+		for (auto [name, macro]: builtin_macros(&pristine))
+			macro_names[macro] = name;
+	}
+	std::unordered_map<MapContainer*, std::string> builtin_maps;
+	for (auto [sc, val]: ctx->builtins)
+		if (val.type == type_t::Map)
+			builtin_maps[val._map] = sc->data;
+
+	// the objects of each kind in the order they were found
+	std::vector<StringContainer*> strings;
+	std::vector<Env*> envs;
+	std::vector<MapContainer*> maps;
+	std::vector<LambdaContainer*> lambdas;
+	std::vector<LazyBody*> lazy_bodies;
+	std::vector<std::vector<OpCode>*> bytecode;
+	std::unordered_map<const void*, uint64_t> indices;
+
+	auto index = [&](auto* ptr, auto &table) -> uint64_t {
+		if (auto pos = indices.find(ptr); pos != indices.end())
+			return pos->second;
+
+		indices[ptr] = table.size();
+		table.push_back(ptr);
+		return table.size() - 1;
+	};
+	// 0 for nullptr, the index + 1 otherwise
+	auto optional = [&](auto* ptr, auto &table) -> uint64_t {
+		return ptr == nullptr ? 0 : index(ptr, table) + 1;
+	};
+
+	auto value = [&](Value val, std::string &out) {
+		put(out, static_cast<uint64_t>(val.type));
+		switch (val.type) {
+		case type_t::Number:{
+			uint64_t bits;
+			std::memcpy(&bits, &val._number, sizeof(bits));
+			put(out, bits);
+			break;
+		}
+		case type_t::Bool:
+			put(out, val._boolean);
+			break;
+		case type_t::Nil:
+			put(out, 0);
+			break;
+		case type_t::String: case type_t::Symbol:
+			put(out, index(val._string, strings));
+			break;
+		case type_t::Lambda:
+			put(out, index(val._lambda, lambdas));
+			break;
+		case type_t::Map:
+			put(out, index(val._map, maps));
+			break;
+		case type_t::Macro:{
+			auto name = macro_names.find(val._macro);
+			if (name == macro_names.end())
+				throw std::runtime_error("snapshot: unknown builtin function");
+			put(out, name->second);
+			break;
+		}
+		default:
+			throw std::runtime_error("snapshot: unexpected value");
+		}
+	};
+
+	// the global env is always the first one
+	index(ctx->global_env.get(), envs);
+	auto root = index(env.get(), envs);
+
+	// maps and lambdas are created from their shells before anything
+	// refers to them when the snapshot is loaded
+	std::string map_shells, lambda_shells, env_data, map_data, lambda_data, bytecode_data;
+	std::size_t e = 0, m = 0, l = 0, b = 0;
+	while (e < envs.size() || m < maps.size() || l < lambdas.size() || b < bytecode.size()) {
+		for (; e < envs.size(); e++) {
+			auto env = envs[e];
+			put(env_data, optional(env->outer.get(), envs));
+			put(env_data, optional(env->caller.get(), envs));
+			put(env_data, env->sealed);
+			put(env_data, env->vars.size());
+			for (auto [name, val]: env->vars) {
+				put(env_data, index(name, strings));
+				value(val, env_data);
+			}
+		}
+
+		for (; m < maps.size(); m++) {
+			auto mc = maps[m];
+			auto builtin = builtin_maps.find(mc);
+			put(map_shells, mc->gc_manage);
+			put(map_shells, builtin != builtin_maps.end());
+			if (builtin != builtin_maps.end()) {
+				put(map_shells, builtin->second);
+				continue;
+			}
+
+			put(map_data, mc->vecdata.size());
+			for (auto val: mc->vecdata)
+				value(val, map_data);
+			put(map_data, mc->data.size());
+			for (auto [key, val]: mc->data) {
+				value(key, map_data);
+				value(val, map_data);
+			}
+		}
+
+		for (; l < lambdas.size(); l++) {
+			auto lc = lambdas[l];
+			put(lambda_shells, lc->gc_manage);
+			put(lambda_data, optional(lc->env.get(), envs));
+			put(lambda_data, index(lc->ops, bytecode));
+			put(lambda_data, optional(lc->lazy, lazy_bodies));
+			put(lambda_data, lc->argnames.size());
+			for (auto sc: lc->argnames)
+				put(lambda_data, index(sc, strings));
+		}
+
+		for (; b < bytecode.size(); b++) {
+			auto &ops = *bytecode[b];
+			put(bytecode_data, ops.size());
+			Immediate kinds[3];
+			for (std::size_t pc = 0; pc < ops.size(); ) {
+				auto op = ops[pc++];
+				put(bytecode_data, op);
+				auto n = immediates(op, kinds);
+				for (unsigned int i = 0; i < n; i++) {
+					auto raw = ops[pc++];
+					switch (kinds[i]) {
+					case Immediate::String:
+						put(bytecode_data, index(reinterpret_cast<StringContainer*>(raw), strings));
+						break;
+					case Immediate::Lambda:
+						put(bytecode_data, index(reinterpret_cast<LambdaContainer*>(raw), lambdas));
+						break;
+					case Immediate::Template:
+						put(bytecode_data, index(reinterpret_cast<MapContainer*>(raw), maps));
+						break;
+					case Immediate::Cell:
+						put(bytecode_data, 0); // of the name before it
+						break;
+					case Immediate::Macro:{
+						auto name = macro_names.find(reinterpret_cast<Value::macro_t>(static_cast<uintptr_t>(raw)));
+						if (name == macro_names.end())
+							throw std::runtime_error("snapshot: unknown builtin function");
+						put(bytecode_data, name->second);
+						break;
+					}
+					case Immediate::Raw:
+						put(bytecode_data, raw);
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	std::string out = magic;
+	put(out, strings.size());
+	for (auto sc: strings) {
+		put(out, (sc->gc_manage ? 0 : interned) | (sc->local ? local : 0));
+		put(out, sc->data);
+	}
+
+	put(out, envs.size());
+	put(out, maps.size());
+	out += map_shells;
+	put(out, lambdas.size());
+	out += lambda_shells;
+	put(out, lazy_bodies.size());
+	for (auto body: lazy_bodies) {
+		put(out, body->line);
+		put(out, body->compiled);
+		put(out, body->source);
+	}
+	put(out, bytecode.size());
+
+	out += env_data;
+	out += map_data;
+	out += lambda_data;
+	out += bytecode_data;
+	put(out, root);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.write(out.data(), out.size()))
+		throw std::runtime_error("snapshot: cannot write " + path);
+}
+
+std::shared_ptr<Env> Snapshot::load(Context* ctx, const std::string &path) {
+	std::string data, name = path;
+	utils::readfile(name, data);
+	if (data.compare(0, sizeof(magic) - 1, magic) != 0)
+		throw std::runtime_error("snapshot: not a snapshot of this version of asbi");
+
+	Reader in{ data, sizeof(magic) - 1 };
+	auto macros = builtin_macros(ctx);
+
+	std::vector<StringContainer*> strings(in.word());
+	for (auto &sc: strings) {
+		auto flags = in.word();
+		auto str = in.string();
+		if (flags & interned) {
+			sc = ctx->new_stringconstant(str);
+			sc->local = sc->local || (flags & local) != 0;
+		} else {
+			sc = ctx->new_string(str);
+			ctx->heap_size += sc->gc_size();
+		}
+	}
+
+	std::vector<std::shared_ptr<Env>> envs(in.word());
+	if (envs.empty())
+		throw std::runtime_error("snapshot: no global env");
+	envs[0] = ctx->global_env;
+	for (std::size_t i = 1; i < envs.size(); i++)
+		envs[i] = std::make_shared<Env>(ctx, nullptr);
+
+	std::vector<MapContainer*> maps(in.word());
+	std::vector<bool> builtin_maps(maps.size());
+	for (std::size_t i = 0; i < maps.size(); i++) {
+		auto &mc = maps[i];
+		auto gc = in.word() != 0;
+		builtin_maps[i] = in.word() != 0;
+		if (!builtin_maps[i]) {
+			mc = new (ctx->heap) MapContainer(ctx, gc);
+			if (!gc)
+				ctx->templates.push_back(mc);
+			continue;
+		}
+
+		auto builtin = in.string();
+		for (auto [sc, val]: ctx->builtins)
+			if (sc->data == builtin && val.type == type_t::Map)
+				mc = val._map;
+		if (mc == nullptr)
+			throw std::runtime_error("snapshot: unknown builtin " + builtin);
+	}
+
+	std::vector<LambdaContainer*> lambdas(in.word());
+	for (auto &lc: lambdas)
+		lc = new (ctx->heap) LambdaContainer(nullptr, nullptr, {}, ctx, in.word() != 0);
+
+	std::vector<LazyBody*> lazy_bodies(in.word());
+	for (auto &body: lazy_bodies) {
+		auto line = static_cast<unsigned int>(in.word());
+		auto compiled = in.word() != 0;
+		body = new LazyBody{ in.string(), line, compiled };
+		ctx->lazy_bodies.push_back(body);
+	}
+
+	std::vector<std::vector<OpCode>*> bytecode(in.word());
+	for (auto &ops: bytecode)
+		ops = new std::vector<OpCode>();
+
+	auto value = [&]() {
+		auto type = static_cast<type_t>(in.word());
+		switch (type) {
+		case type_t::Number:{
+			auto bits = in.word();
+			double num;
+			std::memcpy(&num, &bits, sizeof(num));
+			return Value::number(num);
+		}
+		case type_t::Bool:
+			return Value::boolean(in.word() != 0);
+		case type_t::Nil:
+			in.word();
+			return Value::nil();
+		case type_t::String:
+			return Value::string(strings[in.index(strings.size())]);
+		case type_t::Symbol:
+			return Value::symbol(strings[in.index(strings.size())]);
+		case type_t::Lambda:
+			return Value::lambda(lambdas[in.index(lambdas.size())]);
+		case type_t::Map:
+			return Value::map(maps[in.index(maps.size())]);
+		case type_t::Macro:{
+			auto macro = macros.find(in.string());
+			if (macro == macros.end())
+				throw std::runtime_error("snapshot: unknown builtin function");
+			return Value::macro(macro->second);
+		}
+		default:
+			throw std::runtime_error("snapshot: unexpected value");
+		}
+	};
+	// 0 for nullptr, the index + 1 otherwise
+	auto env_ref = [&]() {
+		auto i = in.index(envs.size() + 1);
+		return i == 0 ? nullptr : envs[i - 1];
+	};
+
+	for (auto &env: envs) {
+		auto outer = env_ref();
+		auto caller = env_ref();
+		auto sealed = in.word() != 0;
+		if (env != ctx->global_env) {
+			env->outer = outer;
+			env->caller = caller;
+			env->sealed = sealed;
+		}
+
+		for (auto n = in.word(); n > 0; n--) {
+			auto name = strings[in.index(strings.size())];
+			env->vars[name] = value();
+		}
+	}
+
+	for (std::size_t i = 0; i < maps.size(); i++) {
+		auto mc = maps[i];
+		if (builtin_maps[i])
+			continue; // as the new context has it
+
+		mc->vecdata.resize(in.word());
+		for (auto &val: mc->vecdata)
+			val = value();
+		for (auto n = in.word(); n > 0; n--) {
+			auto key = value();
+			mc->data[key] = value();
+		}
+		if (mc->gc_manage)
+			ctx->heap_size += mc->gc_size();
+	}
+
+	for (auto lc: lambdas) {
+		lc->env = env_ref();
+		lc->ops = bytecode[in.index(bytecode.size())];
+		auto lazy = in.index(lazy_bodies.size() + 1);
+		lc->lazy = lazy == 0 ? nullptr : lazy_bodies[lazy - 1];
+		for (auto n = in.word(); n > 0; n--)
+			lc->argnames.push_back(strings[in.index(strings.size())]);
+		if (lc->gc_manage)
+			ctx->heap_size += lc->gc_size();
+	}
+
+	// the global env is complete, its cells can be looked up
+	for (auto ops: bytecode) {
+		Immediate kinds[3];
+		StringContainer* sc = nullptr;
+		auto size = in.word();
+		while (ops->size() < size) {
+			auto op = static_cast<OpCode>(in.word());
+			if (op > NOOP)
+				throw std::runtime_error("snapshot: invalid opcode");
+
+			ops->push_back(op);
+			auto n = immediates(op, kinds);
+			for (unsigned int i = 0; i < n; i++) {
+				uint64_t imm = 0;
+				switch (kinds[i]) {
+				case Immediate::String:
+					sc = strings[in.index(strings.size())];
+					imm = reinterpret_cast<uintptr_t>(sc);
+					break;
+				case Immediate::Lambda:
+					imm = reinterpret_cast<uintptr_t>(lambdas[in.index(lambdas.size())]);
+					break;
+				case Immediate::Template:
+					imm = reinterpret_cast<uintptr_t>(maps[in.index(maps.size())]);
+					break;
+				case Immediate::Cell:{
+					in.word();
+					auto cell = ctx->global_cell(sc);
+					if (cell == nullptr)
+						throw std::runtime_error("snapshot: global not bound: " + sc->data);
+					imm = reinterpret_cast<uintptr_t>(cell);
+					break;
+				}
+				case Immediate::Macro:{
+					auto macro = macros.find(in.string());
+					if (macro == macros.end())
+						throw std::runtime_error("snapshot: unknown builtin function");
+					imm = reinterpret_cast<uintptr_t>(macro->second);
+					break;
+				}
+				case Immediate::Raw:
+					imm = in.word();
+					break;
+				}
+				ops->push_back(static_cast<OpCode>(imm));
+			}
+		}
+		if (ops->size() != size)
+			throw std::runtime_error("snapshot: truncated bytecode");
+	}
+
+	auto root = envs[in.index(envs.size())];
+	if (in.pos != data.size())
+		throw std::runtime_error("snapshot: trailing data");
+
+	// every bytecode vector is freed with one lambda of Context::lambdas
+	std::unordered_set<std::vector<OpCode>*> owned;
+	for (auto lc: lambdas)
+		if (!lc->gc_manage && owned.insert(lc->ops).second)
+			ctx->lambdas.push_back(lc);
+	for (auto ops: bytecode)
+		if (owned.count(ops) == 0)
+			ctx->lambdas.push_back(new (ctx->heap) LambdaContainer(nullptr, ops, {}, ctx, false));
+
+	return root;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cassert>
 #include <memory>
+#include <sstream>
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
@@ -16,11 +17,42 @@ using namespace asbi;
 
 namespace tests {
 
+	// every test has to pass at every optimization level, also when the
+	// statements are read and run one at a time (with a parallel GC), the
+	// GC stops the world to mark at -O0
 	void test(const std::string code, Value expected) {
-		Context ctx;
 		std::cout << "test(\'" << code << "\'): " << std::flush;
-		Value res = ctx.run(code);
-		assert(res == expected);
+		for (unsigned int level = 0; level <= opt::max_level; level++) {
+			Context ctx;
+			ctx.optimizer.level = level;
+			if (level == 0)
+				ctx.gc_slice = 0;
+			Value res = ctx.run(code);
+			assert(res == expected);
+
+			Context streamed;
+			streamed.optimizer.level = level;
+			streamed.gc_threads = 2;
+			std::istringstream in(code);
+			res = streamed.run(in);
+			assert(res == expected);
+		}
+		std::cout << "SUCCESS\n";
+	}
+
+	// the passes of the highest level still reason about the variables of
+	// `code`: every line of `expected` is in what they inferred (--dump-types)
+	void test_types(const std::string code, std::vector<std::string> expected) {
+		std::cout << "test_types(\'" << code << "\'): " << std::flush;
+		Context ctx;
+		ctx.optimizer.level = opt::max_level;
+		ctx.optimizer.dump_types = true;
+		std::ostringstream dump;
+		auto cerr = std::cerr.rdbuf(dump.rdbuf());
+		ctx.run(code);
+		std::cerr.rdbuf(cerr);
+		for (auto &line: expected)
+			assert(dump.str().find("\t" + line + "\n") != std::string::npos);
 		std::cout << "SUCCESS\n";
 	}
 
@@ -45,6 +77,56 @@ namespace tests {
 		test("[a, :test, b, 123] := ((x) -> [x, :test, :b, 123])(42); a == 42 & b == :b", Value::boolean(true));
 		test("[1, 4, 9, 16, 25] := map([1, 2, 3, 4, 5], (_, x) -> x * x); nil", Value::nil());
 		test("reduce([1, 2, 3, 4, 5], 0, (sum, _, x) -> sum + x)", Value::number(15));
+		test("-5 + 3 == -2 & !false & (true | nil) & (false & nil) == false & len(\"abc\" + 1) == 4", Value::boolean(true));
+		test("debug := false, name := \"asbi\"; if debug { 1 } else if name == \"asbi\" { len(name + \"!\") } else { 3 }", Value::number(5));
+		test("t := true; f := () -> if !t { 1 } else { x := 2; x }; { y := f() + 1 }; y + len([1, 2, :c])", Value::number(6));
+		test("x := 5; f := () -> x; if true { x := 2; f() + x }", Value::number(7));
+		test("f := () -> c; c := 3; for false { c := 4 }; f() + len([42 ~ 0])", Value::number(46));
+		test("len := (x) -> 42; len(\"abc\")", Value::number(42));
+		test("x := 1; eval(\"x = 2\", 0); x", Value::number(2));
+		test("i := 0; pair := (a, b) -> [a, b]; [1, 0] := pair(i = i + 1, i = i * 10); i", Value::number(1));
+		test("sq := (x) -> x * x; f := (x) -> sq(x) + sq(x + 1); k := 10; g := (a) -> { k := 1; f(a) * f(k) }; g(3)", Value::number(125));
+		test("k := 10; f := (x) -> x + k; g := () -> f(1); k = 3; g()", Value::number(4));
+		test("arr := [1, 2, 3], m := [:k ~ 1], s := 0; for i := 0; i < len(arr); i = i + 1 { s = s + m.:k * 2; m.:k = i }; s", Value::number(4));
+		test("k := 2, s := 0; bump := () -> k = k + 1; for i := 0; i < 3 & len(\"\") == 0; i = i + 1 { s = s + k * 10; bump() }; s", Value::number(90));
+		test("x := \"a\", n := 0; for n < len([,]) { x - 1 }; n", Value::number(0));
+		test("f := () -> a; a := 1; [a, b, c] := [2, f()]; [a, b, c] == [2, 1, nil]", Value::boolean(true));
+		test("e := [:value ~ 3, :next ~ nil]; e.:value = e.:value + 1; g := () -> e.:value; e.:value = 10; g() + [e.:next, 1].1", Value::number(11));
+		test("f := (a, b) -> { r := 0; for i := 0; i < 3; i = i + 1 { r = r + a * i }; b + r }; f(1, \"\") + f(2, 1) + f(2, \"x\") == \"37x6\"", Value::boolean(true));
+		test("x := 1; g := () -> x = \"s\"; r := 0; for i := 0; i < 2; i = i + 1 { r = x + 1; g() }; r == \"s1\"", Value::boolean(true));
+		test("f := (n) -> { r := 0; for i := 0; i < 4; i = i + 1 { r = r - -n; if i == 1 { n = 0.5 } }; r }; f(2)", Value::number(5));
+		test("fib := (n) -> { a := 0, b := 1; for i := 0; i < n; i = i + 1 { t := a; a = b; b = t + b }; a }; fib(20)", Value::number(6765));
+		test("y := 100; f := (c) -> { if c { y := 1; y = y + 1 }; y }; f(true) + f(false)", Value::number(200));
+		test("f := (a, b, c) -> { r := if a > 0 & b > 0 { 1 } else { 2 }; x := a - b; r * 100 + x * (a - b) + c }; f(1, 2, 3) + f(3, 1, 0) + f(0, 1, 0)", Value::number(409));
+		test("f := (n) -> if n < 0 { -n } else if n == 0 { x := 100; x } else { n * 2 }; f(-3) + f(0) + f(4) + -(2)", Value::number(109));
+		test("s := 0; for i := 0; i < 10; i = i + 1 { if i == 5 { s = s + 100 } else { s = s + i } }; s", Value::number(140));
+		test("z := 0; m := [:k ~ 1]; { m.:k = -z }; 1 / m.:k > 0", Value::boolean(true));
+		test("f := () -> [:a ~ 1, :b ~ [1, 2]]; x := f(); x.:a = 5; x.:b.0 = 9; y := f(); y.:a + y.:b.0 + x.:b.0", Value::number(11));
+		test("m := [:a ~ 1, :a ~ 2, 3 ~ :x, \"s\" ~ [~]]; [m.:a, m.3, len(m), len(m.\"s\")] == [1, :x, 4, 0]", Value::boolean(true));
+		test("f := () -> { 1 } + 1; g := (x) -> { y := x; [() -> { y }, () -> { y = y + 1 }] }; p := g(3); p.1(); f() + p.0() + len(\"}{\")", Value::number(8));
+		test("fact := (n) -> { if n < 2 { 1 } else { n * fact(n - 1) } }; a := fact(5); b := fact(3); a + b", Value::number(126));
+		test("a := len([1, 2]); g := (len) -> len + 1; b := g(5); a + b + len([1])", Value::number(9));
+		test("f := () -> typeof(1); r := f(); typeof := (x) -> :mine; [r, f(), typeof(2)] == [:number, :mine, :mine]", Value::boolean(true));
+		test("f := () -> mod(7, 4) + toInt(2.5) + len(\"ab\"); a := f(); mod = (x, y) -> x * y; a + f()", Value::number(39));
+		test("[typeof(typeof), typeof([~]), typeof(\"\"), mod(-7, 3), toInt(-0.5)] == [:function, :map, :string, -1, -1]", Value::boolean(true));
+		test("a := len(\"a\\\"b\\n\") # c\n// d\n/* e\n f */ + len('c\\'d'); a + 0x10 + 1.5", Value::number(24.5));
+		test("iff := 1, nile := 2, fort := 3, elsewhere := 4, truex := 5, fa := 6; if true { iff + nile + fort + elsewhere + truex + fa } else { nil }", Value::number(21));
+		test("s := 0; for i := 0; i < 50; i = i + 1 { s = s + eval(\"[p, q] := [i, 2]; p * q\", 0) }; s", Value::number(2450));
+		test("[a, b] := [1, 2]; f := (x) -> if false { 1 } else { for false { 2 }; [x, 4].0 }; a + b + f(3)", Value::number(6));
+		test("s := \"a;b\"; # ;\nf := (x) -> {\n\tx + 1; };\nn := 0; for i := 0; i < 3; i = i + 1 { n = n + f(i) }; /* ; */ n + len(s)", Value::number(9));
+		test("for f := () -> { 0 }; f() > 0; f = nil {}; for false { 1 }; 7", Value::number(7));
+		test("s := \"a;\nb\"; /* x;\ny'; */ t := 'c\\';\n\"'; len(s) + len(t)", Value::number(9));
+		test("fns := [,]; mk := () -> { s := \"f\" + len(fns); () -> s }; for i := 0; i < 20; i = i + 1 { fns.i = mk() }; for j := 0; j < 10000; j = j + 1 { g := [:g ~ \"g\" + j] }; fns.7() + fns.19() == \"f7f19\"", Value::boolean(true));
+		test("old := [:k ~ nil, :l ~ [,]]; n := \"\"; set := (x) -> n = x; for j := 0; j < 10000; j = j + 1 { old.:k = [:v ~ \"a\" + j]; old.:l.(mod(j, 7)) = \"b\" + j; set(\"n\" + j) }; [old.:k.:v, old.:l.3, n] == [\"a9999\", \"b9999\", \"n9999\"]", Value::boolean(true));
+		test("l := [,]; for i := 0; i < 6000; i = i + 1 { l.i = i }; r := map(l, (x, i) -> [:s ~ \"m\" + x]); len(r) + len(r.5999.:s)", Value::number(6005));
+		test("l := [,]; for i := 0; i < 3000; i = i + 1 { l.i = [:v ~ [:w ~ \"s\" + i]] }; for j := 0; j < 20000; j = j + 1 { k := mod(j * 7, 3000); b := l.k.:v; w := b.:w; b.:w = nil; l.k = [:v ~ [:w ~ w]] }; n := 0; for i := 0; i < 3000; i = i + 1 { n = n + len(l.i.:v.:w) }; n", Value::number(13890));
+		test("mk := (v) -> { c := v; [() -> c, (n) -> c = n] }; cells := [,]; for i := 0; i < 3000; i = i + 1 { cells.i = mk([:w ~ \"s\" + i]) }; for j := 0; j < 20000; j = j + 1 { p := cells.(mod(j * 7, 3000)); b := p.0(); w := b.:w; b.:w = nil; p.1([:w ~ w]) }; n := 0; for i := 0; i < 3000; i = i + 1 { n = n + len(cells.i.0().:w) }; n", Value::number(13890));
+		test("l := nil; for i := 0; i < 200000; i = i + 1 { l = [:v ~ i, :next ~ l] }; n := 0; for e := l; e != nil; e = e.:next { n = n + e.:v }; n", Value::number(19999900000));
+		test("s := 0; for i := 0; i < 30000; i = i + 1 { a := \"x\" + i; f := () -> a; m := [:f ~ f]; s = s + len(m.:f()) }; s", Value::number(168890));
+		test("l := [,]; for i := 0; i < 20000; i = i + 1 { l.i = [:v ~ i] }; for i := 1; i < 20000; i = i + 2 { l.i = nil }; for j := 0; j < 50000; j = j + 1 { t := [:t ~ j] }; s := 0; for i := 0; i < 20000; i = i + 2 { s = s + l.i.:v }; s", Value::number(99990000));
+		test("apply := (f, x) -> f(x); arr := [1, 2, 3], sum := 0; for i := 0; i < len(arr); i = i + 1 { sum = sum + i }; sum + apply((y) -> y, 1)", Value::number(4));
+
+		test_types("apply := (f, x) -> f(x); arr := [1, 2, 3], sum := 0; for i := 0; i < len(arr); i = i + 1 { sum = sum + i }; sum + apply((y) -> y, 1)", { "sum: number", "i: number", "licm#1: number" });
 
 	}
 
@@ -1,34 +1,134 @@
 #include <string>
-#include <memory>
-#include <iostream>
-#include <map>
+#include <array>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 
 #include "include/utils.hh"
 #include "include/tokenizer.hh"
 
 using namespace tok;
 
-static std::map<std::string, Token> keywords = {
-	{ "if",     Token(If, 0)      },
-	{ "else",   Token(Else, 0)    },
-	{ "for",    Token(For, 0)     },
-	{ "true",   Token(Bool, 1, 0) },
-	{ "false",  Token(Bool, 0, 0) },
-	{ "nil",    Token(Nil, 0)     },
-};
-
-static bool is_identifier(char c) {
-	// 0-9 nicht als erstes zeichen eines identifiers
-	return (c == '_' || c == '$' || c == '@' || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9'));
+namespace {
+
+	enum CharClass: unsigned char {
+		SPACE  = 1 << 0,
+		DIGIT  = 1 << 1,
+		IDENT  = 1 << 2, // 0-9 nicht als erstes zeichen eines identifiers
+		NUMBER = 1 << 3,
+	};
+
+	constexpr std::array<unsigned char, 256> make_classes() {
+		std::array<unsigned char, 256> classes{};
+		for (unsigned char c: { ' ', '\t', '\v', '\n' })
+			classes[c] |= SPACE;
+		for (unsigned char c = '0'; c <= '9'; c++)
+			classes[c] |= DIGIT | IDENT | NUMBER;
+		for (unsigned char c = 'a'; c <= 'z'; c++)
+			classes[c] |= IDENT | NUMBER;
+		for (unsigned char c = 'A'; c <= 'Z'; c++)
+			classes[c] |= IDENT;
+		for (unsigned char c: { '_', '$', '@' })
+			classes[c] |= IDENT;
+		classes['.'] |= NUMBER;
+		return classes;
+	}
+
+	constexpr auto classes = make_classes();
+
+	inline bool is(char c, CharClass cls) {
+		return classes[static_cast<unsigned char>(c)] & cls;
+	}
+
+	struct Keyword {
+		std::string_view name;
+		Type type;
+		int value;
+	};
+
+	// indexed by keyword_hash(), which has no collisions between the keywords
+	const Keyword keywords[8] = {
+		{ "true",  Bool, 1 },
+		{ "for",   For,  0 },
+		{ "",      Nil,  0 },
+		{ "",      Nil,  0 },
+		{ "else",  Else, 0 },
+		{ "nil",   Nil,  0 },
+		{ "if",    If,   0 },
+		{ "false", Bool, 0 },
+	};
+
+	inline std::size_t keyword_hash(std::string_view str) {
+		auto c0 = static_cast<unsigned char>(str[0]), c1 = static_cast<unsigned char>(str[1]);
+		return ((c0 << 3) + (c1 << 1) + str.size()) % 8;
+	}
+
+	// the end of a string (`open` is its quote) or block comment ('*')
+	// searched for from pos on, npos if it is not in text (yet)
+	std::size_t closing(const std::string &text, std::size_t pos, char open) {
+		if (open == '*') {
+			auto end = text.find("*/", pos);
+			return end == std::string::npos ? end : end + 2;
+		}
+		for (; pos < text.length(); pos++) {
+			if (text[pos] == '\\')
+				pos++;
+			else if (text[pos] == open)
+				return pos + 1;
+		}
+		return std::string::npos;
+	}
+
+	// what the tokenizer stopped in after pos: the whitespace and comments
+	// up to an unterminated string or block comment (its `open`, see
+	// closing()) or the end of text (0)
+	char unterminated(const std::string &text, std::size_t pos) {
+		while (pos < text.length()) {
+			char c = text[pos];
+			bool comment = c == '/' && pos + 1 < text.length();
+			if (is(c, SPACE)) {
+				pos++;
+			} else if (c == '#' || (comment && text[pos + 1] == '/')) {
+				pos = text.find('\n', pos);
+			} else if (comment && text[pos + 1] == '*') {
+				if ((pos = closing(text, pos + 2, '*')) == std::string::npos)
+					return '*';
+			} else if (c == '"' || c == '\'') {
+				if ((pos = closing(text, pos + 1, c)) == std::string::npos)
+					return c;
+			} else {
+				return 0;
+			}
+		}
+		return 0;
+	}
+
 }
 
 Token Tokenizer::next_string(char strstart) {
-	std::string *str = new std::string("");
-	pos++;
+	auto first = line;
+	auto start = ++pos;
+	while (pos < source.length() && source[pos] != strstart && source[pos] != '\\') {
+		if (source[pos] == '\n')
+			line++;
+		pos++;
+	}
+
+	// no escape sequences: the token points into the source
+	if (pos >= source.length() || source[pos] == strstart) {
+		std::string_view str(source.data() + start, pos - start);
+		if (pos < source.length())
+			pos++;
+		return Token(String, str, first);
+	}
+
+	auto &str = escaped.emplace_back(source, start, pos - start);
 	while (pos < source.length()) {
 		char c = source[pos++];
 		if (c == '\\') {
-			char c = source[pos++];
+			c = source[pos++];
 			switch (c) {
 			case 'n': c = '\n'; break;
 			case 't': c = '\t'; break;
@@ -40,28 +140,57 @@ Token Tokenizer::next_string(char strstart) {
 			}
 		} else if (c == strstart)
 			break;
-		*str += c;
+		else if (c == '\n')
+			line++;
+		str += c;
 	}
-	return Token(String, str, line);
+	return Token(String, str, first);
 }
 
 Token Tokenizer::next_number() {
-	std::string str = "";
+	auto start = pos;
 	bool contains_dot = false;
-	char c = source[pos];
-	while (('0' <= c && c <= '9') || c == '.' || (c >= 'a' && c <= 'z')) {
-		str += c;
-		if (c == '.')
-			contains_dot = true;
-		if (++pos >= source.length())
-			break;
-		c = source[pos];
+	for (; pos < source.length() && is(source[pos], NUMBER); pos++)
+		contains_dot |= source[pos] == '.';
+
+	char buf[64];
+	if (pos - start >= sizeof(buf))
+		throw utils::tokenizer_error("number too long", line, source[start]);
+	memcpy(buf, source.data() + start, pos - start);
+	buf[pos - start] = '\0';
+
+	errno = 0;
+	if (contains_dot) {
+		double real = strtod(buf, nullptr);
+		if (errno == ERANGE)
+			throw utils::tokenizer_error("number out of range", line, source[start]);
+		return Token(Real, real, line);
 	}
 
-	if (contains_dot)
-		return Token(Real, std::stod(str, nullptr), line);
-	else
-		return Token(Int, std::stoi(str, nullptr, 0), line);
+	long integer = strtol(buf, nullptr, 0);
+	if (errno == ERANGE || integer < INT_MIN || integer > INT_MAX)
+		throw utils::tokenizer_error("number out of range", line, source[start]);
+	return Token(Int, static_cast<int>(integer), line);
+}
+
+Token Tokenizer::next_identifier() {
+	auto start = pos;
+	while (pos < source.length() && is(source[pos], IDENT))
+		pos++;
+
+	std::string_view str(source.data() + start, pos - start);
+	if (str.size() >= 2 && str.size() <= 5) {
+		auto &keyword = keywords[keyword_hash(str)];
+		if (keyword.name == str)
+			return Token(keyword.type, keyword.value, line);
+	}
+	return Token(Identifier, str, line);
+}
+
+void Tokenizer::seek(unsigned long pos, unsigned int line) {
+	tokbuffed = false;
+	this->pos = pos;
+	this->line = line;
 }
 
 Token Tokenizer::peek() {
@@ -79,21 +208,33 @@ Token Tokenizer::next() {
 		return tokbuf;
 	}
 
-	if (pos >= source.length())
-		return Token(EOFTok, line);
+	// whitespace and comments
+	const auto length = source.length();
+	for (;;) {
+		while (pos < length && is(source[pos], SPACE))
+			if (source[pos++] == '\n')
+				line++;
+		if (pos >= length)
+			return Token(EOFTok, line);
+
+		if (source[pos] == '#' || (source[pos] == '/' && pos + 1 < length && source[pos + 1] == '/')) {
+			auto eol = static_cast<const char*>(memchr(source.data() + pos, '\n', length - pos));
+			pos = eol != nullptr ? eol - source.data() : length;
+			continue;
+		}
+		if (source[pos] == '/' && pos + 1 < length && source[pos + 1] == '*') {
+			pos += 2;
+			while (pos + 1 < length && !(source[pos] == '*' && source[pos + 1] == '/'))
+				if (source[pos++] == '\n')
+					line++;
+			pos = std::min(pos + 2, length);
+			continue;
+		}
+		break;
+	}
 
 	char c = source[pos];
 	switch (c) {
-	case '\n':
-		line += 1;
-	case ' ': case '\t': case '\v':
-		pos++;
-		return next();
-	case '#':
-		while (pos < source.length() && source[pos] != '\n') pos++;
-		line++;
-		pos++;
-		return next();
 	case '"':
 	case '\'':
 		return next_string(c);
@@ -130,22 +271,6 @@ Token Tokenizer::next() {
 		return Token(Mul, line);
 	case '/':
 		pos++;
-		if (pos < source.length() && source[pos] == '/') {
-			while (pos < source.length() && source[pos] != '\n') pos++;
-			line++;
-			pos++;
-			return next();
-		}
-		if (pos < source.length() && source[pos] == '*') {
-			pos++;
-			while (pos + 1 < source.length() && !(source[pos] == '*' && source[pos + 1] == '/')) {
-				if (source[pos++] == '\n') {
-					line++;
-				}
-			}
-			pos += 2;
-			return next();
-		}
 		return Token(Div, line);
 	case '!':
 		pos++;
@@ -205,30 +330,70 @@ Token Tokenizer::next() {
 		pos++;
 		return Token(KeyValue, line);
 	default:
-		if ('0' <= c && c <= '9')
+		if (is(c, DIGIT))
 			return next_number();
+		if (is(c, IDENT))
+			return next_identifier();
+		throw utils::tokenizer_error("unkown char", line, c);
+	}
+}
 
-		if (!is_identifier(c))
-			throw utils::tokenizer_error("unkown char", line, source[pos]);
+bool StatementReader::next(std::string &statement, unsigned int &line) {
+	for (;;) {
+		// the tokenizer would start over at a string or comment spanning
+		// lines with every one of them
+		if (open != 0 && closing(buffer, resume, open) != std::string::npos)
+			open = 0;
 
-		std::string* str = new std::string("");
-		while (pos < source.length()) {
-			char c = source[pos];
-			if (!is_identifier(c))
+		Tokenizer tokenizer(buffer, scanned_line);
+		tokenizer.seek(scanned, scanned_line);
+		for (auto t = open == 0 ? tokenizer.next() : Token(EOFTok, 0); t.type != EOFTok; t = tokenizer.next()) {
+			// every line read ends in '\n', only an unterminated string reaches the end
+			if (tokenizer.offset() >= buffer.length())
 				break;
 
-			*str += c;
-			pos++;
+			scanned = tokenizer.offset();
+			scanned_line = tokenizer.lineno();
+			auto prev = last;
+			last = t.type;
+			// `for init; cond; inc { ... }`: the header ends with the body (a
+			// `{` that does not start the body of a lambda)
+			if (t.type == For && depth == 0)
+				for_header = true;
+			else if (t.type == LeftCurlyBracket && depth == 0 && prev != Arrow)
+				for_header = false;
+
+			if (t.type == LeftBracket || t.type == LeftCurlyBracket || t.type == LeftSquareBracket)
+				depth++;
+			else if ((t.type == RightBracket || t.type == RightCurlyBracket || t.type == RightSquareBracket) && depth > 0)
+				depth--;
+			else if (t.type == Semicolon && depth == 0 && !for_header) {
+				statement = buffer.substr(0, scanned);
+				line = this->line;
+				buffer.erase(0, scanned);
+				this->line = scanned_line;
+				scanned = 0;
+				return true;
+			}
 		}
+		if (open == 0)
+			open = unterminated(buffer, scanned);
+		resume = buffer.length();
 
-		auto mappos = keywords.find(*str);
-		if (mappos == keywords.end()) {
-			return Token(Identifier, str, line);
-		} else {
-			delete str;
-			mappos->second.line = line;
-			return mappos->second;
+		std::string next_line;
+		if (!std::getline(in, next_line)) {
+			// the last statement, without a `;`
+			open = 0;
+			if (Tokenizer(buffer).next().type == EOFTok)
+				return false;
+			statement = std::move(buffer);
+			line = this->line;
+			buffer.clear();
+			scanned = 0;
+			return true;
 		}
+		buffer += next_line;
+		buffer += '\n';
 	}
 }
 
@@ -236,13 +401,13 @@ Token Tokenizer::next() {
 std::string tok::to_string(Token token) {
 	switch (token.type) {
 	case Identifier:
-		return std::string("Identifier(") + *(token.str) + ")";
+		return std::string("Identifier(") + std::string(token.str()) + ")";
 	case Int:
 	 	return std::string("Int(") + std::to_string(token.integer) + ")";
 	case Real:
 		return std::string("Real(") + std::to_string(token.real) + ")";
 	case String:
-		return std::string("String(\"") + *(token.str) + "\")";
+		return std::string("String(\"") + std::string(token.str()) + "\")";
 	case Bool:
 		return std::string("Bool(") + (token.integer ? "true" : "false") + ")";
 	case Nil:       return std::string("Nil");
@@ -11,6 +11,9 @@
 
 using namespace asbi;
 
+// there are no pages for bigger objects (see Pool)
+static_assert(sizeof(StringContainer) <= Pool::max_size && sizeof(MapContainer) <= Pool::max_size && sizeof(LambdaContainer) <= Pool::max_size);
+
 /*
 static std::size_t hash_cstr(const char* str) {
 	std::size_t hash = 4321;
@@ -29,10 +32,6 @@ StringContainer::~StringContainer(){
 	// std::cout << "~StringContainer" << '\n';
 }
 
-void StringContainer::gc_visit() const {
-	gc_inuse = true;
-}
-
 std::size_t StringContainer::gc_size() const {
 	return sizeof(*this) + data.size();
 }
@@ -44,53 +43,122 @@ LambdaContainer::~LambdaContainer(){
 	// std::cout << "~LambdaContainer" << '\n';
 }
 
-void LambdaContainer::gc_visit() const {
-	if (gc_inuse)
-		return;
+std::size_t LambdaContainer::gc_size() const {
+	return sizeof(*this);
+}
 
-	gc_inuse = true;
-	assert(env != nullptr);
-	env->gc_visit();
+std::size_t LambdaContainer::gc_scan(Context* ctx) const {
+	ctx->shade(env.get());
+	return 1;
 }
 
-std::size_t LambdaContainer::gc_size() const {
-	return sizeof(*this);
+MapContainer::MapContainer(Context* ctx, bool gc): GCObj(ctx, gc), ctx(ctx) {}
+
+std::size_t MapContainer::gc_size() const {
+	return sizeof(*this) + (data.size() * sizeof(Value) * 2) + (vecdata.size() * sizeof(Value));
 }
 
-MapContainer::MapContainer(Context* ctx): GCObj(ctx, true) {}
+std::size_t MapContainer::gc_scan(Context* ctx) const {
+	for (auto &[key, val]: data) {
+		ctx->shade(key);
+		ctx->shade(val);
+	}
+
+	// long arrays are left to Context::gc_mark(), a slice at a time
+	if (ctx->gc_slice != 0 && vecdata.size() > ctx->gc_slice) {
+		ctx->scanning = this;
+		ctx->scan_pos = 0;
+		return 1 + data.size();
+	}
+
+	for (auto &val: vecdata)
+		ctx->shade(val);
 
-void MapContainer::gc_visit() const {
-	if (gc_inuse)
-		return;
+	return 1 + data.size() + vecdata.size();
+}
 
-	gc_inuse = true;
+void MapContainer::gc_scan_dirty() const {
+	for (auto i = gc_dirty_lo; i < gc_dirty_hi; i++)
+		ctx->shade(vecdata[i]);
 
-	for (auto [key, val]: data) {
-		key.gc_visit();
-		val.gc_visit();
+	if (gc_dirty_data) {
+		for (auto &[key, val]: data) {
+			ctx->shade(key);
+			ctx->shade(val);
+		}
 	}
+}
 
-	for (auto val: vecdata) {
-		val.gc_visit();
+bool MapContainer::gc_trim() {
+	while (gc_dirty_lo < gc_dirty_hi && !vecdata[gc_dirty_lo].gc_young())
+		gc_dirty_lo++;
+	while (gc_dirty_hi > gc_dirty_lo && !vecdata[gc_dirty_hi - 1].gc_young())
+		gc_dirty_hi--;
+
+	if (gc_dirty_data) {
+		gc_dirty_data = false;
+		for (auto &[key, val]: data) {
+			if (key.gc_young() || val.gc_young()) {
+				gc_dirty_data = true;
+				break;
+			}
+		}
 	}
+	return gc_dirty_lo < gc_dirty_hi || gc_dirty_data;
 }
 
-std::size_t MapContainer::gc_size() const {
-	return sizeof(*this) + (data.size() * sizeof(Value) * 2) + (vecdata.size() * sizeof(Value));
+bool MapContainer::gc_promote() {
+	gc_dirty_lo = 0;
+	gc_dirty_hi = vecdata.size();
+	gc_dirty_data = true;
+	return gc_trim();
 }
 
 void MapContainer::set(Value key, Value val) {
+	// the write barrier, maps not managed by the GC are never written to
+	bool barrier = gc_old && gc_manage && (key.gc_young() || val.gc_young());
+	if (barrier && !gc_remembered)
+		ctx->remember(this);
+
+	// while an incremental collection marks, nothing the map points to may
+	// stay unmarked once the map itself is
+	if (ctx->gc_phase == Context::GCPhase::Mark && Pool::marked(this)) {
+		ctx->shade(key);
+		ctx->shade(val);
+	}
+
 	unsigned int idx;
 	if (key.asUint(&idx)) {
 		while (vecdata.size() <= idx)
 			vecdata.push_back(Value::nil());
 
 		vecdata[idx] = val;
+		if (barrier) {
+			bool clean = gc_dirty_lo == gc_dirty_hi;
+			gc_dirty_lo = clean ? idx : std::min<std::size_t>(gc_dirty_lo, idx);
+			gc_dirty_hi = clean ? idx + 1 : std::max<std::size_t>(gc_dirty_hi, idx + 1);
+		}
 	} else {
 		data[key] = val;
+		gc_dirty_data = gc_dirty_data || barrier;
 	}
 }
 
+MapContainer* MapContainer::clone(Context* ctx) const {
+	auto mc = new (ctx->heap) MapContainer(ctx);
+	mc->data = data;
+	mc->vecdata = vecdata;
+	ctx->heap_size += mc->gc_size();
+
+	for (auto &[key, val]: mc->data)
+		if (val.type == type_t::Map)
+			val = Value::map(val._map->clone(ctx));
+	for (auto &val: mc->vecdata)
+		if (val.type == type_t::Map)
+			val = Value::map(val._map->clone(ctx));
+	return mc;
+}
+
 Value MapContainer::get(Value key) {
 	unsigned int idx;
 	if (key.asUint(&idx)) {
@@ -143,6 +211,8 @@ Value Value::call(Context *ctx, unsigned int n, std::shared_ptr<Env> callerenv)
 			lbdenv->decl(_lambda->argnames[i], ctx->pop());
 
 		lbdenv->caller = callerenv;
+		if (_lambda->lazy != nullptr && !_lambda->lazy->compiled)
+			ctx->compile_lazy(_lambda);
 		return execute(*_lambda->ops, lbdenv, ctx);
 	}
 	case type_t::Macro:
@@ -240,23 +310,6 @@ std::string Value::to_string(bool debug) const {
 	}
 }
 
-void Value::gc_visit() const {
-	switch (type) {
-	case type_t::Symbol:
-	case type_t::String:
-		_string->gc_visit();
-		return;
-	case type_t::Lambda:
-		_lambda->gc_visit();
-		return;
-	case type_t::Map:
-		_map->gc_visit();
-		return;
-	default:
-		return;
-	}
-}
-
 bool Value::asUint(unsigned int *intpart) const {
 	if (type != type_t::Number)
 		return false;
@@ -59,7 +59,7 @@ namespace utils {
 		what_message += msg;
 	}
 
-	std::string dirname(std::string &path) {
+	std::string dirname(const std::string &path) {
 		auto i = path.find_last_of("/");
 		if (i == std::string::npos)
 			return ".";
@@ -74,12 +74,23 @@ namespace utils {
 		return std::string(normalized);
 	}
 
-	void readfile(std::string &path, std::string &content) {
+	void readfile(const std::string &path, std::string &content) {
 		content.clear();
-		std::ifstream ifs(path);
+		std::ifstream ifs(path, std::ios::binary);
 		if (!ifs.good())
 			throw std::runtime_error("readfile error");
 
+		// in one read if the size is known (not for pipes)
+		if (ifs.seekg(0, std::ios::end); ifs.good() && ifs.tellg() > 0) {
+			content.resize(ifs.tellg());
+			ifs.seekg(0);
+			if (!ifs.read(&content[0], content.size()))
+				throw std::runtime_error("readfile error");
+			return;
+		}
+
+		ifs.clear();
+		ifs.seekg(0);
 		content.assign((std::istreambuf_iterator<char>(ifs)),(std::istreambuf_iterator<char>()));
 	}
 
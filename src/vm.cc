@@ -5,9 +5,33 @@
 
 using namespace asbi;
 
+// the intrinsic's name is still bound to its builtin, looked up where
+// LOOKUP_GLOBAL would
+static inline bool intrinsic_bound(StringContainer* sc, Value* cell, OpCode fn) {
+	return !sc->local && cell->type == type_t::Macro && cell->_macro == reinterpret_cast<Value::macro_t>(static_cast<uintptr_t>(fn));
+}
+
+// the name was rebound or shadowed: a CALL of whatever it is now
+static void intrinsic_fallback(Context* ctx, std::shared_ptr<Env> env, StringContainer* sc, Value* cell, unsigned int n) {
+	auto callable = sc->local ? env->lookup(sc) : *cell;
+	ctx->push(callable.call(ctx, n, env));
+}
+
+// operands of a _NUM op: opt/types.cc inferred numbers, which a value
+// changed behind its back (e.g. by `eval` under another name) would break,
+// the generic op throws or handles the other types then
+static inline bool numbers_on_top(Context* ctx, unsigned int n) {
+	auto it = ctx->stack.end();
+	for (unsigned int i = 0; i < n; i++)
+		if ((--it)->type != type_t::Number)
+			return false;
+	return true;
+}
+
 Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Context* ctx) {
+	auto base = ctx->stack.size(); // slots of the frame start here
 #ifndef NDEBUG
-	auto oldstacksize = ctx->stack.size();
+	auto oldstacksize = base;
 #endif
 	unsigned int pc = 0;
 	while (pc < opcodes.size()) {
@@ -47,7 +71,10 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 		case PUSH_LAMBDA:{
 			auto raw = opcodes[pc++];
 			auto lc = reinterpret_cast<LambdaContainer*>(raw);
-			ctx->push(Value::lambda(new LambdaContainer(env, lc->ops, lc->argnames, ctx, true)));
+			auto closure = new (ctx->heap) LambdaContainer(env, lc->ops, lc->argnames, ctx, true);
+			closure->lazy = lc->lazy;
+			ctx->heap_size += closure->gc_size();
+			ctx->push(Value::lambda(closure));
 			break;
 		}
 		case PUSH_STACK_PLACEHOLDER:{
@@ -68,6 +95,9 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			assert(env != nullptr);
 			break;
 		}
+		case SEAL_ENV:
+			env->sealed = true;
+			break;
 		case CALL:{
 			auto n = static_cast<unsigned int>(opcodes[pc++]);
 			auto callable = ctx->pop();
@@ -80,6 +110,12 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(env->lookup(sc));
 			break;
 		}
+		case LOOKUP_GLOBAL:{
+			auto sc = reinterpret_cast<StringContainer*>(opcodes[pc++]);
+			auto cell = reinterpret_cast<Value*>(opcodes[pc++]);
+			ctx->push(sc->local ? env->lookup(sc) : *cell);
+			break;
+		}
 		case DECL:{
 			auto raw = opcodes[pc++];
 			auto sc = reinterpret_cast<StringContainer*>(raw);
@@ -95,7 +131,19 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(val);
 			break;
 		}
-		case ADD:{
+		case DECL_POP:{
+			auto raw = opcodes[pc++];
+			auto sc = reinterpret_cast<StringContainer*>(raw);
+			env->decl(sc, ctx->pop());
+			break;
+		}
+		case SET_POP:{
+			auto raw = opcodes[pc++];
+			auto sc = reinterpret_cast<StringContainer*>(raw);
+			env->set(sc, ctx->pop());
+			break;
+		}
+		case ADD: add:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type == type_t::Number && b.type == type_t::Number) {
@@ -114,7 +162,7 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 
 			throw std::runtime_error("expected number or string");
 		}
-		case SUB:{
+		case SUB: sub:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type != type_t::Number || b.type != type_t::Number)
@@ -122,7 +170,7 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(Value::number(a._number - b._number));
 			break;
 		}
-		case MUL:{
+		case MUL: mul:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type != type_t::Number || b.type != type_t::Number)
@@ -130,7 +178,7 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(Value::number(a._number * b._number));
 			break;
 		}
-		case DIV:{
+		case DIV: div:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type != type_t::Number || b.type != type_t::Number)
@@ -150,7 +198,7 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(Value::boolean(!(a == b)));
 			break;
 		}
-		case SMALLER:{
+		case SMALLER: smaller:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type != type_t::Number || b.type != type_t::Number)
@@ -158,7 +206,7 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(Value::boolean(a._number < b._number));
 			break;
 		}
-		case BIGGER:{
+		case BIGGER: bigger:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type != type_t::Number || b.type != type_t::Number)
@@ -166,7 +214,7 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(Value::boolean(a._number > b._number));
 			break;
 		}
-		case SMALLER_OR_EQUAL:{
+		case SMALLER_OR_EQUAL: smaller_or_equal:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type != type_t::Number || b.type != type_t::Number)
@@ -174,7 +222,7 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(Value::boolean(a._number <= b._number));
 			break;
 		}
-		case BIGGER_OR_EQUAL:{
+		case BIGGER_OR_EQUAL: bigger_or_equal:{
 			auto b = ctx->pop();
 			auto a = ctx->pop();
 			if (a.type != type_t::Number || b.type != type_t::Number)
@@ -182,6 +230,123 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->push(Value::boolean(a._number >= b._number));
 			break;
 		}
+		case ADD_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto add;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a._number = a._number + b._number;
+			break;
+		}
+		case SUB_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto sub;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a._number = a._number - b._number;
+			break;
+		}
+		case MUL_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto mul;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a._number = a._number * b._number;
+			break;
+		}
+		case DIV_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto div;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a._number = a._number / b._number;
+			break;
+		}
+		case SMALLER_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto smaller;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a = Value::boolean(a._number < b._number);
+			break;
+		}
+		case BIGGER_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto bigger;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a = Value::boolean(a._number > b._number);
+			break;
+		}
+		case SMALLER_OR_EQUAL_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto smaller_or_equal;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a = Value::boolean(a._number <= b._number);
+			break;
+		}
+		case BIGGER_OR_EQUAL_NUM:{
+			if (!numbers_on_top(ctx, 2))
+				goto bigger_or_equal;
+			auto b = ctx->stack.back();
+			ctx->stack.pop_back();
+			auto &a = ctx->stack.back();
+			a = Value::boolean(a._number >= b._number);
+			break;
+		}
+		case NEG: neg:{
+			auto &a = ctx->stack.back();
+			if (a.type != type_t::Number)
+				throw std::runtime_error("expected number");
+			a._number = 0.0 - a._number;
+			break;
+		}
+		case NEG_NUM:{
+			if (!numbers_on_top(ctx, 1))
+				goto neg;
+			auto &a = ctx->stack.back();
+			a._number = 0.0 - a._number;
+			break;
+		}
+		case LEN: case TYPEOF: case TO_INT:{
+			auto op = opcodes[pc - 1];
+			auto sc = reinterpret_cast<StringContainer*>(opcodes[pc++]);
+			auto cell = reinterpret_cast<Value*>(opcodes[pc++]);
+			if (!intrinsic_bound(sc, cell, opcodes[pc++])) {
+				intrinsic_fallback(ctx, env, sc, cell, 1);
+				break;
+			}
+
+			auto arg = ctx->pop();
+			if (op == LEN)
+				ctx->push(builtin_len(arg));
+			else if (op == TYPEOF)
+				ctx->push(builtin_typeof(ctx, arg));
+			else
+				ctx->push(builtin_to_int(arg));
+			break;
+		}
+		case MOD:{
+			auto sc = reinterpret_cast<StringContainer*>(opcodes[pc++]);
+			auto cell = reinterpret_cast<Value*>(opcodes[pc++]);
+			if (!intrinsic_bound(sc, cell, opcodes[pc++])) {
+				intrinsic_fallback(ctx, env, sc, cell, 2);
+				break;
+			}
+
+			auto a = ctx->pop();
+			auto b = ctx->pop();
+			ctx->push(builtin_mod(a, b));
+			break;
+		}
 		case NOT:{
 			auto a = ctx->pop();
 			if (a.type != type_t::Bool)
@@ -191,9 +356,12 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 		}
 		case MAKE_MAP:{
 			auto n = static_cast<unsigned int>(opcodes[pc++]);
-			auto mc = new MapContainer(ctx);
+			auto mc = new (ctx->heap) MapContainer(ctx);
+			mc->data.reserve(n);
 			for (unsigned int i = 0; i < n; ++i) {
-				mc->set(ctx->pop(), ctx->pop());
+				auto key = ctx->pop();
+				auto val = ctx->pop();
+				mc->set(key, val);
 			}
 
 			ctx->push(Value::map(mc));
@@ -203,9 +371,10 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 		}
 		case MAKE_MAP_ARRLIKE:{
 			auto n = static_cast<unsigned int>(opcodes[pc++]);
-			auto mc = new MapContainer(ctx);
+			auto mc = new (ctx->heap) MapContainer(ctx);
+			mc->vecdata.resize(n);
 			for (unsigned int i = 0; i < n; ++i) {
-				mc->set(Value::number(n - 1- i), ctx->pop());
+				mc->vecdata[n - 1 - i] = ctx->pop();
 			}
 
 			ctx->push(Value::map(mc));
@@ -213,6 +382,13 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 			ctx->check_gc(env);
 			break;
 		}
+		case CLONE_MAP:{
+			auto raw = opcodes[pc++];
+			auto tmpl = reinterpret_cast<MapContainer*>(raw);
+			ctx->push(Value::map(tmpl->clone(ctx)));
+			ctx->check_gc(env);
+			break;
+		}
 		case GET_MAP_VAL:{
 			auto map = ctx->pop();
 			if (map.type != type_t::Map)
@@ -285,6 +461,37 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 				pc = new_pc;
 			break;
 		}
+		case IF_NOT_NUMBER_GOTO:{
+			auto raw = opcodes[pc++];
+			auto sc = reinterpret_cast<StringContainer*>(raw);
+			auto new_pc = static_cast<unsigned int>(opcodes[pc++]);
+			auto val = env->find(sc);
+			if (val == nullptr || val->type != type_t::Number)
+				pc = new_pc;
+			break;
+		}
+		case RESERVE:{
+			auto n = static_cast<unsigned int>(opcodes[pc++]);
+			ctx->stack.resize(ctx->stack.size() + n, Value::nil());
+			break;
+		}
+		case FREE:{
+			auto n = static_cast<unsigned int>(opcodes[pc++]);
+			auto res = ctx->pop();
+			ctx->stack.resize(ctx->stack.size() - n);
+			ctx->push(res);
+			break;
+		}
+		case LOAD_SLOT:{
+			auto n = static_cast<unsigned int>(opcodes[pc++]);
+			ctx->push(ctx->stack[base + n]);
+			break;
+		}
+		case STORE_SLOT:{
+			auto n = static_cast<unsigned int>(opcodes[pc++]);
+			ctx->stack[base + n] = ctx->pop();
+			break;
+		}
 		case NOOP:
 			assert("NOOPs should not happen");
 			break;
@@ -297,3 +504,72 @@ Value asbi::execute(std::vector<OpCode> opcodes, std::shared_ptr<Env> env, Conte
 	assert(ctx->stack.size() == oldstacksize + 1);
 	return ctx->pop();
 }
+
+unsigned int asbi::immediates(OpCode op) {
+	switch (op) {
+	case PUSH_NUMBER: case PUSH_BOOLEAN: case PUSH_SYMBOL: case PUSH_STRING:
+	case PUSH_LAMBDA: case PUSH_STACK_PLACEHOLDER:
+	case CALL: case LOOKUP: case DECL: case SET: case DECL_POP: case SET_POP:
+	case MAKE_MAP: case MAKE_MAP_ARRLIKE: case CLONE_MAP: case DESTRUCT_ARRLIKE:
+	case GOTO: case IF_TRUE_GOTO: case IF_FALSE_GOTO:
+	case RESERVE: case FREE: case LOAD_SLOT: case STORE_SLOT:
+		return 1;
+	case IF_NOT_NUMBER_GOTO: case LOOKUP_GLOBAL:
+		return 2;
+	case LEN: case TYPEOF: case MOD: case TO_INT:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+unsigned int asbi::immediates(OpCode op, Immediate kinds[3]) {
+	auto n = immediates(op);
+	for (unsigned int i = 0; i < n; i++)
+		kinds[i] = Immediate::Raw;
+
+	switch (op) {
+	case PUSH_SYMBOL: case PUSH_STRING: case PUSH_STACK_PLACEHOLDER:
+	case LOOKUP: case DECL: case SET: case DECL_POP: case SET_POP:
+	case IF_NOT_NUMBER_GOTO:
+		kinds[0] = Immediate::String;
+		break;
+	case PUSH_LAMBDA:
+		kinds[0] = Immediate::Lambda;
+		break;
+	case CLONE_MAP:
+		kinds[0] = Immediate::Template;
+		break;
+	case LOOKUP_GLOBAL:
+		kinds[0] = Immediate::String;
+		kinds[1] = Immediate::Cell;
+		break;
+	case LEN: case TYPEOF: case MOD: case TO_INT:
+		kinds[0] = Immediate::String;
+		kinds[1] = Immediate::Cell;
+		kinds[2] = Immediate::Macro;
+		break;
+	default:
+		break;
+	}
+	return n;
+}
+
+OpCode asbi::intrinsic(Context* ctx, StringContainer* name, std::size_t nargs) {
+	static const struct { const char* name; OpCode op; std::size_t nargs; } intrinsics[] = {
+		{ "len",    LEN,    1 },
+		{ "typeof", TYPEOF, 1 },
+		{ "mod",    MOD,    2 },
+		{ "toInt",  TO_INT, 1 },
+	};
+
+	auto builtin = ctx->builtins.find(name);
+	auto cell = ctx->global_cell(name);
+	if (builtin == ctx->builtins.end() || cell == nullptr || cell->type != type_t::Macro || cell->_macro != builtin->second._macro)
+		return NOOP;
+
+	for (auto &intr: intrinsics)
+		if (name->data == intr.name && nargs == intr.nargs)
+			return intr.op;
+	return NOOP;
+}